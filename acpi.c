@@ -0,0 +1,363 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "acpi.h"
+#include "fw_cfg.h"
+#include "page_alloc.h"
+#include "memmap.h"
+#include "datamap.h"
+#include "logging.h"
+
+#define TABLE_LOADER_FILE "etc/table-loader"
+
+/** Commands, as defined by QEMU hw/acpi/bios-linker-loader.c, unknown ones are skipped */
+#define LOADER_ALLOCATE         1
+#define LOADER_ADD_POINTER      2
+#define LOADER_ADD_CHECKSUM     3
+#define LOADER_WRITE_POINTER    4
+
+#define LOADER_ZONE_HIGH        1
+#define LOADER_ZONE_FSEG        2
+
+#define LOADER_MAX_BLOBS        16
+
+/** Pointer patches change at most this many bytes each, checksum writes change one */
+#define LOADER_MAX_PATCH_BYTES  8
+
+#define RSDP_SIGNATURE "RSD PTR "
+
+/** Script entry, all fields are little-endian */
+struct loader_entry {
+    uint32_t command;
+    union {
+        struct {
+            char file[FW_CFG_MAX_FILE_PATH];
+            uint32_t align;
+            uint8_t zone;
+        } __attribute__((packed)) alloc;
+
+        struct {
+            char dest[FW_CFG_MAX_FILE_PATH];
+            char src[FW_CFG_MAX_FILE_PATH];
+            uint32_t offset;
+            uint8_t size;
+        } __attribute__((packed)) pointer;
+
+        struct {
+            char file[FW_CFG_MAX_FILE_PATH];
+            uint32_t offset;
+            uint32_t start;
+            uint32_t length;
+        } __attribute__((packed)) checksum;
+
+        uint8_t pad[124];
+    };
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct loader_entry) == 128, "Bad table-loader entry size");
+
+/** Byte changed after blob was summed, checksums over it are corrected by delta */
+struct patch {
+    uint32_t offset;
+    uint8_t delta;
+};
+
+struct blob {
+    const struct fw_cfg_file* file;
+    uint8_t* data;
+    uint8_t* sums;          /* sums[i] is the sum of data[0..i) as loaded, mod 256 */
+    struct patch* patches;  /* Sorted by offset, one per patched byte */
+    uint32_t npatches;
+    uint32_t max_patches;
+};
+
+struct loader {
+    struct blob blobs[LOADER_MAX_BLOBS];
+    uint32_t nblobs;
+    uint32_t max_patches;   /* Per blob, bounded by what the script can change */
+};
+
+static struct {
+    uint64_t rsdp;
+    uintptr_t fseg_next;
+} acpi;
+
+static struct blob* find_blob(struct loader* l, const char* name)
+{
+    for (uint32_t i = 0; i < l->nblobs; ++i) {
+        if (!strncmp(l->blobs[i].file->name, name, FW_CFG_MAX_FILE_PATH)) {
+            return &l->blobs[i];
+        }
+    }
+
+    LOG_ERROR("acpi: %s is not allocated\n", name);
+    return NULL;
+}
+
+/** Index of the first patch at or after offset */
+static uint32_t find_patch(const struct blob* b, uint32_t offset)
+{
+    uint32_t lo = 0;
+    uint32_t hi = b->npatches;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (b->patches[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Record byte change, repeated changes to a byte add up.
+ * Script patches tables front to back, so insertion is nearly always an append.
+ */
+static void add_patch(struct blob* b, uint32_t offset, uint8_t old, uint8_t new)
+{
+    if (old == new) {
+        return;
+    }
+
+    uint32_t i = find_patch(b, offset);
+    if (i < b->npatches && b->patches[i].offset == offset) {
+        b->patches[i].delta += (uint8_t)(new - old);
+        return;
+    }
+
+    assert(b->npatches < b->max_patches);
+    memmove(&b->patches[i + 1], &b->patches[i], (b->npatches - i) * sizeof(struct patch));
+    b->patches[i] = (struct patch){ offset, (uint8_t)(new - old) };
+    b->npatches++;
+}
+
+static inline unsigned patches_order(const struct blob* b)
+{
+    return page_order(b->max_patches * sizeof(struct patch));
+}
+
+static uint8_t* alloc_fseg(uint32_t size, uint32_t align)
+{
+    uintptr_t base = (acpi.fseg_next + align - 1) & ~(uintptr_t)(align - 1);
+    if (base + size > FSEG_SHADOW_BASE + FSEG_SHADOW_SIZE) {
+        return NULL;
+    }
+
+    acpi.fseg_next = base + size;
+    return (uint8_t*)base;
+}
+
+/** Page blocks are naturally aligned, so any alignment up to block size comes for free */
+static uint8_t* alloc_high(uint32_t size, uint32_t align)
+{
+    unsigned order = page_order(size);
+    if (align > (PAGE_SIZE << order)) {
+        return NULL;
+    }
+
+    uint8_t* data = page_alloc(order);
+    if (data && !memmap_mark((uintptr_t)data, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), E820_RESERVED)) {
+        page_free(data, order);
+        return NULL;
+    }
+
+    return data;
+}
+
+/** Allocate blob, read it from fw_cfg and take its prefix sums in the same pass */
+static bool cmd_allocate(struct loader* l, const struct loader_entry* e)
+{
+    const struct fw_cfg_file* file = fw_cfg_find(e->alloc.file);
+    uint32_t align = e->alloc.align ? e->alloc.align : 1;
+    if (!file || !file->size || (align & (align - 1)) || l->nblobs == LOADER_MAX_BLOBS) {
+        LOG_ERROR("acpi: can't allocate %s\n", e->alloc.file);
+        return false;
+    }
+
+    uint8_t* data = NULL;
+    if (e->alloc.zone == LOADER_ZONE_FSEG) {
+        data = alloc_fseg(file->size, align);
+    } else if (e->alloc.zone == LOADER_ZONE_HIGH) {
+        data = alloc_high(file->size, align);
+    }
+
+    if (!data) {
+        LOG_ERROR("acpi: no room for %s, %u bytes in zone %u\n", file->name, file->size, e->alloc.zone);
+        return false;
+    }
+
+    uint8_t* sums = page_alloc(page_order(file->size + 1));
+    assert(sums);
+
+    /* Patched bytes are merged, so there are no more of them than bytes in blob */
+    struct blob* b = &l->blobs[l->nblobs];
+    *b = (struct blob){ file, data, sums, NULL, 0, file->size < l->max_patches ? file->size : l->max_patches };
+    b->patches = page_alloc(patches_order(b));
+    assert(b->patches);
+
+    fw_cfg_read_file(file, 0, data, file->size);
+
+    uint8_t sum = 0;
+    sums[0] = 0;
+    for (uint32_t i = 0; i < file->size; ++i) {
+        sum += data[i];
+        sums[i + 1] = sum;
+    }
+
+    l->nblobs++;
+    LOG_DEBUG("acpi: %s at 0x%llx, %u bytes\n", file->name, (uint64_t)(uintptr_t)data, file->size);
+    return true;
+}
+
+/** Add physical address of source blob to a little-endian offset into it stored in destination blob */
+static bool cmd_add_pointer(struct loader* l, const struct loader_entry* e)
+{
+    struct blob* dest = find_blob(l, e->pointer.dest);
+    struct blob* src = find_blob(l, e->pointer.src);
+    uint32_t offset = e->pointer.offset;
+    uint8_t size = e->pointer.size;
+    if (!dest || !src) {
+        return false;
+    }
+
+    if ((size != 1 && size != 2 && size != 4 && size != 8) || (uint64_t)offset + size > dest->file->size) {
+        LOG_ERROR("acpi: bad pointer at %s+0x%x\n", dest->file->name, offset);
+        return false;
+    }
+
+    uint8_t* p = dest->data + offset;
+    uint64_t val = 0;
+    memcpy(&val, p, size);
+    val += (uintptr_t)src->data;
+    if (size < 8 && (val >> (size * 8))) {
+        LOG_ERROR("acpi: %s does not fit a %u byte pointer\n", src->file->name, size);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < size; ++i) {
+        uint8_t new = (uint8_t)(val >> (i * 8));
+        add_patch(dest, offset + i, p[i], new);
+        p[i] = new;
+    }
+
+    return true;
+}
+
+/** Make bytes of a range sum up to 0 by adjusting checksum byte within it */
+static bool cmd_add_checksum(struct loader* l, const struct loader_entry* e)
+{
+    struct blob* b = find_blob(l, e->checksum.file);
+    if (!b) {
+        return false;
+    }
+
+    uint32_t offset = e->checksum.offset;
+    uint64_t start = e->checksum.start;
+    uint64_t end = start + e->checksum.length;
+    if (offset >= b->file->size || end > b->file->size) {
+        LOG_ERROR("acpi: bad checksum range in %s\n", b->file->name);
+        return false;
+    }
+
+    uint8_t sum = b->sums[end] - b->sums[start];
+    for (uint32_t i = find_patch(b, start); i < b->npatches && b->patches[i].offset < end; ++i) {
+        sum += b->patches[i].delta;
+    }
+
+    uint8_t old = b->data[offset];
+    b->data[offset] = old - sum;
+    add_patch(b, offset, old, b->data[offset]);
+    return true;
+}
+
+static bool run_script(struct loader* l, struct loader_entry* script, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        struct loader_entry* e = &script[i];
+        bool ok = true;
+
+        /* File names are NUL-terminated by QEMU, make sure of it before we print them */
+        e->pointer.dest[FW_CFG_MAX_FILE_PATH - 1] = '\0';
+        e->pointer.src[FW_CFG_MAX_FILE_PATH - 1] = '\0';
+
+        switch (e->command) {
+        case LOADER_ALLOCATE:
+            ok = cmd_allocate(l, e);
+            break;
+        case LOADER_ADD_POINTER:
+            ok = cmd_add_pointer(l, e);
+            break;
+        case LOADER_ADD_CHECKSUM:
+            ok = cmd_add_checksum(l, e);
+            break;
+        case LOADER_WRITE_POINTER:
+            /* Only devices we don't boot with ask for it, e.g. vmgenid */
+            LOG_DEBUG("acpi: skipping write pointer to %s\n", e->pointer.dest);
+            break;
+        default:
+            break;
+        }
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool init_acpi(void)
+{
+    acpi.rsdp = 0;
+    acpi.fseg_next = FSEG_SHADOW_BASE;
+
+    const struct fw_cfg_file* file = fw_cfg_find(TABLE_LOADER_FILE);
+    if (!file) {
+        LOG_INFO("acpi: no %s\n", TABLE_LOADER_FILE);
+        return false;
+    }
+
+    uint32_t count = file->size / sizeof(struct loader_entry);
+    unsigned script_order = page_order(file->size);
+    struct loader_entry* script = page_alloc(script_order);
+    assert(script);
+    fw_cfg_read_file(file, 0, script, count * sizeof(struct loader_entry));
+
+    struct loader l = { .nblobs = 0 };
+    l.max_patches = count * LOADER_MAX_PATCH_BYTES;
+
+    bool ok = run_script(&l, script, count);
+
+    uint64_t total = 0;
+    uint32_t npatches = 0;
+    for (uint32_t i = 0; i < l.nblobs; ++i) {
+        const struct blob* b = &l.blobs[i];
+        if (ok && !acpi.rsdp && !memcmp(b->data, RSDP_SIGNATURE, sizeof(RSDP_SIGNATURE) - 1)) {
+            acpi.rsdp = (uintptr_t)b->data;
+        }
+        total += b->file->size;
+        npatches += b->npatches;
+        page_free(b->sums, page_order(b->file->size + 1));
+        page_free(b->patches, patches_order(b));
+    }
+
+    page_free(script, script_order);
+
+    if (!ok) {
+        LOG_ERROR("acpi: %s failed, no ACPI tables\n", TABLE_LOADER_FILE);
+        return false;
+    }
+
+    LOG_INFO("acpi: %u blobs, %llu KB, %u patched bytes, rsdp at 0x%llx\n",
+             l.nblobs, total >> 10, npatches, acpi.rsdp);
+    return acpi.rsdp != 0;
+}
+
+uint64_t acpi_rsdp(void)
+{
+    return acpi.rsdp;
+}
@@ -0,0 +1,78 @@
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "alloc_stats.h"
+#include "page_alloc.h"
+#include "heap.h"
+#include "dataseg.h"
+#include "logging.h"
+
+#if ALLOC_TRACE
+
+static struct {
+    uint64_t count;         /* Calls recorded since boot, ring holds the last ALLOC_TRACE_ENTRIES of them */
+    struct alloc_trace_entry entries[ALLOC_TRACE_ENTRIES];
+} alloc_trace_ring;
+
+static const char* const trace_op_names[] = {
+    [ALLOC_TRACE_PAGE_ALLOC] = "page_alloc",
+    [ALLOC_TRACE_PAGE_FREE] = "page_free",
+    [ALLOC_TRACE_HEAP_ALLOC] = "heap_alloc",
+    [ALLOC_TRACE_HEAP_FREE] = "heap_free",
+    [ALLOC_TRACE_DATASEG_ALLOC] = "dataseg_alloc",
+};
+
+void alloc_trace_record(enum alloc_trace_op op, unsigned order, size_t size, bool failed, void* caller)
+{
+    struct alloc_trace_entry* e = &alloc_trace_ring.entries[alloc_trace_ring.count++ % ALLOC_TRACE_ENTRIES];
+    *e = (struct alloc_trace_entry){
+        .caller = (uint32_t)(uintptr_t)caller,
+        .size = size > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)size,
+        .op = op,
+        .order = order,
+        .failed = failed,
+    };
+}
+
+static void trace_report(void)
+{
+    uint64_t count = alloc_trace_ring.count;
+    uint64_t first = count > ALLOC_TRACE_ENTRIES ? count - ALLOC_TRACE_ENTRIES : 0;
+
+    LOG_INFO("alloc: trace of last %llu of %llu calls\n", count - first, count);
+    for (uint64_t i = first; i < count; ++i) {
+        const struct alloc_trace_entry* e = &alloc_trace_ring.entries[i % ALLOC_TRACE_ENTRIES];
+        LOG_INFO("  0x%08x %-13s order %2u %8u bytes%s\n",
+                 e->caller, trace_op_names[e->op], e->order, e->size, e->failed ? " failed" : "");
+    }
+}
+
+#endif
+
+void alloc_stats_log(const char* name, const struct alloc_class_stats* classes, unsigned count,
+                     unsigned first_order, unsigned block_shift, const struct alloc_usage* usage)
+{
+    LOG_INFO("%s: %llu KB live, %llu KB peak\n", name, usage->live >> 10, usage->peak >> 10);
+
+    for (unsigned i = 0; i < count; ++i) {
+        const struct alloc_class_stats* c = &classes[i];
+        if (!c->allocs && !c->failed) {
+            continue;
+        }
+
+        LOG_INFO("  order %2u %10llu B: live %u, peak %u, allocs %u, failed %u, waste %llu B\n",
+                 first_order + i, 1ull << (first_order + i + block_shift),
+                 c->live, c->peak, c->allocs, c->failed, c->waste);
+    }
+}
+
+void alloc_report(void)
+{
+    pages_report();
+    heap_report();
+    dataseg_report();
+
+#if ALLOC_TRACE
+    trace_report();
+#endif
+}
@@ -1,14 +1,70 @@
 #include <inttypes.h>
 
+#include "apic.h"
 #include "io.h"
 #include "logging.h"
 
-#define IA32_APIC_BASE 0x0000001B
+#define IA32_APIC_BASE          0x0000001B
+#define IA32_APIC_BASE_ENABLE   (1ull << 11)
+#define IA32_APIC_BASE_MASK     0x000FFFFFFFFFF000ull
+
+#define APIC_SVR_ENABLE         (1u << 8)
+
+/** ICR low dword fields */
+#define APIC_ICR_INIT           (5u << 8)
+#define APIC_ICR_STARTUP        (6u << 8)
+#define APIC_ICR_PENDING        (1u << 12)
+#define APIC_ICR_ASSERT         (1u << 14)
+#define APIC_ICR_ALL_BUT_SELF   (3u << 18)
+
+uintptr_t apic_mmio_base(void)
+{
+    return rdmsr(IA32_APIC_BASE) & IA32_APIC_BASE_MASK;
+}
+
+static inline volatile uint32_t* apic_reg(uint32_t reg)
+{
+    return (volatile uint32_t*)(apic_mmio_base() + reg);
+}
+
+uint32_t apic_read(uint32_t reg)
+{
+    return *apic_reg(reg);
+}
+
+void apic_write(uint32_t reg, uint32_t val)
+{
+    *apic_reg(reg) = val;
+}
+
+static void send_ipi(uint32_t icr)
+{
+    apic_write(APIC_REG_ICR_HIGH, 0);
+    apic_write(APIC_REG_ICR_LOW, icr);
+
+    while (apic_read(APIC_REG_ICR_LOW) & APIC_ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+void apic_send_init_all(void)
+{
+    send_ipi(APIC_ICR_ALL_BUT_SELF | APIC_ICR_ASSERT | APIC_ICR_INIT);
+}
+
+void apic_send_sipi_all(uint8_t vector)
+{
+    send_ipi(APIC_ICR_ALL_BUT_SELF | APIC_ICR_ASSERT | APIC_ICR_STARTUP | vector);
+}
 
 void init_apic(void)
 {
     uint64_t apic_base = rdmsr(IA32_APIC_BASE);
-    LOG_DEBUG("apic base = 0x%llx", apic_base);
+    LOG_DEBUG("apic base = 0x%llx\n", apic_base);
+
+    if (!(apic_base & IA32_APIC_BASE_ENABLE)) {
+        wrmsr(IA32_APIC_BASE, apic_base | IA32_APIC_BASE_ENABLE);
+    }
 
-    memset(0xFFFF0000, 1, 0);
+    apic_write(APIC_REG_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
 }
@@ -0,0 +1,309 @@
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "cache.h"
+#include "cpu.h"
+#include "io.h"
+#include "memmap.h"
+#include "logging.h"
+
+#define MSR_MTRR_CAP        0xFE
+#define MSR_MTRR_PHYS_BASE0 0x200   /* Followed by PHYS_MASK0, then base and mask pairs for other ranges */
+#define MSR_MTRR_FIX64K     0x250
+#define MSR_MTRR_FIX16K_80  0x258
+#define MSR_MTRR_FIX16K_A0  0x259
+#define MSR_MTRR_FIX4K_C0   0x268   /* Followed by 7 more 4K MSRs up to F8000 */
+#define MSR_PAT             0x277
+#define MSR_MTRR_DEF_TYPE   0x2FF
+
+/** MSR_MTRR_CAP fields */
+#define MTRR_CAP_VCNT       0xFFu
+#define MTRR_CAP_FIX        (1u << 8)
+
+/** MSR_MTRR_DEF_TYPE fields */
+#define MTRR_DEF_FE         (1u << 10)
+#define MTRR_DEF_E          (1u << 11)
+
+/** MSR_MTRR_PHYS_MASK valid bit */
+#define MTRR_MASK_VALID     (1u << 11)
+
+#define CR0_NW (1ul << 29)
+#define CR0_CD (1ul << 30)
+
+#define MTRR_FIXED_COUNT    11
+#define MTRR_VAR_MAX        16
+
+/** Repeat memory type in each byte of a fixed range MSR */
+#define FIXED_TYPE(t)       (0x0101010101010101ull * (t))
+
+#define PAT_ENTRY(i, t)     ((uint64_t)(t) << ((i) * 8))
+#define PAT_VALUE           (PAT_ENTRY(0, MEM_TYPE_WB) | PAT_ENTRY(1, MEM_TYPE_WC) | \
+                             PAT_ENTRY(2, MEM_TYPE_UC_MINUS) | PAT_ENTRY(3, MEM_TYPE_UC) | \
+                             PAT_ENTRY(4, MEM_TYPE_WB) | PAT_ENTRY(5, MEM_TYPE_WP) | \
+                             PAT_ENTRY(6, MEM_TYPE_UC_MINUS) | PAT_ENTRY(7, MEM_TYPE_WT))
+
+/** Layout computed once on BSP and replayed on every AP, MTRRs should be identical on all CPUs */
+struct cache_layout {
+    bool mtrr;
+    bool fixed;
+    bool pat;
+    uint32_t vcnt;                      /* Variable ranges supported, all of them are written */
+    uint32_t nvar;                      /* Variable ranges in use */
+    uint64_t def_type;
+    uint64_t fixed_msrs[MTRR_FIXED_COUNT];
+    uint64_t var[MTRR_VAR_MAX][2];      /* PHYS_BASE and PHYS_MASK */
+};
+
+static struct cache_layout cache_layout;
+
+static const uint32_t fixed_msr_index[MTRR_FIXED_COUNT] = {
+    MSR_MTRR_FIX64K, MSR_MTRR_FIX16K_80, MSR_MTRR_FIX16K_A0,
+    MSR_MTRR_FIX4K_C0 + 0, MSR_MTRR_FIX4K_C0 + 1, MSR_MTRR_FIX4K_C0 + 2, MSR_MTRR_FIX4K_C0 + 3,
+    MSR_MTRR_FIX4K_C0 + 4, MSR_MTRR_FIX4K_C0 + 5, MSR_MTRR_FIX4K_C0 + 6, MSR_MTRR_FIX4K_C0 + 7,
+};
+
+static const char* const type_names[8] = {
+    [MEM_TYPE_UC] = "UC",
+    [MEM_TYPE_WC] = "WC",
+    [2] = "?",
+    [3] = "?",
+    [MEM_TYPE_WT] = "WT",
+    [MEM_TYPE_WP] = "WP",
+    [MEM_TYPE_WB] = "WB",
+    [MEM_TYPE_UC_MINUS] = "UC-",
+};
+
+static inline uint64_t read_cr0(void)
+{
+    uint64_t res;
+    __asm__ volatile ("mov %%cr0, %0" :"=r"(res) ::);
+    return res;
+}
+
+static inline void write_cr0(uint64_t val)
+{
+    __asm__ volatile ("mov %0, %%cr0" ::"r"(val) :"memory");
+}
+
+static inline void flush_tlb(void)
+{
+    uint64_t cr3;
+    __asm__ volatile ("mov %%cr3, %0\n"
+                      "mov %0, %%cr3\n"
+                      :"=r"(cr3) ::"memory");
+}
+
+static inline void wbinvd(void)
+{
+    __asm__ volatile ("wbinvd" :::"memory");
+}
+
+static inline uint64_t irq_save(void)
+{
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0; cli" :"=r"(flags) ::"memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+    __asm__ volatile ("push %0; popfq" ::"r"(flags) :"memory", "cc");
+}
+
+/** Physical address width, MTRR masks cover all of it */
+static unsigned phys_bits(void)
+{
+    if (cpu_info()->max_ext_leaf < 0x80000008) {
+        return 36;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+    return eax & 0xFF;
+}
+
+/** Highest end of RAM below 4G, everything from there up to 4G is PCI hole, APIC, IOAPIC and flash */
+static uint64_t low_ram_top(void)
+{
+    uint64_t top = 0;
+    for (uint32_t i = 0; i < memmap_count(); ++i) {
+        const struct e820_entry* e = memmap_at(i);
+        uint64_t end = e->addr + e->size;
+        if (e->type == E820_RAM && end <= (4ull << 30) && end > top) {
+            top = end;
+        }
+    }
+
+    return top;
+}
+
+/** Largest naturally aligned power of 2 range at base, 4G is aligned to all of them */
+static inline uint64_t range_size(uint64_t base)
+{
+    return base ? base & -base : (4ull << 30);
+}
+
+/** Number of ranges it takes to cover [base, 4G) */
+static uint32_t count_ranges(uint64_t base)
+{
+    uint32_t count = 0;
+    for (; base < (4ull << 30); base += range_size(base)) {
+        ++count;
+    }
+
+    return count;
+}
+
+/** Cover [base, 4G) with UC variable ranges, range sizes grow with base alignment */
+static void add_hole_ranges(struct cache_layout* l, uint64_t base, unsigned pbits)
+{
+    uint64_t addr_mask = (1ull << pbits) - 1;
+    while (base < (4ull << 30)) {
+        uint64_t size = range_size(base);
+        l->var[l->nvar][0] = base | MEM_TYPE_UC;
+        l->var[l->nvar][1] = (~(size - 1) & addr_mask) | MTRR_MASK_VALID;
+        l->nvar++;
+        base += size;
+    }
+}
+
+/**
+ * Write layout to MSRs of calling CPU.
+ * Follows SDM sequence: caches off and flushed, MTRRs disabled while they are updated.
+ */
+static void apply(const struct cache_layout* l)
+{
+    uint64_t flags = irq_save();
+    uint64_t cr0 = read_cr0();
+
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    flush_tlb();
+
+    if (l->mtrr) {
+        wrmsr(MSR_MTRR_DEF_TYPE, 0);
+
+        if (l->fixed) {
+            for (unsigned i = 0; i < MTRR_FIXED_COUNT; ++i) {
+                wrmsr(fixed_msr_index[i], l->fixed_msrs[i]);
+            }
+        }
+
+        /* Unused ranges are cleared as well, we don't want leftovers from whoever ran before us */
+        for (uint32_t i = 0; i < l->vcnt; ++i) {
+            wrmsr(MSR_MTRR_PHYS_BASE0 + i * 2, i < l->nvar ? l->var[i][0] : 0);
+            wrmsr(MSR_MTRR_PHYS_BASE0 + i * 2 + 1, i < l->nvar ? l->var[i][1] : 0);
+        }
+    }
+
+    if (l->pat) {
+        wrmsr(MSR_PAT, PAT_VALUE);
+    }
+
+    wbinvd();
+    flush_tlb();
+
+    if (l->mtrr) {
+        wrmsr(MSR_MTRR_DEF_TYPE, l->def_type);
+    }
+
+    write_cr0(cr0 & ~(CR0_CD | CR0_NW));
+    irq_restore(flags);
+}
+
+/** Read MSRs back, returns number of mismatches */
+static unsigned verify(const struct cache_layout* l)
+{
+    unsigned errors = 0;
+
+    if (l->mtrr) {
+        errors += rdmsr(MSR_MTRR_DEF_TYPE) != l->def_type;
+        for (unsigned i = 0; l->fixed && i < MTRR_FIXED_COUNT; ++i) {
+            errors += rdmsr(fixed_msr_index[i]) != l->fixed_msrs[i];
+        }
+        for (uint32_t i = 0; i < l->nvar; ++i) {
+            errors += rdmsr(MSR_MTRR_PHYS_BASE0 + i * 2) != l->var[i][0];
+            errors += rdmsr(MSR_MTRR_PHYS_BASE0 + i * 2 + 1) != l->var[i][1];
+        }
+    }
+
+    if (l->pat) {
+        errors += rdmsr(MSR_PAT) != PAT_VALUE;
+    }
+
+    return errors;
+}
+
+static void report(const struct cache_layout* l, unsigned pbits)
+{
+    if (!l->mtrr) {
+        LOG_INFO("cache: no MTRRs, memory types are left as is\n");
+    } else {
+        LOG_INFO("cache: default %s, %u of %u variable ranges, fixed ranges %s, %u-bit physical address\n",
+                 type_names[l->def_type & 7], l->nvar, l->vcnt, l->fixed ? "on" : "off", pbits);
+        for (uint32_t i = 0; i < l->nvar; ++i) {
+            uint64_t addr_mask = (1ull << pbits) - 1;
+            uint64_t base = l->var[i][0] & ~0xFFFull;
+            uint64_t size = ((~l->var[i][1] & addr_mask) | 0xFFF) + 1;
+            LOG_INFO("  0x%llx - 0x%llx %s\n", base, base + size, type_names[l->var[i][0] & 7]);
+        }
+    }
+
+    LOG_INFO("cache: PAT %s\n", l->pat ? "WB WC UC- UC WB WP UC- WT" : "not supported");
+}
+
+void init_cache(void)
+{
+    struct cache_layout* l = &cache_layout;
+    unsigned pbits = phys_bits();
+
+    l->pat = cpu_has(CPU_FEATURE_PAT);
+    l->mtrr = cpu_has(CPU_FEATURE_MTRR);
+    if (l->mtrr) {
+        uint64_t cap = rdmsr(MSR_MTRR_CAP);
+        l->fixed = (cap & MTRR_CAP_FIX) != 0;
+        l->vcnt = cap & MTRR_CAP_VCNT;
+        if (l->vcnt > MTRR_VAR_MAX) {
+            l->vcnt = MTRR_VAR_MAX;
+        }
+
+        l->def_type = MEM_TYPE_WB | MTRR_DEF_E | (l->fixed ? MTRR_DEF_FE : 0);
+
+        /* Conventional RAM WB, VGA window UC, C- to F-segs are shadowed to RAM by enable_low_ram and written later */
+        for (unsigned i = 0; i < MTRR_FIXED_COUNT; ++i) {
+            l->fixed_msrs[i] = FIXED_TYPE(fixed_msr_index[i] == MSR_MTRR_FIX16K_A0 ? MEM_TYPE_UC : MEM_TYPE_WB);
+        }
+
+        /* Hole base is lowered until it fits into available ranges, RAM below it then runs UC, but MMIO is never cached */
+        uint64_t hole = (low_ram_top() + 0xFFF) & ~0xFFFull;
+        uint64_t base = hole;
+        while (count_ranges(base) > l->vcnt && base) {
+            base &= base - 1;
+        }
+
+        if (count_ranges(base) > l->vcnt) {
+            /* Not even a single range, cache nothing rather than risk caching MMIO */
+            LOG_ERROR("cache: no variable MTRRs to cover PCI hole, leaving default type UC\n");
+            l->def_type = MEM_TYPE_UC | MTRR_DEF_E | (l->fixed ? MTRR_DEF_FE : 0);
+        } else {
+            if (base != hole) {
+                LOG_ERROR("cache: PCI hole at 0x%llx needs more than %u ranges, RAM from 0x%llx is UC\n", hole, l->vcnt, base);
+            }
+            add_hole_ranges(l, base, pbits);
+        }
+    }
+
+    apply(l);
+
+    unsigned errors = verify(l);
+    if (errors) {
+        LOG_ERROR("cache: %u MSRs did not read back as written\n", errors);
+    }
+
+    report(l, pbits);
+}
+
+void init_cache_ap(void)
+{
+    apply(&cache_layout);
+}
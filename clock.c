@@ -0,0 +1,178 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "clock.h"
+#include "cpu.h"
+#include "io.h"
+#include "logging.h"
+
+/** Hypervisor wants pvclock area within a single page, natural alignment of a power of 2 sized area does that */
+_Static_assert(sizeof(struct pvclock) == 32, "Unexpected pvclock area size");
+struct clock clock_state_data __attribute__((aligned(32)));
+
+/** Hypervisor CPUID leaves */
+#define CPUID_HV_BASE           0x40000000
+#define CPUID_KVM_FEATURES      0x40000001
+#define CPUID_HV_TIMING         0x40000010  /* EAX: TSC frequency in kHz */
+
+/** CPUID_KVM_FEATURES EAX bits */
+#define KVM_FEATURE_CLOCKSOURCE2    (1u << 3)
+
+#define MSR_KVM_SYSTEM_TIME_NEW 0x4B564D01
+#define KVM_SYSTEM_TIME_ENABLE  1
+
+/** PIT channel 2, gated and sensed through port 0x61 */
+#define PIT_CH2         ((uint16_t)0x42)
+#define PIT_CMD         ((uint16_t)0x43)
+#define PIT_CTRL        ((uint16_t)0x61)
+#define PIT_CTRL_GATE2  0x01
+#define PIT_CTRL_SPKR   0x02
+#define PIT_CTRL_OUT2   0x20
+#define PIT_HZ          1193182ull
+#define PIT_CALIBRATE_MS 10
+
+/** Returns true if we run under KVM, max hypervisor leaf goes to max_leaf */
+static bool detect_kvm(uint32_t* max_leaf)
+{
+    if (!cpu_has(CPU_FEATURE_HYPERVISOR)) {
+        return false;
+    }
+
+    uint32_t sig[3];
+    cpuid(CPUID_HV_BASE, 0, max_leaf, &sig[0], &sig[1], &sig[2]);
+    return memcmp(sig, "KVMKVMKVM\0\0\0", sizeof(sig)) == 0;
+}
+
+/** Measure TSC against PIT channel 2 in one-shot mode */
+static uint64_t pit_tsc_hz(void)
+{
+    uint16_t latch = PIT_HZ * PIT_CALIBRATE_MS / 1000;
+
+    out8(PIT_CTRL, (in8(PIT_CTRL) & ~PIT_CTRL_SPKR) | PIT_CTRL_GATE2);
+
+    /* Channel 2, lobyte/hibyte, mode 0: OUT2 goes high on terminal count */
+    out8(PIT_CMD, 0xB0);
+    out8(PIT_CH2, latch & 0xFF);
+    out8(PIT_CH2, latch >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(in8(PIT_CTRL) & PIT_CTRL_OUT2)) {
+        ;
+    }
+    uint64_t end = rdtsc();
+
+    return (end - start) * 1000 / PIT_CALIBRATE_MS;
+}
+
+/** TSC frequency from CPUID, 0 if it is not reported */
+static uint64_t cpuid_tsc_hz(bool kvm, uint32_t hv_max_leaf, const char** source)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (kvm && hv_max_leaf >= CPUID_HV_TIMING) {
+        cpuid(CPUID_HV_TIMING, 0, &eax, &ebx, &ecx, &edx);
+        if (eax) {
+            *source = "cpuid 0x40000010";
+            return eax * 1000ull;
+        }
+    }
+
+    /* TSC/crystal ratio is EBX/EAX, ECX is crystal frequency if it is enumerated */
+    if (cpu_info()->max_leaf >= 0x15) {
+        cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+        if (eax && ebx && ecx) {
+            *source = "cpuid 0x15";
+            return (uint64_t)ecx * ebx / eax;
+        }
+    }
+
+    /* Base frequency in MHz, it matches TSC on parts that have no leaf 0x15 crystal */
+    if (cpu_info()->max_leaf >= 0x16) {
+        cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+        if (eax & 0xFFFF) {
+            *source = "cpuid 0x16";
+            return (eax & 0xFFFF) * 1000000ull;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find mul and shift such that ((delta << shift) * mul) >> 32 converts hz ticks to nanoseconds,
+ * same as hypervisors do for pvclock.
+ */
+static void time_scale(uint64_t hz, uint32_t* mul, int8_t* shift)
+{
+    uint64_t scaled = NSEC_PER_SEC;
+    uint64_t tps = hz;
+    int s = 0;
+
+    while (tps > scaled * 2 || (tps >> 32)) {
+        tps >>= 1;
+        --s;
+    }
+
+    uint32_t tps32 = (uint32_t)tps;
+    while (tps32 <= scaled || (scaled >> 32)) {
+        if ((scaled >> 32) || (tps32 & 0x80000000)) {
+            scaled >>= 1;
+        } else {
+            tps32 <<= 1;
+        }
+        ++s;
+    }
+
+    *shift = s;
+    *mul = (uint32_t)((scaled << 32) / tps32);
+}
+
+void init_clock(void)
+{
+    struct clock* clock = clock_state();
+    memset(clock, 0, sizeof(*clock));
+
+    uint32_t hv_max_leaf = 0;
+    bool kvm = detect_kvm(&hv_max_leaf);
+
+    const char* source = NULL;
+    uint64_t hz = cpuid_tsc_hz(kvm, hv_max_leaf, &source);
+
+    if (kvm && hv_max_leaf >= CPUID_KVM_FEATURES) {
+        uint32_t features, ebx, ecx, edx;
+        cpuid(CPUID_KVM_FEATURES, 0, &features, &ebx, &ecx, &edx);
+        if (features & KVM_FEATURE_CLOCKSOURCE2) {
+            wrmsr(MSR_KVM_SYSTEM_TIME_NEW, (uintptr_t)&clock->pvclock | KVM_SYSTEM_TIME_ENABLE);
+            clock->kvmclock = true;
+        }
+    }
+
+    if (!clock->kvmclock) {
+        if (!hz) {
+            hz = pit_tsc_hz();
+            source = "pit";
+        }
+
+        /* Static pvclock: tsc_timestamp and system_time stay 0 */
+        time_scale(hz, &clock->pvclock.tsc_to_system_mul, &clock->pvclock.tsc_shift);
+    }
+
+    clock->base_ns = 0;
+    clock->base_ns = now_ns();
+
+    if (clock->kvmclock) {
+        LOG_INFO("clock: kvmclock\n");
+    } else {
+        LOG_INFO("clock: tsc %llu kHz from %s\n", hz / 1000, source);
+    }
+}
+
+void clock_shutdown(void)
+{
+    struct clock* clock = clock_state();
+    if (clock->kvmclock) {
+        wrmsr(MSR_KVM_SYSTEM_TIME_NEW, 0);
+        clock->kvmclock = false;
+    }
+}
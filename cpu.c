@@ -0,0 +1,99 @@
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "logging.h"
+
+#define CR4_OSXSAVE (1ul << 18)
+
+/** XCR0 state components */
+#define XCR0_X87    (1ul << 0)
+#define XCR0_SSE    (1ul << 1)
+#define XCR0_AVX    (1ul << 2)
+
+/** Zeroed until init_cpu, so memory routines take their baseline SSE2 paths before that */
+struct cpu_info cpu_info_cache;
+
+static inline uint64_t read_cr4(void)
+{
+    uint64_t res;
+    __asm__ volatile ("mov %%cr4, %0" :"=r"(res) ::);
+    return res;
+}
+
+static inline void write_cr4(uint64_t val)
+{
+    __asm__ volatile ("mov %0, %%cr4" ::"r"(val) :"memory");
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t val)
+{
+    __asm__ volatile ("xsetbv" ::"c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)) :);
+}
+
+static inline void cpu_clear_feature(struct cpu_info* info, enum cpu_feature feature)
+{
+    info->words[feature >> 5] &= ~(1u << (feature & 31));
+}
+
+static bool enable_avx(struct cpu_info* info)
+{
+    if (!cpu_has(CPU_FEATURE_XSAVE) || !cpu_has(CPU_FEATURE_AVX) || info->max_leaf < 0xD) {
+        return false;
+    }
+
+    /* Check that AVX state is supported by XSAVE */
+    uint32_t xcr0_lo, ebx, ecx, xcr0_hi;
+    cpuid(0xD, 0, &xcr0_lo, &ebx, &ecx, &xcr0_hi);
+    if ((xcr0_lo & (XCR0_X87 | XCR0_SSE | XCR0_AVX)) != (XCR0_X87 | XCR0_SSE | XCR0_AVX)) {
+        return false;
+    }
+
+    write_cr4(read_cr4() | CR4_OSXSAVE);
+    xsetbv(0, XCR0_X87 | XCR0_SSE | XCR0_AVX);
+    return true;
+}
+
+void init_cpu_ap(void)
+{
+    if (cpu_has(CPU_FEATURE_AVX)) {
+        write_cr4(read_cr4() | CR4_OSXSAVE);
+        xsetbv(0, XCR0_X87 | XCR0_SSE | XCR0_AVX);
+    }
+}
+
+void init_cpu(void)
+{
+    /* Memory routines should not be used until we're done */
+    struct cpu_info* info = &cpu_info_cache;
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &info->max_leaf, &ebx, &ecx, &edx);
+    cpuid(0x80000000, 0, &info->max_ext_leaf, &ebx, &ecx, &edx);
+
+    cpuid(1, 0, &eax, &ebx, &info->words[CPU_WORD_1_ECX], &info->words[CPU_WORD_1_EDX]);
+
+    if (info->max_leaf >= 7) {
+        cpuid(7, 0, &eax, &info->words[CPU_WORD_7_EBX], &info->words[CPU_WORD_7_ECX], &info->words[CPU_WORD_7_EDX]);
+    } else {
+        info->words[CPU_WORD_7_EBX] = info->words[CPU_WORD_7_ECX] = info->words[CPU_WORD_7_EDX] = 0;
+    }
+
+    if (info->max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &info->words[CPU_WORD_81_ECX], &info->words[CPU_WORD_81_EDX]);
+    } else {
+        info->words[CPU_WORD_81_ECX] = info->words[CPU_WORD_81_EDX] = 0;
+    }
+
+    if (enable_avx(info)) {
+        info->words[CPU_WORD_1_ECX] |= 1u << (CPU_FEATURE_OSXSAVE & 31);
+    } else {
+        cpu_clear_feature(info, CPU_FEATURE_AVX);
+        cpu_clear_feature(info, CPU_FEATURE_AVX2);
+    }
+
+    LOG_DEBUG("cpu: leaf1 %x:%x, leaf7 %x:%x:%x, ext %x:%x\n",
+        info->words[CPU_WORD_1_ECX], info->words[CPU_WORD_1_EDX],
+        info->words[CPU_WORD_7_EBX], info->words[CPU_WORD_7_ECX], info->words[CPU_WORD_7_EDX],
+        info->words[CPU_WORD_81_ECX], info->words[CPU_WORD_81_EDX]);
+}
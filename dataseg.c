@@ -4,49 +4,76 @@
 #include <stdlib.h>
 
 #include "dataseg.h"
-#include "datamap.h"
+#include "memmap.h"
+#include "page_alloc.h"
+#include "scrub.h"
+#include "alloc_stats.h"
+#include "logging.h"
 
-#if !defined(DATASEG_BASE)
-#   error DATASEG_BASE must be defined
+/** Heap metadata is the biggest tenant and heap gets 1/256 of RAM, so 1/4096 leaves plenty of room */
+#define DATASEG_SCALE_SHIFT 12
+#define DATASEG_SIZE_MIN    (16ul << 10)
+#define DATASEG_SIZE_MAX    (256ul << 10)
+
+#if defined(DATASEG_BASE) && defined(DATASEG_SIZE)
+_Static_assert((DATASEG_BASE & (HEAP_PTR_ALIGNMENT - 1)) == 0, "Bad dataseg alignment");
 #endif
 
-#if !defined(DATASEG_SIZE)
-#   error DATASEG_SIZE must be defined
+static struct {
+    uintptr_t base;
+    size_t size;
+    size_t offset;
+    uint32_t allocs;
+} dataseg;
+
+void init_dataseg(void)
+{
+#if defined(DATASEG_BASE) && defined(DATASEG_SIZE)
+    uintptr_t base = DATASEG_BASE;
+    size_t size = DATASEG_SIZE;
+#else
+    size_t size = memmap_scale(DATASEG_SCALE_SHIFT, DATASEG_SIZE_MIN, DATASEG_SIZE_MAX);
+    uintptr_t base = (uintptr_t)page_alloc(page_order(size));
+    assert(base);
 #endif
 
-_Static_assert((DATASEG_BASE & (HEAP_PTR_ALIGNMENT - 1)) == 0, "Bad dataseg alignment");
-_Static_assert(DATASEG_SIZE > sizeof(uintptr_t), "Dataseg size too small");
+    dataseg.base = base;
+    dataseg.size = size;
+    dataseg.offset = 0;
+    dataseg.allocs = 0;
+
+    LOG_INFO("dataseg: 0x%llx, %llu KB\n", (uint64_t)base, (uint64_t)size >> 10);
+}
 
-static void* alloc_at(size_t offset, size_t size)
+void* dataseg_alloc(size_t size)
 {
-    uintptr_t ptr = DATASEG_BASE + offset;
+    uintptr_t ptr = dataseg.base + dataseg.offset;
 
-    offset += (size + (HEAP_PTR_ALIGNMENT - 1)) & ~(HEAP_PTR_ALIGNMENT - 1);
-    if (offset >= DATASEG_SIZE) {
+    size_t offset = dataseg.offset + ((size + (HEAP_PTR_ALIGNMENT - 1)) & ~(HEAP_PTR_ALIGNMENT - 1));
+    alloc_trace(ALLOC_TRACE_DATASEG_ALLOC, 0, size, offset > dataseg.size, __builtin_return_address(0));
+    if (offset > dataseg.size) {
+        LOG_ERROR("dataseg: out of space for %llu bytes, %llu of %llu bytes left\n",
+                  (uint64_t)size, (uint64_t)(dataseg.size - dataseg.offset), (uint64_t)dataseg.size);
         abort();
     }
 
     /* assert that new offset is still properly aligned */
     assert((offset & (HEAP_PTR_ALIGNMENT - 1)) == 0);
-    *(uintptr_t*)DATASEG_BASE = offset;
+    dataseg.offset = offset;
+    dataseg.allocs++;
 
     return (void*)ptr;
 }
 
-void init_dataseg(void)
-{
-    /* Dataseg base contains current offset, make an initial allocation to store it there */
-    (void) alloc_at(0, sizeof(uintptr_t));
-}
-
-
-void* dataseg_alloc(size_t size)
+void dataseg_report(void)
 {
-    /* TODO: add debug tracing */
-    return alloc_at(*(uintptr_t*)DATASEG_BASE, size);
+    LOG_INFO("dataseg: %llu of %llu KB used in %u allocations, %llu bytes left\n",
+             (uint64_t)dataseg.offset >> 10, (uint64_t)dataseg.size >> 10, dataseg.allocs,
+             (uint64_t)(dataseg.size - dataseg.offset));
 }
 
 void dataseg_scrub(void)
 {
-    memset((void*)DATASEG_BASE, 0, DATASEG_SIZE);
+    scrub_range(dataseg.base, dataseg.size, 0);
+    dataseg.offset = 0;
 }
@@ -3,6 +3,7 @@
 ;
 
 %include "asm/logging.inc"
+%include "asm/timeline.inc"
 
 ; Segment layout
 %define FSEG_BASE 0xffff0000
@@ -19,16 +20,30 @@
 ; Base address for exception handler trampolines
 %define EXCP_TABLE_BASE ESEG_BASE
 
+; Profiler LAPIC timer vector, keep in sync with include/profile.h
+%define PROFILE_VECTOR 32
+
+; LAPIC spurious interrupt vector, keep in sync with include/apic.h
+%define SPURIOUS_VECTOR 33
+
 ; Work around ELF 32-bit relocations for 16-bit code to make sure R_X86_64_16 will fit
 ; This is because our linker script currently uses high memory addresses
 %define FSEGREL16(var) var - 0xffff0000
 
-; Base address for PML4 page tables
+; Base address for PML4 page tables, keep in sync with PAGE_TABLES_BASE in include/datamap.h
 %define PAGE_SIZE   0x1000
 %define PML4_BASE   0x100000
 %define PDPE_BASE   PML4_BASE + PAGE_SIZE
 %define PDE_BASE    PDPE_BASE + PAGE_SIZE
-%define PTE_BASE    PDE_BASE + PAGE_SIZE * 4
+
+; Page tables sit above 1M, real mode code reaches them through es = 0xFFFF
+%define PT_SEG              0xFFFF
+%define PTSEGREL16(addr)    ((addr) - (PT_SEG << 4))
+
+; Page table entry flags
+%define PTE_P       (1 << 0)
+%define PTE_RW      (1 << 1)
+%define PTE_PS      (1 << 7)
 
 struc gdt_desc
     .lim_low:   resw 1
@@ -149,39 +164,27 @@ gdt32:
         at desc_table_ptr32.base,     dd gdt_start
     iend
 
+global gdt64
 gdt64:
     istruc desc_table_ptr64
         at desc_table_ptr64.limit,    dw (gdt_end - gdt_start - 1)
         at desc_table_ptr64.base,     dq gdt_start
     iend
 
-; Generate 32-bit idt trap descriptors
+; Generate 64-bit idt descriptors: trap gates for exceptions, interrupt gates for profiler timer and LAPIC spurious
 ; Each descriptor will point to 8-byte aligned trampoline starting at address 0
 ; Trampoline jump table is generated in a code section
-idt32_start:
-    %assign i 0
-    %rep 32 
-        make_idt_trap32 EXCP_TABLE_BASE + (i << 3)
-    %assign i i + 1
-    %endrep    
-idt32_end:
-
-idt32:
-    istruc desc_table_ptr32
-        at desc_table_ptr32.limit,    dw (idt32_end - idt32_start - 1)
-        at desc_table_ptr32.base,     dd idt32_start
-    iend
-
-; Generate 64-bit idt trap descriptors
-; Each descriptor points to the same trampoline as for 32-bit case
 idt64_start:
     %assign i 0
     %rep 32
         make_idt_trap64 EXCP_TABLE_BASE + (i << 3)
     %assign i i + 1
     %endrep
+    make_idt_intr64 EXCP_TABLE_BASE + (PROFILE_VECTOR << 3)
+    make_idt_intr64 EXCP_TABLE_BASE + (SPURIOUS_VECTOR << 3)
 idt64_end:
 
+global idt64
 idt64:
     istruc desc_table_ptr64
         at desc_table_ptr64.limit,    dw (idt64_end - idt64_start - 1)
@@ -197,7 +200,6 @@ bad_bist_str: db 'Bad BIST on startup: ', 0
 ; Exception jump table to jump to relocatable entries
 ; Located at fixed address (E-seg base)
 ; IDT points to jmp entries in descriptors (which cannot hold relocatable entries)
-; Both 32 and 64-bit IDTs use the same trampolines below
 section .excp_tbl exec
 use32
 
@@ -209,35 +211,85 @@ use32
 %endmacro
 
 %assign i 0
-%rep 32 
+%rep 34
     isr_trampoline i
 %assign i i + 1
 %endrep
 
-; Relocatable exception handlers
-section .code32 exec
-use32
+; Relocatable interrupt handlers
+section .code64 exec
+use64
 
-; C generic entry for exceptions
 extern exception_handler
+extern profile_tick
+
+; Save general purpose registers below vector and error code, see struct interrupt_frame in include/isr.h
+%macro isr_save 0
+    push    rax
+    push    rbx
+    push    rcx
+    push    rdx
+    push    rsi
+    push    rdi
+    push    rbp
+    push    r8
+    push    r9
+    push    r10
+    push    r11
+    push    r12
+    push    r13
+    push    r14
+    push    r15
+    cld
+%endmacro
+
+%macro isr_restore 0
+    pop     r15
+    pop     r14
+    pop     r13
+    pop     r12
+    pop     r11
+    pop     r10
+    pop     r9
+    pop     r8
+    pop     rbp
+    pop     rdi
+    pop     rsi
+    pop     rdx
+    pop     rcx
+    pop     rbx
+    pop     rax
+    ; Drop vector and error code
+    add     rsp, 16
+%endmacro
+
+; Call C handler with frame pointer as the only argument on a 16-byte aligned stack
+%macro isr_call 1
+    mov     rdi, rsp
+    mov     rbx, rsp
+    and     rsp, ~15
+    mov     eax, %1
+    call    rax
+    mov     rsp, rbx
+%endmacro
 
 %macro excp_entry 1
-    pushad
-    push    esp ; Exception frame pointer
-    push    dword %1
-    call    exception_handler
-    add     esp, 8
-    popad
-    add     esp, 4
-    iret
+    push    qword %1
+    jmp     excp_common
 %endmacro
 
 %macro excp_entry_no_error 1
     ; Push fake error code to align with normal frame pointer
-    push    dword 0
+    push    qword 0
     excp_entry %1
 %endmacro
 
+excp_common:
+    isr_save
+    isr_call exception_handler
+    isr_restore
+    iretq
+
 isr0: excp_entry_no_error 0
 isr1: excp_entry_no_error 1
 isr2: excp_entry_no_error 2
@@ -272,133 +324,130 @@ isr29:
 isr30:
 isr31: ud2
 
+; Profiler timer, see include/profile.h
+isr32:
+    push    qword 0
+    push    qword PROFILE_VECTOR
+    isr_save
+    isr_call profile_tick
+    isr_restore
+    iretq
+
+; LAPIC spurious interrupt, see include/apic.h
+; Spurious interrupts are not in service, so there is nothing to acknowledge
+isr33:
+    iretq
+
 
 ; ------------------------------------------------------------------------------
-; Reset vector entry point and PM init
+; Reset vector entry point and LM init
 ; * Maskable interrupts disabled
 ; * NMIs enabled.
 ;   NMIs happen either if watchdog delivers interrupts as NMI through APIC (and we didn't program it yet),
 ;   or if hardware is failing (and then we're fucked anyway).
+;
+; We go from real mode straight to long mode: page tables are built from real mode
+; and CR0.PE and CR0.PG are set at once, skipping 32-bit protected mode entirely.
 section .code16 exec
 use16
 
 %define lgdtl o32 lgdt
-%define lidtl o32 lidt
 
 init16:
+    ; Keep BIST status while we stamp reset time
+    mov     ebp, eax
+    _timeline_init
+    _tsc_stamp BOOT_PHASE_RESET
+
     ; Check BIST status
-    test    eax, eax
-    jz      .enter_pm
-    mov     ebx, eax
+    test    ebp, ebp
+    jz      .enter_lm
+    mov     ebx, ebp
     mov     si, FSEGREL16(bad_bist_str)
     _puts
     _putdw  ebx
     _putline
     hlt
-    
-.enter_pm:
-    ; Point data segment to low bios mapping
-    mov     ax, 0xf000
-    mov     ds, ax
 
+.enter_lm:
     ; enable A20
     in      al, 0x92
     or      al, 2
     out     0x92, al
 
-    ; Load gdt and switch to pm
-    lgdtl   [FSEGREL16(gdt32)]
-    lidtl   [FSEGREL16(idt32)]
-    mov     eax, 0x40000001 
-    mov     cr0, eax
-
-    ; Switch to PM code segment
-    jmp     SEL_CODE32:dword .now_in_protected_mode
-
-.now_in_protected_mode:
-use32
-    mov     ax, SEL_DATA
-    mov     ds, ax
-    mov     es, ax
-    mov     fs, ax
-    mov     gs, ax
-    mov     ss, ax
-
-    ; Set stack to low 4k memory
-    mov     esp, STACK_BASE
-
     ;
-    ; Prepare for LME
+    ; Setup 4GB identity mapped page tables with large pages
     ;
 
-    ; CR4.PAE = 1, CR4.PGE = 1
-    mov     eax, 0x00000020
-    mov     cr4, eax
-    
-    ;
-    ; Setup 4GB identity mapped page tables
-    ;
-    
-    ; Setup PML4E table page (with 1 entry)
-    mov     ebx, PML4_BASE
+    mov     ax, PT_SEG
+    mov     es, ax
 
+    ; Clear PML4 and PDPT pages
+    cld
     xor     eax, eax
-    mov     ecx, PAGE_SIZE
-    mov     edi, PML4_BASE
-    rep     stosb
-
-    mov     eax, PDPE_BASE | 0b00000011
-    mov     [ebx], eax
-    mov     [ebx + 4], dword 0
-    add     ebx, PAGE_SIZE
+    mov     di, PTSEGREL16(PML4_BASE)
+    mov     cx, PAGE_SIZE * 2 / 4
+    rep     stosd
 
+    ; Setup PML4E table page (with 1 entry)
+    mov     dword [es:PTSEGREL16(PML4_BASE)], PDPE_BASE | PTE_P | PTE_RW
+
+    ; Use 1GB pages if CPUID.80000001h:EDX.Page1GB is reported
+    mov     eax, 0x80000000
+    cpuid
+    cmp     eax, 0x80000001
+    jb      .map_2m_pages
+    mov     eax, 0x80000001
+    cpuid
+    test    edx, (1 << 26)
+    jz      .map_2m_pages
+
+    ; Setup PDPE table page with 4 1GB pages, high dwords are already cleared
+    mov     di, PTSEGREL16(PDPE_BASE)
+    mov     eax, PTE_P | PTE_RW | PTE_PS
+    mov     cx, 4
+.pdpe_1g_setup_loop:
+    mov     [es:di], eax
+    add     eax, (1 << 30)
+    add     di, 8
+    loop    .pdpe_1g_setup_loop
+    jmp     .page_tables_done
+
+.map_2m_pages:
     ; Setup PDPE table page (with 4 entries)
-    xor     eax, eax
-    mov     edi, PDPE_BASE
-    mov     ecx, PAGE_SIZE
-    rep     stosb
-
-    mov     ebx, PDPE_BASE
-    mov     eax, PDE_BASE | 0b00000001
-    mov     [ebx], eax
-    mov     [ebx + 4], dword 0
-    add     eax, PAGE_SIZE
-    mov     [ebx + 8], eax
-    mov     [ebx + 12], dword 0
-    add     eax, PAGE_SIZE
-    mov     [ebx + 16], eax
-    mov     [ebx + 20], dword 0
+    mov     di, PTSEGREL16(PDPE_BASE)
+    mov     eax, PDE_BASE | PTE_P | PTE_RW
+    mov     cx, 4
+.pdpe_setup_loop:
+    mov     [es:di], eax
     add     eax, PAGE_SIZE
-    mov     [ebx + 24], eax
-    mov     [ebx + 28], dword 0
+    add     di, 8
+    loop    .pdpe_setup_loop
 
-    ; Setup 4 PDE table pages
-    mov     ebx, PDE_BASE
-    mov     eax, PTE_BASE | 0b00000011
-    mov     ecx, 512 * 4
+    ; Setup 4 PDE table pages with 2MB pages
+    mov     di, PTSEGREL16(PDE_BASE)
+    mov     eax, PTE_P | PTE_RW | PTE_PS
+    mov     cx, 512 * 4
 .pde_setup_loop:
-    mov     [ebx], eax
-    mov     [ebx + 4], dword 0
-    add     eax, PAGE_SIZE
-    add     ebx, 8
-    dec     ecx
-    cmp     ecx, 0
-    jne     .pde_setup_loop
+    mov     [es:di], eax
+    mov     dword [es:di + 4], 0
+    add     eax, (1 << 21)
+    add     di, 8
+    loop    .pde_setup_loop
+
+.page_tables_done:
+    _tsc_stamp BOOT_PHASE_PAGE_TABLES
+
+    ; Point data segment to low bios mapping and load gdt
+    mov     ax, 0xf000
+    mov     ds, ax
+    lgdtl   [FSEGREL16(gdt32)]
+
+    ; CR4.PAE = 1, CR4.OSFXSR = 1, CR4.OSXMMEXCPT = 1
+    ; SSE is enabled early since compiled C code is free to use it
+    mov     eax, 0x00000620
+    mov     cr4, eax
 
-    ; Setup 8MB worth of PTEs
-    mov     ebx, PTE_BASE
-    xor     eax, eax
-    or      eax, 0b00000011
-    mov     ecx, (1 << 20)
-.pte_setup_loop:
-    mov     [ebx], eax
-    mov     [ebx + 4], dword 0
-    add     eax, PAGE_SIZE
-    add     ebx, 8
-    dec     ecx
-    cmp     ecx, 0
-    jne     .pte_setup_loop
-    
     ; Point CR3 to PML4
     mov     eax, PML4_BASE
     mov     cr3, eax
@@ -409,9 +458,10 @@ use32
     or      eax, 0x100
     wrmsr
 
-    ; Activate paging, which will transition us to compatibility mode
-    mov     eax, cr0
-    or      eax, 0x80000000
+    ; Activate protected mode and paging at once, which will transition us to compatibility mode
+    ; CR0.MP = 1 and CR0.EM = 0 for SSE
+    ; CR0.CD = 0 and CR0.NW = 0, memory is still UC until init_cache enables MTRRs
+    mov     eax, 0x80000003
     mov     cr0, eax
 
 .now_in_compatibility_mode:
@@ -422,7 +472,22 @@ section .code64 exec
 use64
 extern _start
 
+; C stage layout, see image.lds
+extern _stage_start
+extern _stage_load
+extern _stage_size
+extern _bss_start
+extern _bss_size
+
 .now_in_64bit_mode:
+    ; Data segments still hold real mode values
+    mov     ax, SEL_DATA
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     gs, ax
+    mov     ss, ax
+
     ; Initialize 64bit GDTR, IDTR and RSP
     ; Note: lidt/lgdt a32 address override prefix is used so that addresses will _not_ be sign-extended
     mov     rsp, qword STACK_BASE
@@ -435,8 +500,24 @@ extern _start
     and     eax, (1 << 10)
     jz      abort
 
-    ; Call C entry point
-    call    _start
+    _tsc_stamp BOOT_PHASE_LONG_MODE
+
+    ; Copy C stage from ROM to RAM it is linked at and clear its .bss
+    cld
+    mov     esi, _stage_load
+    mov     edi, _stage_start
+    mov     ecx, _stage_size
+    rep     movsb
+    xor     eax, eax
+    mov     edi, _bss_start
+    mov     ecx, _bss_size
+    rep     stosb
+
+    _tsc_stamp BOOT_PHASE_STAGE
+
+    ; Call C entry point, it is too far away for a relative call
+    mov     eax, _start
+    call    rax
 
     ; TODO: report exit status to fw_cfg?
     hlt
@@ -444,6 +525,47 @@ extern _start
 global abort
 abort: ud2
 
+; PVH kernel entry: leave long mode for 32-bit protected mode with paging off
+; @edi  Kernel entry point
+; @esi  hvm_start_info physical address
+global pvh_enter
+pvh_enter:
+    cli
+    mov     ebp, edi
+    mov     ebx, esi
+
+    ; Far return to 32-bit code segment puts us in compatibility mode
+    push    qword SEL_CODE32
+    mov     eax, pvh_enter32
+    push    rax
+    o64 retf
+
+section .code32 exec
+use32
+
+pvh_enter32:
+    ; We run from identity mapped ROM, so turning paging off is safe
+    mov     eax, cr0
+    and     eax, 0x7FFFFFFF
+    mov     cr0, eax
+
+    ; Clear EFER.LME, then CR4.PAE and friends
+    mov     ecx, 0xC0000080
+    rdmsr
+    and     eax, ~0x100
+    wrmsr
+    xor     eax, eax
+    mov     cr4, eax
+
+    mov     ax, SEL_DATA
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     gs, ax
+    mov     ss, ax
+
+    jmp     ebp
+
 section .resetvector16 exec
 use16
     jmp     init16
@@ -0,0 +1,279 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "fw_cfg.h"
+#include "io.h"
+#include "page_alloc.h"
+#include "logging.h"
+
+#define FW_CFG_PORT_SEL     ((uint16_t)0x510)
+#define FW_CFG_PORT_DATA    ((uint16_t)0x511)
+#define FW_CFG_PORT_DMA     ((uint16_t)0x514)
+
+/** FW_CFG_ID feature bits */
+#define FW_CFG_VERSION_DMA  (1u << 1)
+
+/** DMA control bits */
+#define FW_CFG_DMA_ERROR    (1u << 0)
+#define FW_CFG_DMA_READ     (1u << 1)
+#define FW_CFG_DMA_SKIP     (1u << 2)
+#define FW_CFG_DMA_SELECT   (1u << 3)
+
+/** "QEMU" */
+#define FW_CFG_SIGNATURE_VALUE 0x554D4551
+
+/** DMA access descriptor, all fields are big-endian */
+struct fw_cfg_dma {
+    uint32_t control;
+    uint32_t length;
+    uint64_t address;
+};
+
+/** File index, allocated from page allocator */
+struct fw_cfg_index {
+    bool dma;
+    uint32_t count;
+    struct fw_cfg_file files[];
+};
+
+static struct fw_cfg_index* fw_cfg_index;
+
+static inline void insb(uint16_t port, void* buf, size_t n)
+{
+    __asm__ volatile ("rep insb" :"+D"(buf), "+c"(n) :"d"(port) :"memory");
+}
+
+/**
+ * Run a single DMA transfer.
+ * Descriptor lives on our stack, which is identity mapped, so its address is physical.
+ */
+static void dma_transfer(uint32_t control, void* buf, uint32_t size)
+{
+    volatile struct fw_cfg_dma dma = {
+        .control = __builtin_bswap32(control),
+        .length = __builtin_bswap32(size),
+        .address = __builtin_bswap64((uintptr_t)buf),
+    };
+
+    uint64_t addr = (uintptr_t)&dma;
+    out32(FW_CFG_PORT_DMA, __builtin_bswap32((uint32_t)(addr >> 32)));
+    out32(FW_CFG_PORT_DMA + 4, __builtin_bswap32((uint32_t)addr));
+
+    /* Device clears control when it is done, or leaves error bit set */
+    uint32_t status;
+    while ((status = __builtin_bswap32(dma.control)) & ~FW_CFG_DMA_ERROR) {
+        __asm__ volatile ("pause" ::: "memory");
+    }
+    assert(!(status & FW_CFG_DMA_ERROR));
+}
+
+/** Legacy data port transfer, NULL buffer discards data */
+static void pio_transfer(void* buf, uint32_t size)
+{
+    if (buf) {
+        insb(FW_CFG_PORT_DATA, buf, size);
+        return;
+    }
+
+    uint8_t discard[64];
+    while (size) {
+        uint32_t n = size < sizeof(discard) ? size : sizeof(discard);
+        insb(FW_CFG_PORT_DATA, discard, n);
+        size -= n;
+    }
+}
+
+/** Transfer to buf or skip, selecting item first if select is not 0 */
+static void transfer(bool dma, uint16_t select, void* buf, uint32_t size)
+{
+    if (dma) {
+        uint32_t control = buf ? FW_CFG_DMA_READ : FW_CFG_DMA_SKIP;
+        if (select) {
+            control |= FW_CFG_DMA_SELECT | ((uint32_t)select << 16);
+        }
+        dma_transfer(control, buf, size);
+        return;
+    }
+
+    if (select) {
+        out16(FW_CFG_PORT_SEL, select);
+    }
+    pio_transfer(buf, size);
+}
+
+/** Select item with a legacy port write, it works for both interfaces */
+static void select_item(uint16_t select)
+{
+    out16(FW_CFG_PORT_SEL, select);
+}
+
+static void sort_files(struct fw_cfg_file* files, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; ++i) {
+        struct fw_cfg_file file = files[i];
+
+        uint32_t j = i;
+        for (; j > 0 && strncmp(files[j - 1].name, file.name, FW_CFG_MAX_FILE_PATH) > 0; --j) {
+            files[j] = files[j - 1];
+        }
+        files[j] = file;
+    }
+}
+
+static bool probe(void)
+{
+    uint32_t signature;
+    select_item(FW_CFG_SIGNATURE);
+    pio_transfer(&signature, sizeof(signature));
+    return signature == FW_CFG_SIGNATURE_VALUE;
+}
+
+bool init_fw_cfg(void)
+{
+    fw_cfg_index = NULL;
+
+    if (!probe()) {
+        LOG_INFO("fw_cfg: not found\n");
+        return false;
+    }
+
+    uint32_t features;
+    select_item(FW_CFG_ID);
+    pio_transfer(&features, sizeof(features));
+    bool dma = features & FW_CFG_VERSION_DMA;
+
+    uint32_t count;
+    transfer(dma, FW_CFG_FILE_DIR, &count, sizeof(count));
+    count = __builtin_bswap32(count);
+
+    /* Directory entries are read straight into the index */
+    struct fw_cfg_index* index = page_alloc(page_order(sizeof(*index) + count * sizeof(struct fw_cfg_file)));
+    assert(index);
+    index->dma = dma;
+    index->count = count;
+    transfer(dma, 0, index->files, count * sizeof(struct fw_cfg_file));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        index->files[i].size = __builtin_bswap32(index->files[i].size);
+        index->files[i].select = __builtin_bswap16(index->files[i].select);
+    }
+    sort_files(index->files, count);
+
+    fw_cfg_index = index;
+
+    LOG_INFO("fw_cfg: %u files, dma %s\n", count, dma ? "on" : "off");
+    for (uint32_t i = 0; i < count; ++i) {
+        LOG_DEBUG("  %hx %8u %s\n", index->files[i].select, index->files[i].size, index->files[i].name);
+    }
+
+    return true;
+}
+
+uint32_t fw_cfg_read_early(const char* name, void* buf, uint32_t size)
+{
+    if (!probe()) {
+        return 0;
+    }
+
+    uint32_t count;
+    select_item(FW_CFG_FILE_DIR);
+    pio_transfer(&count, sizeof(count));
+    count = __builtin_bswap32(count);
+
+    /* Directory is streamed one entry at a time, there is nowhere to put it yet */
+    for (uint32_t i = 0; i < count; ++i) {
+        struct fw_cfg_file file;
+        pio_transfer(&file, sizeof(file));
+        if (strncmp(file.name, name, FW_CFG_MAX_FILE_PATH) == 0) {
+            uint32_t file_size = __builtin_bswap32(file.size);
+            select_item(__builtin_bswap16(file.select));
+            pio_transfer(buf, file_size < size ? file_size : size);
+            return file_size;
+        }
+    }
+
+    return 0;
+}
+
+bool fw_cfg_present(void)
+{
+    return fw_cfg_index != NULL;
+}
+
+bool fw_cfg_has_dma(void)
+{
+    return fw_cfg_index && fw_cfg_index->dma;
+}
+
+const struct fw_cfg_file* fw_cfg_find(const char* name)
+{
+    const struct fw_cfg_index* index = fw_cfg_index;
+    if (!index) {
+        return NULL;
+    }
+
+    uint32_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(index->files[mid].name, name, FW_CFG_MAX_FILE_PATH);
+        if (cmp == 0) {
+            return &index->files[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+void fw_cfg_read(uint16_t select, void* buf, uint32_t size)
+{
+    assert(fw_cfg_index);
+    assert(select);
+    transfer(fw_cfg_index->dma, select, buf, size);
+}
+
+void fw_cfg_select(uint16_t select)
+{
+    assert(fw_cfg_index);
+    assert(select);
+    transfer(fw_cfg_index->dma, select, NULL, 0);
+}
+
+void fw_cfg_read_next(void* buf, uint32_t size)
+{
+    assert(fw_cfg_index);
+    transfer(fw_cfg_index->dma, 0, buf, size);
+}
+
+void fw_cfg_read_sg(uint16_t select, uint32_t offset, const struct fw_cfg_sg* sg, size_t count)
+{
+    assert(fw_cfg_index);
+    assert(select);
+    bool dma = fw_cfg_index->dma;
+
+    if (offset) {
+        transfer(dma, select, NULL, offset);
+        select = 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        transfer(dma, select, sg[i].buf, sg[i].size);
+        select = 0;
+    }
+}
+
+void fw_cfg_read_scatter(const struct fw_cfg_file* file, uint32_t offset, const struct fw_cfg_sg* sg, size_t count)
+{
+    uint32_t end = offset;
+    for (size_t i = 0; i < count; ++i) {
+        end += sg[i].size;
+    }
+    assert(end <= file->size);
+
+    fw_cfg_read_sg(file->select, offset, sg, count);
+}
@@ -0,0 +1,129 @@
+#include <inttypes.h>
+#include <assert.h>
+
+#include "hbitmap.h"
+
+static inline uint64_t bsf64(uint64_t val)
+{
+    uint64_t res;
+    __asm__ volatile ("bsf %1, %0" :"=r"(res) :"rm"(val) :);
+    return res;
+}
+
+static inline uint32_t words_for_bits(uint32_t nbits)
+{
+    return (nbits >> 6) + ((nbits & 63) != 0);
+}
+
+size_t hbitmap_storage_words(uint32_t nbits)
+{
+    size_t total = 0;
+    uint32_t nwords;
+
+    do {
+        nwords = words_for_bits(nbits);
+        total += nwords;
+        nbits = nwords;
+    } while (nwords > 1);
+
+    return total;
+}
+
+void hbitmap_init(struct hbitmap* hb, uint64_t* storage, uint32_t nbits)
+{
+    assert(nbits > 0);
+
+    hb->nbits = nbits;
+    hb->nlevels = 0;
+
+    uint32_t nwords;
+    do {
+        assert(hb->nlevels < HBITMAP_MAX_LEVELS);
+
+        nwords = words_for_bits(nbits);
+        hb->nwords[hb->nlevels] = nwords;
+        hb->levels[hb->nlevels] = storage;
+        hb->nlevels++;
+
+        for (uint32_t i = 0; i < nwords; ++i) {
+            storage[i] = 0;
+        }
+
+        storage += nwords;
+        nbits = nwords;
+    } while (nwords > 1);
+}
+
+void hbitmap_set(struct hbitmap* hb, uint32_t bit)
+{
+    assert(bit < hb->nbits);
+
+    /* Propagate up until we hit a word that was already summarized as non-empty */
+    for (uint32_t l = 0; l < hb->nlevels; ++l) {
+        uint64_t* word = &hb->levels[l][bit >> 6];
+        uint64_t prev = *word;
+
+        *word = prev | (1ull << (bit & 63));
+        if (prev != 0) {
+            break;
+        }
+
+        bit >>= 6;
+    }
+}
+
+void hbitmap_clear(struct hbitmap* hb, uint32_t bit)
+{
+    assert(bit < hb->nbits);
+
+    /* Propagate up while words become empty */
+    for (uint32_t l = 0; l < hb->nlevels; ++l) {
+        uint64_t* word = &hb->levels[l][bit >> 6];
+
+        *word &= ~(1ull << (bit & 63));
+        if (*word != 0) {
+            break;
+        }
+
+        bit >>= 6;
+    }
+}
+
+static uint32_t find_from(const struct hbitmap* hb, uint32_t idx)
+{
+    /* Go up until some level has bits set at or after our position, then go down picking first set bits */
+    for (uint32_t l = 0; l < hb->nlevels; ++l) {
+        uint32_t w = idx >> 6;
+        if (w >= hb->nwords[l]) {
+            return HBITMAP_NONE;
+        }
+
+        uint64_t bits = hb->levels[l][w] & (~0ull << (idx & 63));
+        if (bits) {
+            idx = (w << 6) | bsf64(bits);
+            while (l-- > 0) {
+                idx = (idx << 6) | bsf64(hb->levels[l][idx]);
+            }
+            return idx;
+        }
+
+        /* Next word on this level is the next bit on the level above */
+        idx = w + 1;
+    }
+
+    return HBITMAP_NONE;
+}
+
+uint32_t hbitmap_find_next(const struct hbitmap* hb, uint32_t start)
+{
+    if (start >= hb->nbits) {
+        start = 0;
+    }
+
+    uint32_t res = find_from(hb, start);
+    if (res == HBITMAP_NONE && start != 0) {
+        res = find_from(hb, 0);
+    }
+
+    return res;
+}
@@ -1,9 +1,12 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <string.h>
+#include <stdbool.h>
 
 #include "heap.h"
+#include "hbitmap.h"
 #include "dataseg.h"
+#include "alloc_stats.h"
 #include "logging.h"
 
 /**
@@ -14,18 +17,16 @@ struct alloc_arena {
     uint32_t nblocks;
     uint8_t order;
 
-    /* Set bit means block is free */
-    uint8_t bitmap[/* nblocks >> 8 + 1 for remainder */];
+    /* Next-fit search position, block after the last allocated one */
+    uint32_t cursor;
 
-    /* blocks */
-} __attribute__((packed));
+    /* Set bit means block is free.
+     * Bitmap covers whole heap, but only blocks in regions owned by arena are ever set. */
+    struct hbitmap bitmap;
+    uint64_t bitmap_storage[/* hbitmap_storage_words(nblocks) */];
 
-static inline uint32_t bsf(uint32_t val)
-{
-    uint32_t res;
-    __asm__ volatile ("bsf %1, %0" :"=r"(res) :"rm"(val) :);
-    return res;
-}
+    /* blocks */
+};
 
 static inline uint32_t bsr(uint32_t val)
 {
@@ -36,7 +37,7 @@ static inline uint32_t bsr(uint32_t val)
 
 static inline size_t arena_bitmap_size(size_t nblocks)
 {
-    return (nblocks >> 3) + ((nblocks & 0x7) != 0);
+    return hbitmap_storage_words(nblocks) * sizeof(uint64_t);
 }
 
 static inline void* arena_blocks_ptr(struct alloc_arena* arena)
@@ -50,7 +51,8 @@ static void* arena_alloc_block(struct alloc_arena* arena, uint32_t block)
 
     LOG_DEBUG("arena %u: allocate block %u\n", arena->order, block);
 
-    arena->bitmap[block >> 3] &= ~((uint8_t)1 << (block & 0x7));
+    hbitmap_clear(&arena->bitmap, block);
+    arena->cursor = block + 1;
     return arena_blocks_ptr(arena) + (block << arena->order);
 }
 
@@ -60,40 +62,19 @@ static void arena_free_block(struct alloc_arena* arena, uint32_t block)
 
     LOG_DEBUG("arena %u: free block %u\n", arena->order, block);
 
-    arena->bitmap[block >> 3] |= (uint8_t)1 << (block & 0x7);
+    hbitmap_set(&arena->bitmap, block);
 }
 
 static void* arena_alloc(struct alloc_arena* arena, size_t size)
 {
     assert(size <= (1ul << arena->order));
 
-    uint32_t block = 0;
-
-    /* Number of 32-bit bitmap chunks we can traverse */
-    uint32_t nchunks = arena->nblocks / 32;
-    uint32_t nrem = arena->nblocks - nchunks * 32;
-    uint32_t* pchunk = (uint32_t*)arena->bitmap;
-
-    while (nchunks-- > 0) {
-        if (*pchunk == 0) {
-            block += 32;
-            pchunk++;
-            continue;
-        }
-
-        return arena_alloc_block(arena, block + bsf(*pchunk));
-    }
-
-    if (nrem) {
-        /* Setting this to 0 also marks any overflown bytes as "occupied blocks" */
-        uint32_t chunk = 0;
-        memcpy(&chunk, pchunk, arena_bitmap_size(nrem));
-        if (chunk != 0) {
-            return arena_alloc_block(arena, block + bsf(chunk));
-        }
+    uint32_t block = hbitmap_find_next(&arena->bitmap, arena->cursor);
+    if (block == HBITMAP_NONE) {
+        return NULL;
     }
 
-    return NULL;
+    return arena_alloc_block(arena, block);
 }
 
 static void arena_free(struct alloc_arena* arena, void* ptr)
@@ -119,69 +100,183 @@ static struct alloc_arena* init_arena(uintptr_t base, size_t size, uint8_t order
     arena->blocks = base;
     arena->nblocks = nblocks;
     arena->order = order;
+    arena->cursor = 0;
 
-    memset(arena->bitmap, 0xFF, bitmap_size);
+    /* Arena starts with no free blocks, they appear when heap hands over regions to it */
+    hbitmap_init(&arena->bitmap, arena->bitmap_storage, nblocks);
 
     return arena;
 }
 
 /**
  * Heap defines arenas for given orders of allocations
- * and holds an arena lookup table in dataseg
+ * and holds an arena lookup table in .bss, variable-sized parts of it go to dataseg.
+ *
+ * Heap memory is split into regions, which are handed over to arenas on demand,
+ * so every region belongs to at most one arena and arenas never overlap.
+ * When an arena runs dry it takes an unowned region or a completely free region from another arena.
  */
 
-#include "datamap.h"
+#include "memmap.h"
+#include "page_alloc.h"
 
-/** We start at 2^6 order and move to 2^10 */
-#define HEAP_ORDER_BASE 6
-#define HEAP_ORDER_MAX  10
+/** Regions are 4K, largest block fits a region several times */
+#define HEAP_REGION_ORDER 12
 
-#if !defined(HEAP_LOOKUP_PTR_ADDR)
-#   error HEAP_LOOKUP_PTR_ADDR should be defined
-#endif
+/** Heap gets 1/256 of RAM */
+#define HEAP_SCALE_SHIFT 8
+#define HEAP_SIZE_MIN   (64ul << 10)
+#define HEAP_SIZE_MAX   (4ul << 20)
 
-#if !defined(HEAP_BASE)
-#   error HEAP_BASE should be defined
+#if defined(HEAP_BASE) && defined(HEAP_SIZE)
+_Static_assert((HEAP_BASE & ((1ul << HEAP_REGION_ORDER) - 1)) == 0, "Heap base should be region-aligned");
 #endif
+_Static_assert(PAGE_SHIFT >= HEAP_REGION_ORDER, "Pages should be region-aligned");
+_Static_assert(HEAP_REGION_ORDER - HEAP_ORDER_BASE <= 6, "Region blocks should fit a single bitmap word");
 
-#if !defined(HEAP_SIZE)
-#   error HEAP_SIZE should be defined
-#endif
+struct heap_lookup {
+    struct alloc_arena* arenas[HEAP_ORDER_MAX - HEAP_ORDER_BASE + 1];
+
+    /* Order of an arena that owns the region, 0 if region is unowned */
+    uint8_t* region_owner;
+    uint32_t nregions;
 
-/** Type of a pointer to arena lookup table */
-typedef struct alloc_arena* (*heap_lookup_ptr)[HEAP_ORDER_MAX - HEAP_ORDER_BASE + 1];
+    /* Set bit means region is not owned by any arena */
+    struct hbitmap unowned;
+};
+
+static struct heap_lookup heap_lookup;
 
-/** Macro that expands to fixed address of a heap lookup pointer in data segment */
-#define HEAP_LOOKUP_PTR (*(heap_lookup_ptr*)HEAP_LOOKUP_PTR_ADDR)
-#define HEAP_LOOKUP_TABLE (*HEAP_LOOKUP_PTR)
+static struct {
+    struct alloc_class_stats classes[HEAP_ORDER_MAX - HEAP_ORDER_BASE + 1];
+    struct alloc_usage usage;
+    uint32_t too_big;       /* Requests no arena can serve */
+} heap_stats;
 
+/** Header is padded so that returned pointers keep heap alignment, requested size lives in the padding */
 struct heap_header {
     uint32_t order;
-};
+    uint32_t size;
+} __attribute__((aligned(HEAP_PTR_ALIGNMENT)));
+
+_Static_assert(sizeof(struct heap_header) == HEAP_PTR_ALIGNMENT, "Heap header should not outgrow its padding");
+
+static inline struct alloc_arena* heap_arena(unsigned order)
+{
+    return heap_lookup.arenas[order - HEAP_ORDER_BASE];
+}
+
+static inline struct alloc_class_stats* heap_class(unsigned order)
+{
+    return &heap_stats.classes[order - HEAP_ORDER_BASE];
+}
 
-static inline void dump_arena(struct alloc_arena* arena)
+/** Mask of region blocks within arena leaf bitmap word */
+static inline uint64_t region_blocks_mask(struct alloc_arena* arena, uint32_t region, uint32_t* first)
 {
-    LOG_DEBUG("arena at %x: order %hhx, nblocks %u, bitmap size %u\n",
-        arena, arena->order, arena->nblocks, arena_bitmap_size(arena->nblocks));
+    uint32_t nblocks = 1u << (HEAP_REGION_ORDER - arena->order);
+    *first = region << (HEAP_REGION_ORDER - arena->order);
+    return (nblocks == 64 ? ~0ull : ((1ull << nblocks) - 1)) << (*first & 63);
+}
+
+static bool region_is_free(struct alloc_arena* arena, uint32_t region)
+{
+    uint32_t first;
+    uint64_t mask = region_blocks_mask(arena, region, &first);
+    return (arena->bitmap.levels[0][first >> 6] & mask) == mask;
+}
+
+static void region_assign(struct alloc_arena* arena, uint32_t region)
+{
+    uint32_t nblocks = 1u << (HEAP_REGION_ORDER - arena->order);
+    uint32_t first = region << (HEAP_REGION_ORDER - arena->order);
+
+    LOG_DEBUG("heap: region %u to arena %u\n", region, arena->order);
+
+    hbitmap_clear(&heap_lookup.unowned, region);
+    heap_lookup.region_owner[region] = arena->order;
+
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        hbitmap_set(&arena->bitmap, first + i);
+    }
+    arena->cursor = first;
+}
+
+static void region_release(struct alloc_arena* arena, uint32_t region)
+{
+    uint32_t nblocks = 1u << (HEAP_REGION_ORDER - arena->order);
+    uint32_t first = region << (HEAP_REGION_ORDER - arena->order);
+
+    LOG_DEBUG("heap: region %u from arena %u\n", region, arena->order);
+
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        hbitmap_clear(&arena->bitmap, first + i);
+    }
+
+    heap_lookup.region_owner[region] = 0;
+    hbitmap_set(&heap_lookup.unowned, region);
+}
+
+/**
+ * Find a region for an arena that ran dry.
+ * Unowned regions go first, then we look for a completely free region in other arenas.
+ */
+static bool heap_grow_arena(struct alloc_arena* arena)
+{
+    struct heap_lookup* lookup = &heap_lookup;
+
+    uint32_t region = hbitmap_find_next(&lookup->unowned, 0);
+    if (region == HBITMAP_NONE) {
+        for (uint32_t i = 0; i < lookup->nregions; ++i) {
+            uint8_t owner = lookup->region_owner[i];
+            if (owner != 0 && owner != arena->order && region_is_free(heap_arena(owner), i)) {
+                region_release(heap_arena(owner), i);
+                region = i;
+                break;
+            }
+        }
+    }
+
+    if (region == HBITMAP_NONE) {
+        return false;
+    }
+
+    region_assign(arena, region);
+    return true;
 }
 
 void init_heap(void)
 {
+#if defined(HEAP_BASE) && defined(HEAP_SIZE)
     uintptr_t base = HEAP_BASE;
-    size_t avail = HEAP_SIZE;
+    size_t size = HEAP_SIZE;
+#else
+    size_t size = memmap_scale(HEAP_SCALE_SHIFT, HEAP_SIZE_MIN, HEAP_SIZE_MAX);
+    uintptr_t base = (uintptr_t)page_alloc(page_order(size));
+    assert(base);
+#endif
+    uint32_t nregions = size >> HEAP_REGION_ORDER;
+    assert(nregions > 0);
 
-    HEAP_LOOKUP_PTR = dataseg_alloc(sizeof(HEAP_LOOKUP_TABLE));
-    assert(HEAP_LOOKUP_PTR);
+    memset(&heap_stats, 0, sizeof(heap_stats));
 
-    /* Half the space is cosumed by 64-byte allocations (which are most common for us) */
-    avail >>= 1;
-    HEAP_LOOKUP_TABLE[0] = init_arena(base, avail, HEAP_ORDER_BASE);
+    struct heap_lookup* lookup = &heap_lookup;
+    lookup->nregions = nregions;
+    lookup->region_owner = dataseg_alloc(nregions);
+    memset(lookup->region_owner, 0, nregions);
 
-    /* Remaining space is separated equally between all other orders up to 1K */
-    for (unsigned i = HEAP_ORDER_BASE + 1; i <= HEAP_ORDER_MAX; ++i) {
-        HEAP_LOOKUP_TABLE[i - HEAP_ORDER_BASE] =
-            init_arena(base, avail / (HEAP_ORDER_MAX - HEAP_ORDER_BASE), i);
+    uint64_t* unowned_storage = dataseg_alloc(hbitmap_storage_words(nregions) * sizeof(uint64_t));
+    hbitmap_init(&lookup->unowned, unowned_storage, nregions);
+    for (uint32_t i = 0; i < nregions; ++i) {
+        hbitmap_set(&lookup->unowned, i);
     }
+
+    /* Every arena spans the whole heap and gets regions as it needs them */
+    for (unsigned i = HEAP_ORDER_BASE; i <= HEAP_ORDER_MAX; ++i) {
+        heap_lookup.arenas[i - HEAP_ORDER_BASE] = init_arena(base, size, i);
+    }
+
+    LOG_INFO("heap: 0x%llx, %llu KB in %u regions\n", (uint64_t)base, (uint64_t)size >> 10, nregions);
 }
 
 void* heap_alloc(size_t size)
@@ -190,33 +285,43 @@ void* heap_alloc(size_t size)
      * so we don't need to worry about overflows so much */
     _Static_assert(HEAP_ORDER_MAX < 31, "HEAP_ORDER_MAX is way too large");
 
+    void* caller = __builtin_return_address(0);
+
     /* We don't support allocations larger than our max base */
-    if (size >= (1ul << HEAP_ORDER_MAX)) {
+    size_t full_size = size + sizeof(struct heap_header);
+    if (size >= (1ul << HEAP_ORDER_MAX) || full_size > (1ul << HEAP_ORDER_MAX)) {
+        heap_stats.too_big++;
+        alloc_trace(ALLOC_TRACE_HEAP_ALLOC, 0, size, true, caller);
         return NULL;
     }
 
-    size += sizeof(struct heap_header);
-    LOG_DEBUG("heap_alloc: full size %u\n", size);
-
     /* Find next log2 order for allocation size */
-    uint32_t order = bsr((size - 1) << 1);
-    if (order > HEAP_ORDER_MAX) {
-        return NULL;
-    } else if (order < HEAP_ORDER_BASE) {
+    uint32_t order = bsr((full_size - 1) << 1);
+    if (order < HEAP_ORDER_BASE) {
         order = HEAP_ORDER_BASE;
     }
 
-    struct alloc_arena* arena = (*HEAP_LOOKUP_PTR)[order - HEAP_ORDER_BASE];
-    dump_arena(arena);
+    struct alloc_arena* arena = heap_arena(order);
     assert(arena->order == order);
 
-    void* ptr = arena_alloc(arena, size); 
+    void* ptr = arena_alloc(arena, full_size);
+    if (!ptr && heap_grow_arena(arena)) {
+        ptr = arena_alloc(arena, full_size);
+        assert(ptr);
+    }
+
+    alloc_trace(ALLOC_TRACE_HEAP_ALLOC, order, size, !ptr, caller);
     if (!ptr) {
+        heap_class(order)->failed++;
         return NULL;
     }
 
+    /* Header is part of the waste: it is what pushes a 64 byte request into the 128 byte arena */
+    alloc_stats_alloc(heap_class(order), &heap_stats.usage, 1ul << order, (1ul << order) - size);
+
     struct heap_header* header = ptr;
     header->order = order;
+    header->size = size;
 
     ptr += sizeof(*header);
     assert(((uintptr_t)ptr & (HEAP_PTR_ALIGNMENT - 1)) == 0);
@@ -232,9 +337,24 @@ void heap_free(void* ptr)
     struct heap_header* header = ptr - sizeof(*header);
     assert(header->order >= HEAP_ORDER_BASE && header->order <= HEAP_ORDER_MAX);
 
-    struct alloc_arena* arena = (*HEAP_LOOKUP_PTR)[header->order - HEAP_ORDER_BASE];
-    dump_arena(arena);
+    struct alloc_arena* arena = heap_arena(header->order);
     assert(arena->order == header->order);
 
+    alloc_stats_free(heap_class(header->order), &heap_stats.usage, 1ul << header->order,
+                     (1ul << header->order) - header->size);
+    alloc_trace(ALLOC_TRACE_HEAP_FREE, header->order, header->size, false, __builtin_return_address(0));
+
     arena_free(arena, header);
 }
+
+void heap_report(void)
+{
+    alloc_stats_log("heap", heap_stats.classes, HEAP_ORDER_MAX - HEAP_ORDER_BASE + 1, HEAP_ORDER_BASE, 0,
+                    &heap_stats.usage);
+
+    uint32_t unowned = 0;
+    for (uint32_t i = 0; i < heap_lookup.nregions; ++i) {
+        unowned += heap_lookup.region_owner[i] == 0;
+    }
+    LOG_INFO("  %u of %u regions unowned, %u requests too big\n", unowned, heap_lookup.nregions, heap_stats.too_big);
+}
@@ -0,0 +1,28 @@
+/**
+ * ACPI tables built by QEMU.
+ * init_acpi runs the fw_cfg "etc/table-loader" linker script: blobs are allocated and read from fw_cfg,
+ * pointers between them are patched to physical addresses and table checksums are fixed up.
+ * HIGH zone blobs come from page allocator and are marked reserved in memory map,
+ * FSEG zone blobs, i.e. the RSDP, go to F-segment shadow RAM where legacy scans look for them.
+ *
+ * Each blob is summed once as it is loaded, checksums are then derived from its prefix sums
+ * corrected by bytes patched since, so nothing is rescanned however many tables share a blob.
+ * Patched bytes are kept per blob sorted by offset, so a checksum only visits those within its range.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/**
+ * Install ACPI tables.
+ * Returns false if there is no table-loader or the script could not be run.
+ * Should be called after enable_low_ram, init_pages and init_fw_cfg.
+ */
+bool init_acpi(void);
+
+/**
+ * Physical address of installed RSDP, 0 if there is none
+ */
+uint64_t acpi_rsdp(void);
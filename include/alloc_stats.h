@@ -0,0 +1,94 @@
+/**
+ * Allocator statistics.
+ * Page allocator and heap count blocks per size class (order), dataseg counts bytes left.
+ * Counters are always on, they cost a few adds per call. Build with ALLOC_TRACE=1 to also record every call
+ * in a ring of compact entries: caller address, size and order. Callers resolve against bootleg.elf64.map.
+ * alloc_report logs all of it once, at the end of boot, to size HEAP_SIZE and DATASEG_SIZE from data.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#if !defined(ALLOC_TRACE)
+#   define ALLOC_TRACE 0
+#endif
+
+/** Trace ring keeps this many most recent calls */
+#define ALLOC_TRACE_ENTRIES 256
+
+struct alloc_class_stats {
+    uint32_t live;          /* Blocks allocated now */
+    uint32_t peak;          /* Most blocks allocated at once */
+    uint32_t allocs;        /* Successful allocations */
+    uint32_t failed;        /* Allocations that found no block */
+    uint64_t waste;         /* Bytes of live blocks not covered by requests, i.e. internal fragmentation */
+};
+
+/** Bytes in live blocks of all classes, and their high-water mark */
+struct alloc_usage {
+    uint64_t live;
+    uint64_t peak;
+};
+
+static inline void alloc_stats_alloc(struct alloc_class_stats* c, struct alloc_usage* u, uint64_t block, uint64_t waste)
+{
+    c->allocs++;
+    if (++c->live > c->peak) {
+        c->peak = c->live;
+    }
+    c->waste += waste;
+
+    u->live += block;
+    if (u->live > u->peak) {
+        u->peak = u->live;
+    }
+}
+
+static inline void alloc_stats_free(struct alloc_class_stats* c, struct alloc_usage* u, uint64_t block, uint64_t waste)
+{
+    c->live--;
+    c->waste -= waste;
+    u->live -= block;
+}
+
+/**
+ * Log usage and every class that saw any calls.
+ * classes[i] counts blocks of 2^(first_order + i + block_shift) bytes.
+ */
+void alloc_stats_log(const char* name, const struct alloc_class_stats* classes, unsigned count,
+                     unsigned first_order, unsigned block_shift, const struct alloc_usage* usage);
+
+enum alloc_trace_op {
+    ALLOC_TRACE_PAGE_ALLOC = 0,
+    ALLOC_TRACE_PAGE_FREE,
+    ALLOC_TRACE_HEAP_ALLOC,
+    ALLOC_TRACE_HEAP_FREE,
+    ALLOC_TRACE_DATASEG_ALLOC,
+};
+
+struct alloc_trace_entry {
+    uint32_t caller;        /* Return address, C stage runs below 4G */
+    uint32_t size;          /* Requested bytes, block size for pages */
+    uint8_t op;
+    uint8_t order;          /* 0 for dataseg */
+    uint8_t failed;
+    uint8_t reserved;
+};
+
+#if ALLOC_TRACE
+void alloc_trace_record(enum alloc_trace_op op, unsigned order, size_t size, bool failed, void* caller);
+#endif
+
+static inline void alloc_trace(enum alloc_trace_op op, unsigned order, size_t size, bool failed, void* caller)
+{
+#if ALLOC_TRACE
+    alloc_trace_record(op, order, size, failed, caller);
+#endif
+}
+
+/**
+ * Log page allocator, heap and dataseg statistics, followed by trace ring if it is built in
+ */
+void alloc_report(void);
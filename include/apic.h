@@ -1,3 +1,63 @@
+/**
+ * Local APIC in xAPIC mode.
+ * Registers are accessed through MMIO window at the base programmed in IA32_APIC_BASE.
+ */
+
 #pragma once
 
+#include <inttypes.h>
+
+/** Register offsets */
+#define APIC_REG_ID         0x020
+#define APIC_REG_EOI        0x0B0
+#define APIC_REG_SVR        0x0F0
+#define APIC_REG_ICR_LOW    0x300
+#define APIC_REG_ICR_HIGH   0x310
+#define APIC_REG_LVT_TIMER  0x320
+#define APIC_REG_TIMER_INIT 0x380
+#define APIC_REG_TIMER_DIV  0x3E0
+
+/** LVT entry fields */
+#define APIC_LVT_MASKED         (1u << 16)
+#define APIC_LVT_TIMER_PERIODIC (1u << 17)
+
+/** Timer divide configuration value for divide by 1 */
+#define APIC_TIMER_DIV_1        0xB
+
+/**
+ * Spurious interrupt vector, has an IDT entry that only returns. Keep in sync with entry16.asm.
+ * Low 4 bits are writable on every CPU with long mode, so it doesn't need to be 0xXF.
+ */
+#define APIC_SPURIOUS_VECTOR    33
+
+/**
+ * Software-enable local APIC of calling CPU
+ */
 void init_apic(void);
+
+/**
+ * Physical base of MMIO register window of calling CPU
+ */
+uintptr_t apic_mmio_base(void);
+
+uint32_t apic_read(uint32_t reg);
+void apic_write(uint32_t reg, uint32_t val);
+
+/**
+ * Local APIC ID of calling CPU
+ */
+static inline uint32_t apic_id(void)
+{
+    return apic_read(APIC_REG_ID) >> 24;
+}
+
+/**
+ * Send INIT IPI to all CPUs but self
+ */
+void apic_send_init_all(void);
+
+/**
+ * Send STARTUP IPI to all CPUs but self.
+ * APs start in real mode at vector << 12.
+ */
+void apic_send_sipi_all(uint8_t vector);
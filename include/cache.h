@@ -0,0 +1,30 @@
+/**
+ * Memory types: MTRRs and PAT.
+ * Reset leaves MTRRs disabled, which makes all memory UC. init_cache programs MTRRs from memory map:
+ * default type is WB, fixed ranges cover the first 1M with VGA window UC and shadowed C- to F-segs WB,
+ * variable ranges mark the PCI hole from low RAM top up to 4G UC.
+ * PAT is programmed with the same layout Linux uses, so that PTE.PWT alone selects WC:
+ * PA0-PA7 = WB, WC, UC-, UC, WB, WP, UC-, WT.
+ */
+
+#pragma once
+
+/** MTRR and PAT memory types */
+#define MEM_TYPE_UC         0
+#define MEM_TYPE_WC         1
+#define MEM_TYPE_WT         4
+#define MEM_TYPE_WP         5
+#define MEM_TYPE_WB         6
+#define MEM_TYPE_UC_MINUS   7   /* PAT only */
+
+/**
+ * Program MTRRs and PAT on BSP, verify and log resulting layout.
+ * Should be called after init_memmap. Interrupts are held off while caches are disabled.
+ */
+void init_cache(void);
+
+/**
+ * Program on an application processor the same MTRRs and PAT as init_cache did on BSP.
+ * Should be called early in AP bring-up, before AP touches shared memory in earnest.
+ */
+void init_cache_ap(void);
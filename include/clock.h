@@ -0,0 +1,105 @@
+/**
+ * Monotonic clock.
+ * Time is TSC scaled to nanoseconds with pvclock arithmetic: ns = system_time + ((tsc - tsc_timestamp) << shift) * mul >> 32.
+ * On KVM with kvmclock, hypervisor keeps the scale in a pvclock area we register with it.
+ * Otherwise we fill the same area once, with TSC frequency taken from CPUID leaf 0x15 or 0x16,
+ * the hypervisor timing leaf 0x40000010, or measured against PIT channel 2 as the last resort.
+ * Either way reading time is a rdtsc and some arithmetic, without any exits.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "io.h"
+
+#define NSEC_PER_SEC    1000000000ull
+#define NSEC_PER_USEC   1000ull
+
+/** pvclock_vcpu_time_info, written by hypervisor when kvmclock is on */
+struct pvclock {
+    uint32_t version;
+    uint32_t pad0;
+    uint64_t tsc_timestamp;
+    uint64_t system_time;
+    uint32_t tsc_to_system_mul;
+    int8_t tsc_shift;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+
+struct clock {
+    struct pvclock pvclock;
+    uint64_t base_ns;
+    bool kvmclock;
+};
+
+extern struct clock clock_state_data;
+
+static inline struct clock* clock_state(void)
+{
+    return &clock_state_data;
+}
+
+static inline uint64_t pvclock_scale(uint64_t delta, uint32_t mul, int8_t shift)
+{
+    if (shift < 0) {
+        delta >>= -shift;
+    } else {
+        delta <<= shift;
+    }
+
+    return (uint64_t)(((unsigned __int128)delta * mul) >> 32);
+}
+
+/**
+ * Find TSC frequency and pick a clock source.
+ * Should be called after init_cpu.
+ */
+void init_clock(void);
+
+/**
+ * Unregister kvmclock area, so that hypervisor stops writing to it once we hand over memory to a kernel
+ */
+void clock_shutdown(void);
+
+/**
+ * Nanoseconds since init_clock
+ */
+static inline uint64_t now_ns(void)
+{
+    const volatile struct pvclock* pv = &clock_state()->pvclock;
+
+    uint32_t version;
+    uint64_t ns;
+    do {
+        /* Odd version means hypervisor is in the middle of an update */
+        version = pv->version;
+        __asm__ volatile ("" ::: "memory");
+        ns = pv->system_time + pvclock_scale(rdtsc() - pv->tsc_timestamp, pv->tsc_to_system_mul, pv->tsc_shift);
+        __asm__ volatile ("" ::: "memory");
+    } while ((version & 1) || version != pv->version);
+
+    return ns - clock_state()->base_ns;
+}
+
+/**
+ * Convert a TSC delta to nanoseconds
+ */
+static inline uint64_t clock_tsc_to_ns(uint64_t cycles)
+{
+    const volatile struct pvclock* pv = &clock_state()->pvclock;
+    return pvclock_scale(cycles, pv->tsc_to_system_mul, pv->tsc_shift);
+}
+
+/**
+ * Spin for at least us microseconds
+ */
+static inline void udelay(uint64_t us)
+{
+    uint64_t deadline = now_ns() + us * NSEC_PER_USEC;
+    while (now_ns() < deadline) {
+        __asm__ volatile ("pause");
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <inttypes.h>
+#include "io.h"
+
+#define CMOS_INDEX ((uint16_t)0x70)
+#define CMOS_DATA  ((uint16_t)0x71)
+
+/** NMI disable bit in CMOS index port */
+#define CMOS_NMI_DISABLE 0x80
+
+/** Extended memory between 1M and 16M in KB */
+#define CMOS_EXT_MEM_LOW    0x30
+#define CMOS_EXT_MEM_HIGH   0x31
+
+/** Memory between 16M and 4G in 64K units */
+#define CMOS_MEM_16M_LOW    0x34
+#define CMOS_MEM_16M_HIGH   0x35
+
+/** Memory above 4G in 64K units, 24 bits */
+#define CMOS_MEM_4G_LOW     0x5B
+#define CMOS_MEM_4G_MID     0x5C
+#define CMOS_MEM_4G_HIGH    0x5D
+
+static inline uint8_t cmos_read(uint8_t reg)
+{
+    out8(CMOS_INDEX, reg | CMOS_NMI_DISABLE);
+    return in8(CMOS_DATA);
+}
+
+/**
+ * Top of RAM below 4G, as reported by CMOS
+ */
+static inline uint64_t cmos_low_ram_top(void)
+{
+    uint64_t above_16m = ((uint64_t)cmos_read(CMOS_MEM_16M_HIGH) << 8) | cmos_read(CMOS_MEM_16M_LOW);
+    if (above_16m) {
+        return (16ull << 20) + (above_16m << 16);
+    }
+
+    uint64_t ext_kb = ((uint64_t)cmos_read(CMOS_EXT_MEM_HIGH) << 8) | cmos_read(CMOS_EXT_MEM_LOW);
+    return (1ull << 20) + (ext_kb << 10);
+}
+
+/**
+ * Size of RAM above 4G, as reported by CMOS
+ */
+static inline uint64_t cmos_high_ram_size(void)
+{
+    uint64_t units = ((uint64_t)cmos_read(CMOS_MEM_4G_HIGH) << 16) |
+                     ((uint64_t)cmos_read(CMOS_MEM_4G_MID) << 8) |
+                     cmos_read(CMOS_MEM_4G_LOW);
+    return units << 16;
+}
@@ -0,0 +1,92 @@
+/**
+ * CPU feature detection.
+ * CPUID results are read once by init_cpu and cached in a global.
+ * Cached feature bits reflect what is usable, i.e. AVX bits are cleared if we could not enable AVX state.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** Cached CPUID register words */
+enum cpu_word {
+    CPU_WORD_1_ECX = 0,     /* CPUID.01h:ECX */
+    CPU_WORD_1_EDX,         /* CPUID.01h:EDX */
+    CPU_WORD_7_EBX,         /* CPUID.(EAX=07h,ECX=0):EBX */
+    CPU_WORD_7_ECX,         /* CPUID.(EAX=07h,ECX=0):ECX */
+    CPU_WORD_7_EDX,         /* CPUID.(EAX=07h,ECX=0):EDX */
+    CPU_WORD_81_ECX,        /* CPUID.80000001h:ECX */
+    CPU_WORD_81_EDX,        /* CPUID.80000001h:EDX */
+
+    CPU_WORD_COUNT
+};
+
+#define CPU_FEATURE(word, bit) (((word) << 5) | (bit))
+
+enum cpu_feature {
+    CPU_FEATURE_SSE3        = CPU_FEATURE(CPU_WORD_1_ECX, 0),
+    CPU_FEATURE_SSSE3       = CPU_FEATURE(CPU_WORD_1_ECX, 9),
+    CPU_FEATURE_SSE41       = CPU_FEATURE(CPU_WORD_1_ECX, 19),
+    CPU_FEATURE_SSE42       = CPU_FEATURE(CPU_WORD_1_ECX, 20),
+    CPU_FEATURE_X2APIC      = CPU_FEATURE(CPU_WORD_1_ECX, 21),
+    CPU_FEATURE_XSAVE       = CPU_FEATURE(CPU_WORD_1_ECX, 26),
+    CPU_FEATURE_OSXSAVE     = CPU_FEATURE(CPU_WORD_1_ECX, 27),
+    CPU_FEATURE_AVX         = CPU_FEATURE(CPU_WORD_1_ECX, 28),
+    CPU_FEATURE_HYPERVISOR  = CPU_FEATURE(CPU_WORD_1_ECX, 31),
+
+    CPU_FEATURE_TSC         = CPU_FEATURE(CPU_WORD_1_EDX, 4),
+    CPU_FEATURE_MSR         = CPU_FEATURE(CPU_WORD_1_EDX, 5),
+    CPU_FEATURE_APIC        = CPU_FEATURE(CPU_WORD_1_EDX, 9),
+    CPU_FEATURE_MTRR        = CPU_FEATURE(CPU_WORD_1_EDX, 12),
+    CPU_FEATURE_PAT         = CPU_FEATURE(CPU_WORD_1_EDX, 16),
+    CPU_FEATURE_CLFLUSH     = CPU_FEATURE(CPU_WORD_1_EDX, 19),
+    CPU_FEATURE_SSE         = CPU_FEATURE(CPU_WORD_1_EDX, 25),
+    CPU_FEATURE_SSE2        = CPU_FEATURE(CPU_WORD_1_EDX, 26),
+
+    CPU_FEATURE_AVX2        = CPU_FEATURE(CPU_WORD_7_EBX, 5),
+    CPU_FEATURE_ERMSB       = CPU_FEATURE(CPU_WORD_7_EBX, 9),
+    CPU_FEATURE_SHA         = CPU_FEATURE(CPU_WORD_7_EBX, 29),
+
+    CPU_FEATURE_FSRM        = CPU_FEATURE(CPU_WORD_7_EDX, 4),
+
+    CPU_FEATURE_PAGE1GB     = CPU_FEATURE(CPU_WORD_81_EDX, 26),
+    CPU_FEATURE_RDTSCP      = CPU_FEATURE(CPU_WORD_81_EDX, 27),
+    CPU_FEATURE_LM          = CPU_FEATURE(CPU_WORD_81_EDX, 29),
+};
+
+struct cpu_info {
+    uint32_t max_leaf;
+    uint32_t max_ext_leaf;
+    uint32_t words[CPU_WORD_COUNT];
+};
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    __asm__ volatile("cpuid" :"=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) :"a"(leaf), "c"(subleaf) :);
+}
+
+extern struct cpu_info cpu_info_cache;
+
+static inline const struct cpu_info* cpu_info(void)
+{
+    return &cpu_info_cache;
+}
+
+static inline bool cpu_has(enum cpu_feature feature)
+{
+    return (cpu_info()->words[feature >> 5] & (1u << (feature & 31))) != 0;
+}
+
+/**
+ * Read and cache CPUID, enable extended SIMD state.
+ * SSE is enabled by reset vector code, AVX is enabled here if present.
+ * Should be called before anything else, since memory routines dispatch on cached features.
+ */
+void init_cpu(void);
+
+/**
+ * Enable on an application processor same SIMD state BSP has enabled in init_cpu.
+ * Should be called before AP uses memory routines.
+ */
+void init_cpu_ap(void);
@@ -1,23 +1,47 @@
 /**
- * Static layout of data segment, where we store our RW data
+ * Static layout of fixed RAM regions used before and outside of page allocator
  */
 
 #pragma once
 
 /**
- * D-seg
+ * Low conventional RAM, usable before PAM is programmed
  */
 
-/** see include/dataseg.h */
-#define DATASEG_BASE 0x000D0000ul
-#define DATASEG_SIZE 0x1000ul
+/** Boot timeline: stamps taken by assembly code before C stage is in RAM (see include/timeline.h) */
+#define TIMELINE_EARLY_BASE 0x00001000ul
+#define TIMELINE_EARLY_SIZE 0x100ul
 
-/** heap arena lookup table pointer */
-#define HEAP_LOOKUP_PTR_ADDR (DATASEG_BASE + DATASEG_SIZE)
+/** SMP: AP boot parameters (see include/smp.h), keep in sync with trampoline.asm */
+#define SMP_BOOT_ADDR       0x00007000ul
+
+/** AP real mode trampoline, SIPI vector is its page number, keep in sync with trampoline.asm */
+#define SMP_TRAMPOLINE_BASE 0x00008000ul
+
+/** Log ring, header followed by LOG_RING_SIZE bytes of data (see include/logring.h) */
+#define LOG_RING_BASE       0x00010000ul
+#define LOG_RING_SIZE       0x10000ul
+
+/** C stage: code, rodata and data copied from ROM followed by bss, keep in sync with image.lds */
+#define STAGE_BASE          0x00040000ul
+#define STAGE_SIZE          0x40000ul
+
+/**
+ * Legacy BIOS segments, RAM shadow is writable once enable_low_ram has programmed PAM
+ */
+
+/** F-segment shadow, ACPI table-loader FSEG zone blobs are placed here (see include/acpi.h) */
+#define FSEG_SHADOW_BASE    0x000F0000ul
+#define FSEG_SHADOW_SIZE    0x10000ul
 
 /**
- * C-seg
+ * RAM above 1M
  */
 
-#define HEAP_BASE 0x000C0000ul
-#define HEAP_SIZE (64ul << 10)
+/** Identity map page tables built by reset vector code, keep in sync with entry16.asm */
+#define PAGE_TABLES_BASE 0x00100000ul
+#define PAGE_TABLES_SIZE 0x6000ul
+
+/** Page allocator manages RAM from here up to the end of identity map */
+#define PAGES_BASE (PAGE_TABLES_BASE + PAGE_TABLES_SIZE)
+#define PAGES_TOP  (4ull << 30)
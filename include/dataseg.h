@@ -1,6 +1,6 @@
 /**
- * We don't have an RW .data segment (because we always run from ROM).
- * To store RW data that does not need to be deallocated we use a simple grows-up allocator,
+ * Fixed-size RW state lives in .data/.bss of the C stage (see image.lds).
+ * To store RW data that is sized at runtime and does not need to be deallocated we use a simple grows-up allocator,
  * which is called data segment. This segment is just that: a reserved memory area.
  * Since there is no deallocation involved, we don't need to worry about fragmentation.
  */
@@ -9,7 +9,8 @@
 
 /**
  * Init dataseg.
- * Location is specified by build defines: DATASEG_BASE and DATASEG_SIZE.
+ * Size is scaled to RAM size from memory map and memory comes from page allocator,
+ * so it should be called after init_pages. Build defines DATASEG_BASE and DATASEG_SIZE pin it to a fixed region instead.
  */
 void init_dataseg(void);
 
@@ -19,6 +20,11 @@ void init_dataseg(void);
  */
 void* dataseg_alloc(size_t size);
 
+/**
+ * Log bytes used and left, since nothing is freed the used part is also the high-water mark
+ */
+void dataseg_report(void);
+
 /**
  * Scrub entire datasegment and forget it
  */
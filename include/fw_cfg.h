@@ -0,0 +1,102 @@
+/**
+ * QEMU fw_cfg interface.
+ * init_fw_cfg reads file directory once into an index sorted by name, lookups are binary searches in it.
+ * Reads go through DMA interface when it is available, landing data directly in destination buffers,
+ * and fall back to string I/O on the data port otherwise.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** Well-known selectors */
+#define FW_CFG_SIGNATURE    0x0000
+#define FW_CFG_ID           0x0001
+#define FW_CFG_KERNEL_SIZE  0x0008
+#define FW_CFG_INITRD_SIZE  0x000B
+#define FW_CFG_KERNEL_DATA  0x0011
+#define FW_CFG_INITRD_DATA  0x0012
+#define FW_CFG_CMDLINE_SIZE 0x0014
+#define FW_CFG_CMDLINE_DATA 0x0015
+#define FW_CFG_FILE_DIR     0x0019
+
+#define FW_CFG_MAX_FILE_PATH 56
+
+/** Directory entry, fields are in host byte order once index is built */
+struct fw_cfg_file {
+    uint32_t size;
+    uint16_t select;
+    uint16_t reserved;
+    char name[FW_CFG_MAX_FILE_PATH];
+};
+
+/** Scatter list element, NULL buffer skips size bytes of file */
+struct fw_cfg_sg {
+    void* buf;
+    uint32_t size;
+};
+
+/**
+ * Detect fw_cfg and build file index.
+ * Returns false if there is no fw_cfg device. Should be called after init_pages.
+ */
+bool init_fw_cfg(void);
+
+/**
+ * Find file with a linear directory scan and read up to size bytes of it through the data port.
+ * Does not need init_fw_cfg or any allocator, meant for code that runs before those.
+ * Returns full file size, 0 if there is no fw_cfg device or no such file.
+ */
+uint32_t fw_cfg_read_early(const char* name, void* buf, uint32_t size);
+
+/**
+ * True if fw_cfg is present
+ */
+bool fw_cfg_present(void);
+
+/**
+ * True if fw_cfg is present and DMA interface is available
+ */
+bool fw_cfg_has_dma(void);
+
+/**
+ * Find file by name, returns NULL if there is no such file
+ */
+const struct fw_cfg_file* fw_cfg_find(const char* name);
+
+/**
+ * Read size bytes of item from its beginning
+ */
+void fw_cfg_read(uint16_t select, void* buf, uint32_t size);
+
+/**
+ * Select item and rewind it, fw_cfg_read_next then reads it front to back
+ */
+void fw_cfg_select(uint16_t select);
+
+/**
+ * Continue reading selected item from where the previous read stopped, NULL buffer skips size bytes.
+ * Lets a caller consume a large item in chunks without seeking back to each chunk.
+ */
+void fw_cfg_read_next(void* buf, uint32_t size);
+
+/**
+ * Read item into several target regions in one go: item is selected once,
+ * then each region is filled or skipped in order, starting at offset.
+ */
+void fw_cfg_read_sg(uint16_t select, uint32_t offset, const struct fw_cfg_sg* sg, size_t count);
+
+/**
+ * Scatter read of a file, see fw_cfg_read_sg
+ */
+void fw_cfg_read_scatter(const struct fw_cfg_file* file, uint32_t offset, const struct fw_cfg_sg* sg, size_t count);
+
+/**
+ * Read size bytes of file starting at offset
+ */
+static inline void fw_cfg_read_file(const struct fw_cfg_file* file, uint32_t offset, void* buf, uint32_t size)
+{
+    struct fw_cfg_sg sg = { buf, size };
+    fw_cfg_read_scatter(file, offset, &sg, 1);
+}
@@ -0,0 +1,53 @@
+/**
+ * Hierarchical bitmap.
+ * Level 0 holds the actual bits, every bit of the level above summarizes one 64-bit word below it
+ * (set if word has any bits set). Top level is always a single word.
+ * Finding a set bit takes at most 2 * nlevels word lookups regardless of how full the bitmap is.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** 64^4 bits is enough to track every 4K page of 64G */
+#define HBITMAP_MAX_LEVELS 4
+
+#define HBITMAP_NONE ((uint32_t)-1)
+
+struct hbitmap {
+    uint32_t nbits;
+    uint32_t nlevels;
+    uint32_t nwords[HBITMAP_MAX_LEVELS];
+    uint64_t* levels[HBITMAP_MAX_LEVELS];
+};
+
+/**
+ * Number of 64-bit storage words for a bitmap of nbits, including all summary levels
+ */
+size_t hbitmap_storage_words(uint32_t nbits);
+
+/**
+ * Init bitmap with all bits cleared.
+ * Storage should hold at least hbitmap_storage_words(nbits) words.
+ */
+void hbitmap_init(struct hbitmap* hb, uint64_t* storage, uint32_t nbits);
+
+void hbitmap_set(struct hbitmap* hb, uint32_t bit);
+void hbitmap_clear(struct hbitmap* hb, uint32_t bit);
+
+static inline bool hbitmap_test(const struct hbitmap* hb, uint32_t bit)
+{
+    return (hb->levels[0][bit >> 6] & (1ull << (bit & 63))) != 0;
+}
+
+static inline bool hbitmap_empty(const struct hbitmap* hb)
+{
+    return hb->levels[hb->nlevels - 1][0] == 0;
+}
+
+/**
+ * Find first set bit at or after start, wrapping around to the beginning.
+ * Returns HBITMAP_NONE if no bits are set.
+ */
+uint32_t hbitmap_find_next(const struct hbitmap* hb, uint32_t start);
@@ -1,8 +1,13 @@
 #pragma once
 
+/** Arenas serve blocks of 2^6 to 2^10 bytes, block header included */
+#define HEAP_ORDER_BASE 6
+#define HEAP_ORDER_MAX  10
+
 /**
  * Init heap.
- * Heap base and size is defined in datamap.
+ * Size is scaled to RAM size from memory map and memory comes from page allocator,
+ * so it should be called after init_pages and init_dataseg. Build defines HEAP_BASE and HEAP_SIZE pin it to a fixed region instead.
  */
 void init_heap(void);
 
@@ -11,3 +16,8 @@ void init_heap(void);
  */
 void* heap_alloc(size_t size);
 void heap_free(void* ptr);
+
+/**
+ * Log per-arena live, peak, failed and internal fragmentation counts (see include/alloc_stats.h)
+ */
+void heap_report(void);
@@ -2,6 +2,30 @@
 
 #include <inttypes.h>
 
+static inline void out8(uint16_t port, uint8_t val)
+{
+    __asm__ volatile("out %%al, %%dx" ::"a"(val), "d"(port):);
+}
+
+static inline uint8_t in8(uint16_t port)
+{
+    uint8_t res;
+    __asm__ volatile("in %%dx, %%al" :"=a"(res) :"d"(port):);
+    return res;
+}
+
+static inline void out16(uint16_t port, uint16_t val)
+{
+    __asm__ volatile("out %%ax, %%dx" ::"a"(val), "d"(port):);
+}
+
+static inline uint16_t in16(uint16_t port)
+{
+    uint16_t res;
+    __asm__ volatile("in %%dx, %%ax" :"=a"(res) :"d"(port):);
+    return res;
+}
+
 static inline void out32(uint16_t port, uint32_t val)
 {
     __asm__ volatile("out %%eax, %%dx" ::"a"(val), "d"(port):);
@@ -16,7 +40,19 @@ static inline uint32_t in32(uint16_t port)
 
 static inline uint64_t rdmsr(uint32_t reg)
 {
-    uint64_t res;
-    __asm__ volatile("rdmsr" :"=a"(res) :"c"(reg) :);
-    return res;
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" :"=a"(lo), "=d"(hi) :"c"(reg) :);
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t reg, uint64_t val)
+{
+    __asm__ volatile("wrmsr" ::"c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)) :);
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" :"=a"(lo), "=d"(hi) ::);
+    return ((uint64_t)hi << 32) | lo;
 }
@@ -0,0 +1,43 @@
+/**
+ * Interrupt and exception entry.
+ * Stubs in entry16.asm push vector, error code (a fake one if CPU does not push it) and all general purpose
+ * registers, then call a C handler with a pointer to the resulting frame. Handlers run with the stack
+ * of interrupted code and may modify the frame, it is restored on return.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+/** Generated by assembly code, order of fields is important */
+struct interrupt_frame {
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t r11;
+    uint64_t r10;
+    uint64_t r9;
+    uint64_t r8;
+    uint64_t rbp;
+    uint64_t rdi;
+    uint64_t rsi;
+    uint64_t rdx;
+    uint64_t rcx;
+    uint64_t rbx;
+    uint64_t rax;
+    uint64_t vector;
+    uint64_t error_code;
+
+    /* Pushed by CPU */
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+/**
+ * C entry for CPU exceptions, vectors 0-31
+ */
+void exception_handler(struct interrupt_frame* frame);
@@ -4,6 +4,10 @@ typedef unsigned char       uint8_t;
 typedef unsigned short      uint16_t;
 typedef unsigned int        uint32_t;
 typedef unsigned long long  uint64_t;
+typedef signed char         int8_t;
+typedef short               int16_t;
+typedef int                 int32_t;
+typedef long long           int64_t;
 typedef unsigned long long  uintptr_t;
 typedef unsigned long long  size_t;
 typedef long long           ssize_t;
@@ -0,0 +1,78 @@
+/**
+ * LZ4 frame decoder.
+ * Input is fed in chunks of any size as it arrives from a transfer path, all decoder state lives in struct lz4_stream,
+ * so a chunk may end anywhere, even in the middle of a frame header or a match length.
+ * Output goes to one flat buffer, matches reference it directly, so linked blocks need no separate window.
+ *
+ * In-place decoding: place compressed frame at the end of a buffer of LZ4_INPLACE_BUFFER_SIZE(decoded size)
+ * bytes and decode to its beginning. Output then never catches up with unread input.
+ *
+ * Block and content checksums are skipped, not verified. Dictionaries are not supported.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define LZ4_INPLACE_MARGIN(decoded)         (((decoded) >> 8) + 32)
+#define LZ4_INPLACE_BUFFER_SIZE(decoded)    ((decoded) + LZ4_INPLACE_MARGIN(decoded))
+
+/** Returned by lz4_feed and lz4_decode on malformed input or output overflow */
+#define LZ4_ERROR ((size_t)-1)
+
+/** Frame header is at most this long, enough to peek at content size */
+#define LZ4_MAX_HEADER_SIZE 19
+
+struct lz4_stream {
+    uint8_t* dst;
+    uint8_t* op;
+    uint8_t* oend;
+
+    uint32_t state;
+    uint32_t seq;           /* Sequence decoder state within a compressed block */
+    uint32_t flags;         /* Frame descriptor FLG byte */
+    uint32_t block_max;
+    uint32_t left;          /* Bytes left in current block, skippable frame or checksum */
+    uint32_t lit_len;
+    uint32_t match_len;
+    uint32_t offset;
+
+    uint32_t buffered;      /* Header bytes collected so far */
+    uint8_t buf[LZ4_MAX_HEADER_SIZE];
+};
+
+/**
+ * Start decoding a frame into dst
+ */
+void lz4_init(struct lz4_stream* s, void* dst, size_t dst_size);
+
+/**
+ * Decode next chunk of input.
+ * Returns number of bytes consumed, which is less than size only if frame ended within the chunk,
+ * or LZ4_ERROR. Skippable frames ahead of an LZ4 frame are consumed transparently.
+ */
+size_t lz4_feed(struct lz4_stream* s, const void* src, size_t size);
+
+/**
+ * True once end of frame is reached
+ */
+bool lz4_done(const struct lz4_stream* s);
+
+/**
+ * Bytes of output produced so far
+ */
+static inline size_t lz4_decoded_size(const struct lz4_stream* s)
+{
+    return s->op - s->dst;
+}
+
+/**
+ * Decoded size recorded in frame header, 0 if it is not an LZ4 frame or the header does not have it
+ */
+uint64_t lz4_content_size(const void* src, size_t size);
+
+/**
+ * Decode a whole frame in one call, returns decoded size or LZ4_ERROR
+ */
+size_t lz4_decode(void* dst, size_t dst_size, const void* src, size_t src_size);
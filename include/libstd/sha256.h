@@ -0,0 +1,50 @@
+/**
+ * SHA-256.
+ * Single stream hashing is incremental: sha256_update takes chunks of any size as they arrive.
+ * Blocks are compressed with SHA extensions when CPU has them and with portable C code otherwise.
+ *
+ * sha256_multi hashes several independent buffers at once. Without SHA extensions it runs 8 buffers
+ * side by side in AVX2 lanes, refilling a lane from the queue as soon as its buffer is done.
+ * Lanes compress in lockstep, so this pays off for batches of buffers of similar size.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define SHA256_DIGEST_SIZE  32
+#define SHA256_BLOCK_SIZE   64
+
+/** AVX2 multi-buffer lane count */
+#define SHA256_LANES        8
+
+struct sha256 {
+    uint32_t h[8];
+    uint64_t size;                      /* Bytes hashed so far, size % SHA256_BLOCK_SIZE of them are in buf */
+    uint8_t buf[SHA256_BLOCK_SIZE];
+};
+
+void sha256_init(struct sha256* ctx);
+
+void sha256_update(struct sha256* ctx, const void* data, size_t size);
+
+/**
+ * Pad, write digest, context has to be initialized again to be reused
+ */
+void sha256_final(struct sha256* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Hash a whole buffer
+ */
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Hash count independent buffers, digests[i] is the hash of data[i]
+ */
+void sha256_multi(const void* const* data, const size_t* size, size_t count, uint8_t (*digests)[SHA256_DIGEST_SIZE]);
+
+/**
+ * Name of the block function single stream hashing dispatches to, for logs
+ */
+const char* sha256_impl(void);
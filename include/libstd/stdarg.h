@@ -2,12 +2,16 @@
 
 #include <inttypes.h>
 
-#define __va_aligned_type uintptr_t
+/**
+ * Variadic arguments are passed in registers first on x86-64, only compiler knows where to find them.
+ * Arguments narrower than int are promoted, so they should be read as int.
+ */
+typedef __builtin_va_list va_list;
 
-#define va_list __va_aligned_type*
+#define va_start(ap, last) __builtin_va_start(ap, last)
 
-#define va_start(ap, last) ((ap) = (__va_aligned_type*)&(last) + 1)
+#define va_end(ap) __builtin_va_end(ap)
 
-#define va_end(ap) ((ap) = NULL)
+#define va_arg(ap, type) __builtin_va_arg(ap, type)
 
-#define va_arg(ap, type) (*(type*)(ap)++)
+#define va_copy(dest, src) __builtin_va_copy(dest, src)
@@ -2,5 +2,77 @@
 
 #include <stdio.h>
 
-#define LOG_ERROR(msg, ...) { fprintf(stderr, msg, ## __VA_ARGS__); }
-#define LOG_DEBUG(msg, ...) { fprintf(stderr, msg, ## __VA_ARGS__); }
+/**
+ * Log levels.
+ * Messages above LOG_LEVEL are compiled out entirely, along with their format strings.
+ */
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#if !defined(LOG_LEVEL)
+#   define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/**
+ * Tokenized logging.
+ * Format strings go to a non-loadable .logfmt section and never reach the ROM image,
+ * a message is logged as its format string offset in that section followed by raw 64-bit argument words.
+ * tools/logdecode expands log stream back to text using format strings from bootleg.elf64.
+ * Up to LOG_TOKEN_MAX_ARGS arguments are supported.
+ */
+#if !defined(LOG_TOKENIZED)
+#   define LOG_TOKENIZED 0
+#endif
+
+#if LOG_TOKENIZED
+
+#include "logring.h"
+
+#define _LOG_CAT(a, b) _LOG_CAT_(a, b)
+#define _LOG_CAT_(a, b) a ## b
+
+/*
+ * Format string is counted as the first argument, so argument lists are never empty
+ * and counting works in strict C11, without relying on ", ## __VA_ARGS__" comma swallowing.
+ */
+#define _LOG_FIRST(...) _LOG_FIRST_(__VA_ARGS__, _)
+#define _LOG_FIRST_(msg, ...) msg
+
+#define _LOG_NARGS(...) _LOG_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define _LOG_NARGS_(msg, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+/* Argument words skip the format string */
+#define _LOG_WORD(x) , ((uint64_t)(x))
+#define _LOG_WORDS0(msg)
+#define _LOG_WORDS1(msg, a) _LOG_WORD(a)
+#define _LOG_WORDS2(msg, a, ...) _LOG_WORD(a) _LOG_WORDS1(msg, __VA_ARGS__)
+#define _LOG_WORDS3(msg, a, ...) _LOG_WORD(a) _LOG_WORDS2(msg, __VA_ARGS__)
+#define _LOG_WORDS4(msg, a, ...) _LOG_WORD(a) _LOG_WORDS3(msg, __VA_ARGS__)
+#define _LOG_WORDS5(msg, a, ...) _LOG_WORD(a) _LOG_WORDS4(msg, __VA_ARGS__)
+#define _LOG_WORDS6(msg, a, ...) _LOG_WORD(a) _LOG_WORDS5(msg, __VA_ARGS__)
+#define _LOG_WORDS7(msg, a, ...) _LOG_WORD(a) _LOG_WORDS6(msg, __VA_ARGS__)
+#define _LOG_WORDS8(msg, a, ...) _LOG_WORD(a) _LOG_WORDS7(msg, __VA_ARGS__)
+
+/** Offset of format string in .logfmt section, which is linked at address 0 */
+#define _LOG_TOKEN_ID(msg) ({ \
+    static const char _logfmt[] __attribute__((section(".logfmt"), used)) = msg; \
+    (uint32_t)(uintptr_t)_logfmt; \
+})
+
+/* Argument words are prefixed with a dummy 0, so that there is always something to initialize array with */
+#define _LOG_EMIT(...) \
+    log_emit_token(_LOG_TOKEN_ID(_LOG_FIRST(__VA_ARGS__)), _LOG_NARGS(__VA_ARGS__), \
+        &((const uint64_t[]){ 0 _LOG_CAT(_LOG_WORDS, _LOG_NARGS(__VA_ARGS__))(__VA_ARGS__) })[1])
+
+#else
+
+#define _LOG_EMIT(...) fprintf(stderr, __VA_ARGS__)
+
+#endif
+
+/** Arguments are a format string followed by its arguments */
+#define LOG_ERROR(...) { if (LOG_LEVEL >= LOG_LEVEL_ERROR) { _LOG_EMIT(__VA_ARGS__); } }
+#define LOG_INFO(...)  { if (LOG_LEVEL >= LOG_LEVEL_INFO)  { _LOG_EMIT(__VA_ARGS__); } }
+#define LOG_DEBUG(...) { if (LOG_LEVEL >= LOG_LEVEL_DEBUG) { _LOG_EMIT(__VA_ARGS__); } }
@@ -0,0 +1,56 @@
+/**
+ * In-memory log ring.
+ * All stdio output lands in a RAM ring buffer at a fixed location (see datamap.h).
+ * Unless LOG_RING_FLUSH is 0, ring is flushed to debugcon with a single rep outsb per contiguous chunk
+ * when it fills up and on explicit log_flush calls. Otherwise the host is expected to read
+ * the ring from a guest memory dump: header magic marks the ring, head is the total number of bytes written.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+#if !defined(LOG_RING_FLUSH)
+#   define LOG_RING_FLUSH 1
+#endif
+
+/** "BLOG" */
+#define LOG_RING_MAGIC 0x474F4C42
+
+struct log_ring {
+    uint32_t magic;
+    uint32_t size;
+    uint64_t head;
+    uint64_t flushed;
+    char data[];
+};
+
+/**
+ * Init log ring.
+ * Should be called before anything is logged.
+ */
+void init_log_ring(void);
+
+/**
+ * stdio sink that appends to log ring
+ */
+void log_ring_putc(char c);
+
+/**
+ * Append raw bytes to log ring
+ */
+void log_ring_write(const void* buf, size_t n);
+
+/**
+ * Tokenized log record: 32-bit tag, followed by nargs 64-bit argument words.
+ * Tag holds format string id in upper bits and number of arguments in lower LOG_TOKEN_NARGS_BITS.
+ */
+#define LOG_TOKEN_NARGS_BITS 4
+#define LOG_TOKEN_MAX_ARGS 8
+
+void log_emit_token(uint32_t id, unsigned nargs, const uint64_t* args);
+
+/**
+ * Write out everything not flushed yet to debugcon, does nothing if LOG_RING_FLUSH is 0
+ */
+void log_flush(void);
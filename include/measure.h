@@ -0,0 +1,41 @@
+/**
+ * Measured boot.
+ * Payloads are hashed with SHA-256 while they are loaded, and each digest is recorded in a measurement log
+ * kept in dataseg. Expected digests come from fw_cfg file MEASURE_DIGESTS_FILE in sha256sum output format,
+ * one "<hex digest>  <name>" line per payload. With that file present every recorded payload has to be listed
+ * with a matching digest, or measure_verify fails. Without it measurements are only logged.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "sha256.h"
+
+#define MEASURE_DIGESTS_FILE    "opt/bootleg/sha256sums"
+#define MEASURE_MAX_ENTRIES     16
+#define MEASURE_MAX_NAME        32
+
+struct measurement {
+    const char* name;       /* Static string, so that tokenized logs can print it */
+    uint64_t size;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+};
+
+/**
+ * Self-test SHA-256, allocate measurement log and read expected digests.
+ * Should be called after init_dataseg and init_fw_cfg.
+ */
+void init_measure(void);
+
+/**
+ * Append a payload digest to the measurement log
+ */
+void measure_record(const char* name, uint64_t size, const uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Log all measurements and check them against expected digests.
+ * Returns false if expected digests are given and any measurement is missing from them or does not match.
+ */
+bool measure_verify(void);
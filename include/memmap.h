@@ -0,0 +1,61 @@
+/**
+ * Physical memory map.
+ * init_memmap builds an E820-style table from fw_cfg "etc/e820", or from CMOS when there is no such file,
+ * punches the legacy VGA/BIOS hole into it and sanitizes it: entries are sorted, overlaps are resolved
+ * in favour of non-RAM types and adjacent entries of the same type are merged.
+ * Allocators are sized and placed from this table, and it is what we hand over to a kernel.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define E820_RAM        1
+#define E820_RESERVED   2
+#define E820_ACPI       3
+#define E820_NVS        4
+#define E820_UNUSABLE   5
+
+#define MEMMAP_MAX_ENTRIES 32
+
+/** Entry layout matches etc/e820 file */
+struct e820_entry {
+    uint64_t addr;
+    uint64_t size;
+    uint32_t type;
+} __attribute__((packed));
+
+/**
+ * Build memory map.
+ * Should be called after enable_low_ram and before any allocator is initialized.
+ */
+void init_memmap(void);
+
+/**
+ * Number of entries in sanitized map
+ */
+uint32_t memmap_count(void);
+
+/**
+ * Entry by index, entries are sorted by address and do not overlap
+ */
+const struct e820_entry* memmap_at(uint32_t idx);
+
+/**
+ * Total RAM in bytes, including RAM above 4G
+ */
+uint64_t memmap_ram_size(void);
+
+/**
+ * Overlay a range of given type onto the map, e.g. to keep firmware tables carved out of RAM away from a kernel.
+ * Map is sanitized again, so the range may split existing entries.
+ * Returns false and leaves map untouched if there is no room for the split.
+ */
+bool memmap_mark(uint64_t addr, uint64_t size, uint32_t type);
+
+/**
+ * Allocator size for current RAM size: RAM size >> shift rounded down to a power of 2, clamped to [min, max].
+ * min and max should be powers of 2.
+ */
+size_t memmap_scale(unsigned shift, size_t min, size_t max);
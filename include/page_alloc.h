@@ -0,0 +1,69 @@
+/**
+ * Page-granular buddy allocator for physically contiguous page-aligned memory.
+ * Free blocks of each order are tracked in a per-order hierarchical bitmap (see include/hbitmap.h),
+ * so metadata is about 2 bits per page and never lives inside the blocks themselves.
+ * Blocks are naturally aligned to their size.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1ul << PAGE_SHIFT)
+
+/** Largest block is 1G */
+#define PAGE_ORDER_MAX  18
+
+/**
+ * Init page allocator with no RAM ranges
+ */
+void init_pages(void);
+
+/**
+ * Add a RAM range to the page allocator.
+ * Range metadata is carved from its beginning.
+ */
+void pages_add_range(uintptr_t base, size_t size);
+
+/**
+ * Allocate 2^order contiguous pages.
+ * Returns NULL if no block is available.
+ */
+void* page_alloc(unsigned order);
+
+/**
+ * Free block previously allocated with page_alloc with the same order
+ */
+void page_free(void* ptr, unsigned order);
+
+/**
+ * Take a page-aligned range out of the free pool, e.g. to place data at a fixed physical address.
+ * Returns false and leaves allocator untouched if any page in the range is not free.
+ */
+bool page_reserve(uintptr_t base, size_t size);
+
+/**
+ * Call fn for every free block, in no particular order.
+ * fn should not allocate or free pages.
+ */
+void pages_for_each_free(void (*fn)(uintptr_t base, size_t size, void* arg), void* arg);
+
+/**
+ * Log per-order live, peak and failed block counts (see include/alloc_stats.h)
+ */
+void pages_report(void);
+
+/**
+ * Smallest order of a block which can hold size bytes
+ */
+static inline unsigned page_order(size_t size)
+{
+    unsigned order = 0;
+    while ((PAGE_SIZE << order) < size) {
+        ++order;
+    }
+
+    return order;
+}
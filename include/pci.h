@@ -1,36 +1,67 @@
+/**
+ * PCI configuration space access.
+ * init_pci detects host bridge: on q35 MCH config space goes through memory-mapped ECAM window
+ * (PCIEXBAR is programmed with PCI_ECAM_BASE if firmware finds it disabled), which is a single access
+ * per register and covers all 4K of extended config space.
+ * Otherwise we fall back to CF8/CFC port pair, which only reaches first 256 bytes
+ * and is not atomic: address and data accesses must not be interleaved with other config accesses.
+ */
+
 #pragma once
 
 #include <inttypes.h>
-#include "io.h"
 
 #define PCI_CONFADDR ((uint16_t)0x0CF8)
 #define PCI_CONFDATA ((uint16_t)0x0CFC)
 
-static inline uint32_t pci_make_bdf(uint8_t bus, uint8_t dev, uint8_t func)
-{
-    return 0x80000000 | ((uint32_t)(func & 0x7) << 8) | ((uint32_t)(dev & 0x1F) << 11) | ((uint32_t)bus << 16);
-}
+/** Extended config space size per function */
+#define PCI_CONFIG_SIZE 0x1000
 
-static inline uint8_t pci_read8(uint32_t bdf, uint8_t reg)
-{
-    out32(PCI_CONFADDR, bdf | reg);
-    return in32(PCI_CONFDATA) & 0xFF;
-}
+/** Legacy config space size reachable with CF8/CFC */
+#define PCI_CONFIG_LEGACY_SIZE 0x100
 
-static inline uint16_t pci_read16(uint32_t bdf, uint8_t reg)
-{
-    out32(PCI_CONFADDR, bdf | reg);
-    return in32(PCI_CONFDATA) & 0xFFFF;
-}
+/** ECAM window base we program into q35 PCIEXBAR, can be overridden by build defines */
+#if !defined(PCI_ECAM_BASE)
+#   define PCI_ECAM_BASE 0xB0000000ul
+#endif
 
-static inline uint32_t pci_read32(uint32_t bdf, uint8_t reg)
-{
-    out32(PCI_CONFADDR, bdf | reg);
-    return in32(PCI_CONFDATA);
-}
+enum pci_host {
+    PCI_HOST_I440FX = 0,
+    PCI_HOST_Q35,
+};
 
-static inline void pci_write32(uint32_t bdf, uint8_t reg, uint32_t val)
+/** Config access state */
+struct pci_config {
+    uint64_t ecam_base;     /* 0 if ECAM is not available */
+    uint32_t ecam_buses;    /* Number of buses decoded by ECAM window */
+    uint32_t host;          /* enum pci_host */
+};
+
+/** Bus, device and function packed as in ECAM address bits 27:12 */
+static inline uint32_t pci_make_bdf(uint8_t bus, uint8_t dev, uint8_t func)
 {
-    out32(PCI_CONFADDR, bdf | reg);
-    out32(PCI_CONFDATA, val);
+    return ((uint32_t)bus << 8) | ((uint32_t)(dev & 0x1F) << 3) | (func & 0x7);
 }
+
+/**
+ * Detect host bridge and config access method.
+ * Should be called before any other PCI function.
+ */
+void init_pci(void);
+
+/**
+ * Detected host bridge
+ */
+enum pci_host pci_host(void);
+
+/**
+ * Config space accessors.
+ * reg should be naturally aligned for access size.
+ * Registers beyond what current access method can reach read as all ones and ignore writes.
+ */
+uint8_t pci_read8(uint32_t bdf, uint16_t reg);
+uint16_t pci_read16(uint32_t bdf, uint16_t reg);
+uint32_t pci_read32(uint32_t bdf, uint16_t reg);
+void pci_write8(uint32_t bdf, uint16_t reg, uint8_t val);
+void pci_write16(uint32_t bdf, uint16_t reg, uint16_t val);
+void pci_write32(uint32_t bdf, uint16_t reg, uint32_t val);
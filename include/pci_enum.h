@@ -0,0 +1,77 @@
+/**
+ * PCI enumeration.
+ * pci_enumerate walks bus 0 once, sizes BARs and assigns them windows in a single pass.
+ * Every function found is recorded in a device table, so drivers look up IDs, class and BARs
+ * there instead of issuing config cycles of their own.
+ * Bridges are recorded, but buses behind them are not scanned.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+#define PCI_MAX_BARS 6
+
+/** BAR flags */
+#define PCI_BAR_IO          (1u << 0)
+#define PCI_BAR_MEM64       (1u << 1)
+#define PCI_BAR_PREFETCH    (1u << 2)
+
+struct pci_bar {
+    uint64_t base;      /* 0 if BAR is not implemented or could not be assigned */
+    uint8_t size_order; /* log2 of BAR size, 0 if BAR is not implemented */
+    uint8_t flags;
+};
+
+struct pci_device {
+    uint32_t bdf;
+    uint16_t vendor;
+    uint16_t device;
+    uint32_t class_rev;     /* class:subclass:prog-if:revision, as in config register 0x08 */
+    uint8_t header_type;    /* without multifunction bit */
+    uint8_t nbars;          /* BAR slots for header type, 64-bit BARs take 2 */
+    uint16_t command;       /* Command register, as left by enumeration */
+    struct pci_bar bars[PCI_MAX_BARS];
+};
+
+static inline uint8_t pci_device_class(const struct pci_device* dev)
+{
+    return dev->class_rev >> 24;
+}
+
+static inline uint8_t pci_device_subclass(const struct pci_device* dev)
+{
+    return (dev->class_rev >> 16) & 0xFF;
+}
+
+static inline uint64_t pci_bar_size(const struct pci_bar* bar)
+{
+    return bar->size_order ? (1ull << bar->size_order) : 0;
+}
+
+/**
+ * Walk bus 0, fill device table and assign BARs.
+ * Should be called once after init_pci and init_pages.
+ */
+void pci_enumerate(void);
+
+/**
+ * Number of functions in device table
+ */
+size_t pci_device_count(void);
+
+/**
+ * Device table entry by index
+ */
+const struct pci_device* pci_device_at(size_t i);
+
+/**
+ * Find next device after prev (or first device if prev is NULL) with matching IDs.
+ * 0xFFFF matches any vendor or device id.
+ */
+const struct pci_device* pci_find_device(uint16_t vendor, uint16_t device, const struct pci_device* prev);
+
+/**
+ * Find next device after prev (or first device if prev is NULL) with matching class and subclass
+ */
+const struct pci_device* pci_find_class(uint8_t class, uint8_t subclass, const struct pci_device* prev);
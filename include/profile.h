@@ -0,0 +1,40 @@
+/**
+ * Sampling profiler.
+ * Local APIC timer of BSP runs in periodic mode and each tick records interrupted RIP
+ * in a histogram over C stage code, which is preallocated in .bss so that profiling can start before any allocator is up.
+ * profile_report dumps non-empty buckets to the log, tools/profsym symbolizes them against bootleg.elf64.map.
+ *
+ * Profiler is opt-in: build with PROFILE=1, otherwise profile_start does nothing.
+ * Real mode code before long mode entry is not covered, timeline stamps are all we have there.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+#if !defined(PROFILE)
+#   define PROFILE 0
+#endif
+
+/** Timer period in APIC timer ticks with divide by 1, which is 100us with 1GHz APIC bus of KVM */
+#if !defined(PROFILE_PERIOD)
+#   define PROFILE_PERIOD 100000
+#endif
+
+/** Keep in sync with entry16.asm */
+#define PROFILE_VECTOR 32
+
+/**
+ * Clear histogram and start sampling on calling CPU, enables interrupts.
+ */
+void profile_start(void);
+
+/**
+ * Stop sampling, disables interrupts
+ */
+void profile_stop(void);
+
+/**
+ * Stop sampling and log histogram
+ */
+void profile_report(void);
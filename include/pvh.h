@@ -0,0 +1,56 @@
+/**
+ * PVH direct kernel boot.
+ * Kernel ELF given with -kernel is streamed from fw_cfg straight to its PT_LOAD physical addresses,
+ * initrd and command line land in page allocator blocks, and we jump to PVH entry
+ * from the XEN_ELFNOTE_PHYS32_ENTRY note in 32-bit protected mode with paging off.
+ * Without -initrd, contents of virtio-blk disk, if there is one, are passed as initrd module instead,
+ * LZ4 frames with content size are decoded on the way.
+ * Kernel file, command line and initrd are measured as they load (see include/measure.h),
+ * and we refuse to jump if expected digests are given and any of them does not match.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** hvm_start_info, as defined by Xen PVH boot ABI */
+#define HVM_START_MAGIC_VALUE 0x336ec578
+
+struct hvm_start_info {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t nr_modules;
+    uint64_t modlist_paddr;
+    uint64_t cmdline_paddr;
+    uint64_t rsdp_paddr;
+    /* version 1 */
+    uint64_t memmap_paddr;
+    uint32_t memmap_entries;
+    uint32_t reserved;
+};
+
+struct hvm_modlist_entry {
+    uint64_t paddr;
+    uint64_t size;
+    uint64_t cmdline_paddr;
+    uint64_t reserved;
+};
+
+#define XEN_HVM_MEMMAP_TYPE_RAM         1
+#define XEN_HVM_MEMMAP_TYPE_RESERVED    2
+
+struct hvm_memmap_table_entry {
+    uint64_t addr;
+    uint64_t size;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+/**
+ * Boot PVH kernel from fw_cfg.
+ * Returns false if there is no kernel or it has no PVH entry, does not return otherwise.
+ * Should be called last, after free RAM has been scrubbed.
+ */
+bool pvh_boot(void);
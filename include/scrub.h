@@ -0,0 +1,41 @@
+/**
+ * Bulk memory scrubbing.
+ * Ranges are split into SCRUB_CHUNK_SIZE-aligned chunks, which are filled on all CPUs through parallel_for.
+ * Chunks are large enough for memset to use non-temporal stores, followed by sfence on each CPU.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+/** Chunk size and alignment, a large page */
+#define SCRUB_CHUNK_SIZE (2ul << 20)
+
+struct scrub_range {
+    uint64_t base;
+    uint64_t size;
+};
+
+/** Scrub result */
+struct scrub_stats {
+    uint64_t bytes;
+    uint64_t ns;
+};
+
+/**
+ * Fill ranges with pattern byte.
+ * Should be called after init_smp.
+ */
+struct scrub_stats scrub_ranges(const struct scrub_range* ranges, size_t count, uint8_t pattern);
+
+static inline struct scrub_stats scrub_range(uint64_t base, uint64_t size, uint8_t pattern)
+{
+    struct scrub_range range = { base, size };
+    return scrub_ranges(&range, 1, pattern);
+}
+
+/**
+ * Zero every free block in page allocator and report throughput.
+ * Should be called after init_smp, so that all CPUs take part.
+ */
+void scrub_free_pages(void);
@@ -0,0 +1,51 @@
+/**
+ * Application processors bring-up and parallel work dispatch.
+ * init_smp wakes APs with INIT-SIPI-SIPI, each AP enters long mode on its own stack
+ * and spins waiting for work. parallel_for splits a range into chunks which BSP and APs
+ * claim until the range is exhausted.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+#include "datamap.h"
+
+#if !defined(SMP_BOOT_ADDR) || !defined(SMP_TRAMPOLINE_BASE)
+#   error SMP_BOOT_ADDR and SMP_TRAMPOLINE_BASE should be defined
+#endif
+
+/** AP stack size */
+#define SMP_AP_STACK_SIZE (16ul << 10)
+
+/** AP boot parameters, read by trampoline code, keep in sync with trampoline.asm */
+struct smp_boot {
+    uint32_t next_index;    /* Next AP index to claim */
+    uint32_t stack_size;
+    uint64_t stacks;        /* Base of stack block, stack for AP N ends at stacks + N * stack_size */
+    uint32_t max_index;     /* Last AP index there is a stack for, APs past it halt */
+};
+
+/**
+ * Wake APs and wait until they are online.
+ * Should be called after init_pages and init_apic.
+ */
+void init_smp(void);
+
+/**
+ * Number of online CPUs, including BSP
+ */
+unsigned smp_cpu_count(void);
+
+/**
+ * Work function, processes [begin, end) part of the range.
+ * Runs concurrently on all CPUs: it should not log or allocate.
+ */
+typedef void (*parallel_fn)(size_t begin, size_t end, void* arg);
+
+/**
+ * Run fn over [0, count) in chunks of grain items on all CPUs.
+ * Returns when the whole range is done. Should only be called by BSP.
+ * Before init_smp, fn runs over the whole range on BSP.
+ */
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void* arg);
@@ -0,0 +1,57 @@
+/**
+ * Boot phase timeline.
+ * Each phase is closed by a TSC stamp, phase duration is the distance from the previous recorded stamp.
+ * Stamps taken by assembly code before C stage is in RAM go to a fixed table in low RAM (see datamap.h),
+ * init_timeline moves them into a static table.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+/**
+ * Boot phases in execution order.
+ * First 4 are stamped from assembly, keep in sync with include/asm/timeline.inc
+ */
+enum boot_phase {
+    BOOT_PHASE_RESET = 0,       /* Reset vector, origin of the timeline */
+    BOOT_PHASE_PAGE_TABLES,     /* Identity map built, still in real mode */
+    BOOT_PHASE_LONG_MODE,       /* Paging and long mode enabled, straight from real mode */
+    BOOT_PHASE_STAGE,           /* C stage copied from ROM to RAM */
+    BOOT_PHASE_START,           /* C entry point */
+    BOOT_PHASE_CLOCK,           /* init_clock */
+    BOOT_PHASE_LOW_RAM,         /* enable_low_ram */
+    BOOT_PHASE_MEMMAP,          /* init_memmap */
+    BOOT_PHASE_CACHE,           /* init_cache */
+    BOOT_PHASE_PAGES,           /* init_pages */
+    BOOT_PHASE_DATASEG,         /* init_dataseg */
+    BOOT_PHASE_HEAP,            /* init_heap */
+    BOOT_PHASE_FW_CFG,          /* init_fw_cfg */
+    BOOT_PHASE_MEASURE,         /* init_measure */
+    BOOT_PHASE_ACPI,            /* init_acpi */
+    BOOT_PHASE_PCI,             /* pci_enumerate */
+    BOOT_PHASE_VIRTIO_BLK,      /* init_virtio_blk */
+    BOOT_PHASE_APIC,            /* init_apic */
+    BOOT_PHASE_SMP,             /* init_smp */
+    BOOT_PHASE_SCRUB,           /* scrub_free_pages */
+    BOOT_PHASE_KERNEL,          /* Kernel loaded, right before jumping to it */
+
+    BOOT_PHASE_COUNT
+};
+
+/**
+ * Copy early stamps into a static table, which C code stamps from then on.
+ * Should be called first thing in C code, before any timeline_stamp.
+ */
+void init_timeline(void);
+
+/**
+ * Record TSC stamp for the end of a boot phase
+ */
+void timeline_stamp(enum boot_phase phase);
+
+/**
+ * Emit per-phase durations and percentages of total boot time.
+ * Should be called after init_clock.
+ */
+void timeline_report(void);
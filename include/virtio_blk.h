@@ -0,0 +1,63 @@
+/**
+ * virtio-blk over modern virtio-pci.
+ * init_virtio_blk binds to the first virtio-blk function with modern vendor capabilities and sets up
+ * a single split virtqueue. Reads are split into requests of up to VIRTIO_BLK_REQ_SEGS data descriptors,
+ * as many requests as fit into the queue are kept in flight, and each batch is published with one doorbell.
+ * With VIRTIO_RING_F_EVENT_IDX doorbells are skipped while device is still consuming the avail ring,
+ * and device interrupts are suppressed altogether: completions are reaped from the used ring.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** virtio-blk sector size, request offsets are always in these units */
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/** Scatter list element, NULL buffer skips size bytes of disk */
+struct virtio_blk_sg {
+    void* buf;
+    uint32_t size;      /* Multiple of VIRTIO_BLK_SECTOR_SIZE */
+};
+
+/**
+ * Find and initialize virtio-blk device.
+ * Returns false if there is none or it could not be set up. Should be called after pci_enumerate.
+ */
+bool init_virtio_blk(void);
+
+/**
+ * True if a disk is ready
+ */
+bool virtio_blk_present(void);
+
+/**
+ * Disk size in bytes
+ */
+uint64_t virtio_blk_size(void);
+
+/**
+ * Read disk into several target regions in one pass, starting at sector.
+ * Returns false if device reported an error or did not complete in time.
+ */
+bool virtio_blk_read_sg(uint64_t sector, const struct virtio_blk_sg* sg, size_t count);
+
+/**
+ * Read size bytes starting at sector, size is a multiple of VIRTIO_BLK_SECTOR_SIZE
+ */
+static inline bool virtio_blk_read(uint64_t sector, void* buf, uint32_t size)
+{
+    struct virtio_blk_sg sg = { buf, size };
+    return virtio_blk_read_sg(sector, &sg, 1);
+}
+
+/**
+ * Log bytes read, throughput, requests and doorbells since init
+ */
+void virtio_blk_report(void);
+
+/**
+ * Reset device so that it stops touching guest memory, before we hand over memory to a kernel
+ */
+void virtio_blk_shutdown(void);
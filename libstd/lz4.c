@@ -0,0 +1,483 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lz4.h"
+
+/**
+ * Frame layout: magic, FLG, BD, [content size], [dict id], HC, blocks, end mark, [content checksum].
+ * Each block is a 32-bit size (high bit set for stored blocks), data and [block checksum].
+ *
+ * Compressed blocks are decoded a whole sequence at a time while token, lengths, literals and offset are all
+ * within current chunk. Sequences split across chunks go through a byte-wise state machine, which hands back
+ * to the fast path at the next token. Literal and match copies go through memmove, memcpy and memset,
+ * so wide copies are done by the same SIMD/ERMSB paths as everything else.
+ */
+
+#define LZ4_MAGIC               0x184D2204u
+#define LZ4_SKIPPABLE_MAGIC     0x184D2A50u
+#define LZ4_SKIPPABLE_MASK      0xFFFFFFF0u
+
+/** FLG byte */
+#define FLG_VERSION_MASK        0xC0
+#define FLG_VERSION             0x40
+#define FLG_BLOCK_CHECKSUM      0x10
+#define FLG_CONTENT_SIZE        0x08
+#define FLG_CONTENT_CHECKSUM    0x04
+#define FLG_RESERVED            0x02
+#define FLG_DICT_ID             0x01
+
+/** BD byte */
+#define BD_BLOCK_MAX(bd)        (((bd) >> 4) & 7)
+#define BD_RESERVED             0x8F
+
+#define BLOCK_STORED            0x80000000u
+
+#define MIN_MATCH               4
+#define LEN_MASK                15
+
+/** Short literals and matches are copied with one fixed-size copy, which may write past their end */
+#define SHORT_COPY              16
+
+enum {
+    ST_HEADER = 0,
+    ST_SKIP,                /* Skippable frame body */
+    ST_BLOCK_SIZE,
+    ST_BLOCK_STORED,
+    ST_BLOCK,
+    ST_BLOCK_CHECKSUM,
+    ST_CONTENT_CHECKSUM,
+    ST_DONE,
+    ST_ERROR,
+};
+
+enum {
+    SEQ_TOKEN = 0,
+    SEQ_LIT_EXT,
+    SEQ_LITERALS,
+    SEQ_OFFSET,
+    SEQ_MATCH_EXT,
+};
+
+static inline uint32_t le32(const uint8_t* p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t le64(const uint8_t* p)
+{
+    return le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+static inline size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+/** Header length once FLG byte is known */
+static inline uint32_t header_size(uint8_t flags)
+{
+    return 7 + (flags & FLG_CONTENT_SIZE ? 8 : 0) + (flags & FLG_DICT_ID ? 4 : 0);
+}
+
+/** Copy match from offset bytes back in output, overlapping matches repeat their period */
+static bool copy_match(struct lz4_stream* s, size_t offset, size_t len)
+{
+    uint8_t* d = s->op;
+    if (offset == 0 || offset > (size_t)(d - s->dst) || len > (size_t)(s->oend - d)) {
+        return false;
+    }
+
+    const uint8_t* m = d - offset;
+    s->op = d + len;
+
+    if (offset >= len) {
+        memcpy(d, m, len);
+    } else if (offset == 1) {
+        memset(d, *m, len);
+    } else {
+        /* Distance from m doubles with every copy and stays a multiple of the period */
+        while (len) {
+            size_t n = min_size(d - m, len);
+            memcpy(d, m, n);
+            d += n;
+            len -= n;
+        }
+    }
+
+    return true;
+}
+
+static bool copy_literals(struct lz4_stream* s, const uint8_t* ip, size_t len)
+{
+    if (len > (size_t)(s->oend - s->op)) {
+        return false;
+    }
+
+    /* Input may sit right after output when decoding in place */
+    memmove(s->op, ip, len);
+    s->op += len;
+    return true;
+}
+
+/**
+ * Decode whole sequences from [ip, iend).
+ * bend is block end if it is within reach, NULL otherwise.
+ * Returns pointer to first unconsumed byte, which is the start of a sequence that is not entirely in reach,
+ * or NULL on error.
+ */
+static const uint8_t* decode_fast(struct lz4_stream* s, const uint8_t* ip, const uint8_t* iend, const uint8_t* bend)
+{
+    while (ip < iend) {
+        const uint8_t* p = ip;
+        uint8_t token = *p++;
+
+        size_t lit = token >> 4;
+        if (lit == LEN_MASK) {
+            uint8_t b;
+            do {
+                if (p == iend) {
+                    return ip;
+                }
+                b = *p++;
+                lit += b;
+            } while (b == 255);
+        }
+
+        if (lit > (size_t)(iend - p)) {
+            return ip;
+        }
+
+        /* Last sequence of a block has literals only */
+        if (p + lit == bend) {
+            return copy_literals(s, p, lit) ? bend : NULL;
+        }
+
+        const uint8_t* lits = p;
+        p += lit;
+        if (iend - p < 2) {
+            return ip;
+        }
+
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+
+        size_t match = token & LEN_MASK;
+        if (match == LEN_MASK) {
+            uint8_t b;
+            do {
+                if (p == iend) {
+                    return ip;
+                }
+                b = *p++;
+                match += b;
+            } while (b == 255);
+        }
+
+        match += MIN_MATCH;
+        uint8_t* op = s->op;
+        size_t room = s->oend - op;
+
+        /* Short sequence: one fixed-size copy each for literals and match, inlined even in freestanding build.
+         * Writing past the end is fine as long as it stays in output and clear of unread input. */
+        if (lit <= SHORT_COPY && match <= SHORT_COPY && offset >= SHORT_COPY && iend - lits >= SHORT_COPY &&
+            room >= lit + SHORT_COPY && (uintptr_t)lits - (uintptr_t)op >= SHORT_COPY &&
+            (uintptr_t)p - (uintptr_t)(op + lit) >= SHORT_COPY && offset <= (size_t)(op + lit - s->dst)) {
+            __builtin_memcpy(op, lits, SHORT_COPY);
+            op += lit;
+            __builtin_memcpy(op, op - offset, SHORT_COPY);
+            s->op = op + match;
+        } else if (!copy_literals(s, lits, lit) || !copy_match(s, offset, match)) {
+            return NULL;
+        }
+
+        ip = p;
+    }
+
+    return ip;
+}
+
+/**
+ * Continue a sequence byte by byte until it is complete or input runs out.
+ * Returns pointer to first unconsumed byte or NULL on error.
+ */
+static const uint8_t* decode_slow(struct lz4_stream* s, const uint8_t* ip, const uint8_t* iend, const uint8_t* bend)
+{
+    while (ip < iend || (s->seq == SEQ_LITERALS && !s->lit_len)) {
+        switch (s->seq) {
+        case SEQ_TOKEN: {
+            uint8_t token = *ip++;
+            s->lit_len = token >> 4;
+            s->match_len = token & LEN_MASK;
+            s->seq = s->lit_len == LEN_MASK ? SEQ_LIT_EXT : SEQ_LITERALS;
+            break;
+        }
+        case SEQ_LIT_EXT: {
+            uint8_t b = *ip++;
+            s->lit_len += b;
+            s->seq = b == 255 ? SEQ_LIT_EXT : SEQ_LITERALS;
+            break;
+        }
+        case SEQ_LITERALS: {
+            size_t n = min_size(s->lit_len, iend - ip);
+            if (!copy_literals(s, ip, n)) {
+                return NULL;
+            }
+            ip += n;
+            s->lit_len -= n;
+            if (s->lit_len) {
+                break;
+            }
+
+            if (ip == bend) {
+                s->seq = SEQ_TOKEN;
+                return ip;
+            }
+            s->seq = SEQ_OFFSET;
+            s->offset = 0;
+            s->buffered = 0;
+            break;
+        }
+        case SEQ_OFFSET:
+            s->offset |= (uint32_t)*ip++ << (8 * s->buffered++);
+            if (s->buffered < 2) {
+                break;
+            }
+            s->buffered = 0;
+            if (s->match_len == LEN_MASK) {
+                s->seq = SEQ_MATCH_EXT;
+                break;
+            }
+            if (!copy_match(s, s->offset, s->match_len + MIN_MATCH)) {
+                return NULL;
+            }
+            s->seq = SEQ_TOKEN;
+            return ip;
+        case SEQ_MATCH_EXT: {
+            uint8_t b = *ip++;
+            s->match_len += b;
+            if (b == 255) {
+                break;
+            }
+            if (!copy_match(s, s->offset, s->match_len + MIN_MATCH)) {
+                return NULL;
+            }
+            s->seq = SEQ_TOKEN;
+            return ip;
+        }
+        }
+    }
+
+    return ip;
+}
+
+/** Consume up to avail bytes of current compressed block, returns bytes consumed or LZ4_ERROR */
+static size_t decode_block(struct lz4_stream* s, const uint8_t* src, size_t avail)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + min_size(avail, s->left);
+    const uint8_t* bend = s->left <= avail ? src + s->left : NULL;
+
+    while (ip && ip < iend) {
+        if (s->seq == SEQ_TOKEN) {
+            ip = decode_fast(s, ip, iend, bend);
+            if (!ip || ip == iend || ip == bend) {
+                break;
+            }
+        }
+        ip = decode_slow(s, ip, iend, bend);
+    }
+
+    if (!ip) {
+        return LZ4_ERROR;
+    }
+
+    /* Block may only end between sequences */
+    if (ip == bend && s->seq != SEQ_TOKEN) {
+        return LZ4_ERROR;
+    }
+
+    return ip - src;
+}
+
+/** Frame header is complete in s->buf, validate it and move on to blocks */
+static bool parse_header(struct lz4_stream* s)
+{
+    uint8_t flags = s->buf[4];
+    uint8_t bd = s->buf[5];
+
+    if ((flags & FLG_VERSION_MASK) != FLG_VERSION || (flags & (FLG_RESERVED | FLG_DICT_ID)) ||
+        (bd & BD_RESERVED) || BD_BLOCK_MAX(bd) < 4) {
+        return false;
+    }
+
+    if ((flags & FLG_CONTENT_SIZE) && le64(s->buf + 6) > (uint64_t)(s->oend - s->op)) {
+        return false;
+    }
+
+    s->flags = flags;
+    s->block_max = 1u << (8 + 2 * BD_BLOCK_MAX(bd));
+    s->state = ST_BLOCK_SIZE;
+    return true;
+}
+
+/** Collect header bytes, returns bytes consumed or LZ4_ERROR */
+static size_t feed_header(struct lz4_stream* s, const uint8_t* ip, size_t avail)
+{
+    uint32_t need = 4;
+    if (s->buffered >= 4) {
+        uint32_t magic = le32(s->buf);
+        if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+            need = 8;
+        } else if (magic != LZ4_MAGIC) {
+            return LZ4_ERROR;
+        } else {
+            need = s->buffered >= 5 ? header_size(s->buf[4]) : 5;
+        }
+    }
+
+    size_t n = min_size(need - s->buffered, avail);
+    memcpy(s->buf + s->buffered, ip, n);
+    s->buffered += n;
+    if (s->buffered < need || need <= 5) {
+        return n;
+    }
+
+    s->buffered = 0;
+    if (need == 8 && (le32(s->buf) & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+        s->left = le32(s->buf + 4);
+        s->state = ST_SKIP;
+        return n;
+    }
+
+    return parse_header(s) ? n : LZ4_ERROR;
+}
+
+static void end_block(struct lz4_stream* s)
+{
+    if (s->flags & FLG_BLOCK_CHECKSUM) {
+        s->left = 4;
+        s->state = ST_BLOCK_CHECKSUM;
+    } else {
+        s->state = ST_BLOCK_SIZE;
+    }
+}
+
+static size_t feed_block_size(struct lz4_stream* s, const uint8_t* ip, size_t avail)
+{
+    size_t n = min_size(4 - s->buffered, avail);
+    memcpy(s->buf + s->buffered, ip, n);
+    s->buffered += n;
+    if (s->buffered < 4) {
+        return n;
+    }
+    s->buffered = 0;
+
+    uint32_t size = le32(s->buf);
+    if (!size) {
+        s->left = 4;
+        s->state = s->flags & FLG_CONTENT_CHECKSUM ? ST_CONTENT_CHECKSUM : ST_DONE;
+        return n;
+    }
+
+    s->left = size & ~BLOCK_STORED;
+    if (s->left > s->block_max) {
+        return LZ4_ERROR;
+    }
+
+    s->seq = SEQ_TOKEN;
+    s->state = size & BLOCK_STORED ? ST_BLOCK_STORED : ST_BLOCK;
+    if (!s->left) {
+        end_block(s);
+    }
+    return n;
+}
+
+void lz4_init(struct lz4_stream* s, void* dst, size_t dst_size)
+{
+    memset(s, 0, sizeof(*s));
+    s->dst = dst;
+    s->op = dst;
+    s->oend = s->op + dst_size;
+    s->state = ST_HEADER;
+}
+
+size_t lz4_feed(struct lz4_stream* s, const void* src, size_t size)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = ip + size;
+
+    while (ip < iend && s->state != ST_DONE) {
+        size_t avail = iend - ip;
+        size_t n;
+
+        switch (s->state) {
+        case ST_HEADER:
+            n = feed_header(s, ip, avail);
+            break;
+        case ST_BLOCK_SIZE:
+            n = feed_block_size(s, ip, avail);
+            break;
+        case ST_BLOCK:
+            n = decode_block(s, ip, avail);
+            if (n != LZ4_ERROR && !(s->left -= n)) {
+                end_block(s);
+            }
+            break;
+        case ST_BLOCK_STORED:
+            n = min_size(s->left, avail);
+            if (!copy_literals(s, ip, n)) {
+                n = LZ4_ERROR;
+            } else if (!(s->left -= n)) {
+                end_block(s);
+            }
+            break;
+        case ST_SKIP:
+        case ST_BLOCK_CHECKSUM:
+        case ST_CONTENT_CHECKSUM:
+            n = min_size(s->left, avail);
+            s->left -= n;
+            if (!s->left) {
+                s->state = s->state == ST_SKIP ? ST_HEADER : s->state == ST_BLOCK_CHECKSUM ? ST_BLOCK_SIZE : ST_DONE;
+            }
+            break;
+        default:
+            n = LZ4_ERROR;
+            break;
+        }
+
+        if (n == LZ4_ERROR) {
+            s->state = ST_ERROR;
+            return LZ4_ERROR;
+        }
+        ip += n;
+    }
+
+    return ip - (const uint8_t*)src;
+}
+
+bool lz4_done(const struct lz4_stream* s)
+{
+    return s->state == ST_DONE;
+}
+
+uint64_t lz4_content_size(const void* src, size_t size)
+{
+    const uint8_t* p = src;
+    if (size < 14 || le32(p) != LZ4_MAGIC || !(p[4] & FLG_CONTENT_SIZE)) {
+        return 0;
+    }
+
+    return le64(p + 6);
+}
+
+size_t lz4_decode(void* dst, size_t dst_size, const void* src, size_t src_size)
+{
+    struct lz4_stream s;
+    lz4_init(&s, dst, dst_size);
+    if (lz4_feed(&s, src, src_size) == LZ4_ERROR || !lz4_done(&s)) {
+        return LZ4_ERROR;
+    }
+
+    return lz4_decoded_size(&s);
+}
@@ -0,0 +1,457 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sha256.h"
+#include "cpu.h"
+
+/**
+ * Block functions take state words h[0..7] and a run of whole blocks.
+ * SSE and AVX2 code is written with GCC vector extensions plus inline asm for SHA and SSSE3 instructions,
+ * AVX2 functions are compiled for that target alone, so that the rest of the image stays baseline x86-64.
+ */
+
+/** Lanes still busy when multi-buffer queue runs dry are finished one by one below this count */
+#define SHA256_MIN_LANES 3
+
+#define AVX2 __attribute__((target("avx2")))
+
+typedef uint32_t v4u __attribute__((vector_size(16)));
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef uint32_t v8u __attribute__((vector_size(32)));
+typedef uint8_t v32u8 __attribute__((vector_size(32)));
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t K[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror(uint32_t x, unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load_be32(const uint8_t* p)
+{
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v)
+{
+    v = __builtin_bswap32(v);
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+static void blocks_c(uint32_t* h, const uint8_t* p, size_t count)
+{
+    for (; count; --count, p += SHA256_BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = load_be32(p + i * 4);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+}
+
+/*
+ * SHA extensions.
+ * sha256rnds2 keeps state in two registers, ABEF and CDGH, A in the highest word,
+ * and does 2 rounds with message words plus constants from xmm0.
+ */
+
+static inline v4u sha256rnds2(v4u cdgh, v4u abef, v4u wk)
+{
+    __asm__ ("sha256rnds2 %2, %1, %0" :"+x"(cdgh) :"x"(abef), "Yz"(wk));
+    return cdgh;
+}
+
+static inline v4u sha256msg1(v4u w0, v4u w1)
+{
+    __asm__ ("sha256msg1 %1, %0" :"+x"(w0) :"x"(w1));
+    return w0;
+}
+
+static inline v4u sha256msg2(v4u w, v4u w3)
+{
+    __asm__ ("sha256msg2 %1, %0" :"+x"(w) :"x"(w3));
+    return w;
+}
+
+/** Words 1..3 of lo followed by word 0 of hi */
+static inline v4u alignr4(v4u hi, v4u lo)
+{
+    __asm__ ("palignr $4, %1, %0" :"+x"(hi) :"x"(lo));
+    return hi;
+}
+
+static inline v4u load_be128(const uint8_t* p)
+{
+    static const v16u8 bswap = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+    v4u v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    __asm__ ("pshufb %1, %0" :"+x"(v) :"x"(bswap));
+    return v;
+}
+
+static void blocks_shani(uint32_t* h, const uint8_t* p, size_t count)
+{
+    v4u abcd, efgh;
+    __builtin_memcpy(&abcd, h, sizeof(abcd));
+    __builtin_memcpy(&efgh, h + 4, sizeof(efgh));
+    v4u abef = __builtin_shuffle(abcd, efgh, (v4u){ 5, 4, 1, 0 });
+    v4u cdgh = __builtin_shuffle(abcd, efgh, (v4u){ 7, 6, 3, 2 });
+    const v4u* k = (const v4u*)K;
+
+    for (; count; --count, p += SHA256_BLOCK_SIZE) {
+        v4u abef_in = abef;
+        v4u cdgh_in = cdgh;
+
+        /* w[g & 3] holds message words 4g..4g+3, 4 rounds per iteration */
+        v4u w[4];
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; ++g) {
+            if (g < 4) {
+                w[g] = load_be128(p + g * 16);
+            } else {
+                v4u w7 = alignr4(w[(g + 3) & 3], w[(g + 2) & 3]);
+                w[g & 3] = sha256msg2(sha256msg1(w[g & 3], w[(g + 1) & 3]) + w7, w[(g + 3) & 3]);
+            }
+
+            v4u wk = w[g & 3] + k[g];
+            cdgh = sha256rnds2(cdgh, abef, wk);
+            abef = sha256rnds2(abef, cdgh, __builtin_shuffle(wk, (v4u){ 2, 3, 0, 1 }));
+        }
+
+        abef += abef_in;
+        cdgh += cdgh_in;
+    }
+
+    abcd = __builtin_shuffle(abef, cdgh, (v4u){ 3, 2, 7, 6 });
+    efgh = __builtin_shuffle(abef, cdgh, (v4u){ 1, 0, 5, 4 });
+    __builtin_memcpy(h, &abcd, sizeof(abcd));
+    __builtin_memcpy(h + 4, &efgh, sizeof(efgh));
+}
+
+static inline bool has_sha_ni(void)
+{
+    return cpu_has(CPU_FEATURE_SHA) && cpu_has(CPU_FEATURE_SSSE3);
+}
+
+static void blocks(uint32_t* h, const uint8_t* p, size_t count)
+{
+    if (has_sha_ni()) {
+        blocks_shani(h, p, count);
+    } else {
+        blocks_c(h, p, count);
+    }
+}
+
+/** Pad last partial block of a message of total bytes into 1 or 2 blocks at out, returns their count */
+static size_t pad_tail(uint8_t* out, const uint8_t* rest, size_t rest_size, uint64_t total)
+{
+    size_t count = rest_size < SHA256_BLOCK_SIZE - 8 ? 1 : 2;
+    size_t end = count * SHA256_BLOCK_SIZE;
+
+    memcpy(out, rest, rest_size);
+    out[rest_size] = 0x80;
+    memset(out + rest_size + 1, 0, end - 8 - rest_size - 1);
+    store_be32(out + end - 8, (uint32_t)(total >> 29));
+    store_be32(out + end - 4, (uint32_t)(total << 3));
+    return count;
+}
+
+static void write_digest(const uint32_t* h, uint8_t* digest)
+{
+    for (int i = 0; i < 8; ++i) {
+        store_be32(digest + i * 4, h[i]);
+    }
+}
+
+void sha256_init(struct sha256* ctx)
+{
+    memcpy(ctx->h, H0, sizeof(H0));
+    ctx->size = 0;
+}
+
+void sha256_update(struct sha256* ctx, const void* data, size_t size)
+{
+    const uint8_t* p = data;
+    size_t used = ctx->size % SHA256_BLOCK_SIZE;
+    ctx->size += size;
+
+    if (used) {
+        size_t n = SHA256_BLOCK_SIZE - used < size ? SHA256_BLOCK_SIZE - used : size;
+        memcpy(ctx->buf + used, p, n);
+        p += n;
+        size -= n;
+        if (used + n < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        blocks(ctx->h, ctx->buf, 1);
+    }
+
+    if (size >= SHA256_BLOCK_SIZE) {
+        blocks(ctx->h, p, size / SHA256_BLOCK_SIZE);
+        p += size & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+        size %= SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buf, p, size);
+}
+
+void sha256_final(struct sha256* ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+    blocks(ctx->h, tail, pad_tail(tail, ctx->buf, ctx->size % SHA256_BLOCK_SIZE, ctx->size));
+    write_digest(ctx->h, digest);
+}
+
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    struct sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, digest);
+}
+
+const char* sha256_impl(void)
+{
+    return has_sha_ni() ? "sha-ni" : "c";
+}
+
+/*
+ * AVX2 multi-buffer.
+ * State is transposed: s[i] holds word i of all 8 lanes, message words are transposed the same way on load.
+ */
+
+static inline AVX2 __attribute__((always_inline)) v8u ror8(v8u x, unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+/** Load 32 bytes of each lane and transpose, w[i] gets word i of every lane */
+static inline AVX2 __attribute__((always_inline)) void load_x8(v8u* w, const uint8_t* const* p, size_t offset)
+{
+    static const v32u8 bswap = {
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        19, 18, 17, 16, 23, 22, 21, 20, 27, 26, 25, 24, 31, 30, 29, 28,
+    };
+
+    v8u r[SHA256_LANES];
+    for (int i = 0; i < SHA256_LANES; ++i) {
+        v32u8 b;
+        __builtin_memcpy(&b, p[i] + offset, sizeof(b));
+        r[i] = (v8u)__builtin_shuffle(b, bswap);
+    }
+
+    /* Unpack 32 and 64-bit pairs within 128-bit halves, then swap halves */
+    v8u t[SHA256_LANES], u[SHA256_LANES];
+    for (int i = 0; i < SHA256_LANES; i += 2) {
+        t[i] = __builtin_shuffle(r[i], r[i + 1], (v8u){ 0, 8, 1, 9, 4, 12, 5, 13 });
+        t[i + 1] = __builtin_shuffle(r[i], r[i + 1], (v8u){ 2, 10, 3, 11, 6, 14, 7, 15 });
+    }
+    for (int i = 0; i < SHA256_LANES; i += 4) {
+        u[i] = __builtin_shuffle(t[i], t[i + 2], (v8u){ 0, 1, 8, 9, 4, 5, 12, 13 });
+        u[i + 1] = __builtin_shuffle(t[i], t[i + 2], (v8u){ 2, 3, 10, 11, 6, 7, 14, 15 });
+        u[i + 2] = __builtin_shuffle(t[i + 1], t[i + 3], (v8u){ 0, 1, 8, 9, 4, 5, 12, 13 });
+        u[i + 3] = __builtin_shuffle(t[i + 1], t[i + 3], (v8u){ 2, 3, 10, 11, 6, 7, 14, 15 });
+    }
+    for (int i = 0; i < 4; ++i) {
+        w[i] = __builtin_shuffle(u[i], u[i + 4], (v8u){ 0, 1, 2, 3, 8, 9, 10, 11 });
+        w[i + 4] = __builtin_shuffle(u[i], u[i + 4], (v8u){ 4, 5, 6, 7, 12, 13, 14, 15 });
+    }
+}
+
+/** Compress one block per lane, state of lanes that are off in mask is left as is */
+static AVX2 void compress_x8(v8u* s, const uint8_t* const* p, v8u mask)
+{
+    v8u w[16];
+    load_x8(w, p, 0);
+    load_x8(w + 8, p, 32);
+
+    v8u a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; ++i) {
+        if (i >= 16) {
+            v8u w15 = w[(i - 15) & 15];
+            v8u w2 = w[(i - 2) & 15];
+            w[i & 15] += (ror8(w15, 7) ^ ror8(w15, 18) ^ (w15 >> 3)) + w[(i - 7) & 15] +
+                         (ror8(w2, 17) ^ ror8(w2, 19) ^ (w2 >> 10));
+        }
+
+        v8u t1 = h + (ror8(e, 6) ^ ror8(e, 11) ^ ror8(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i & 15];
+        v8u t2 = (ror8(a, 2) ^ ror8(a, 13) ^ ror8(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    s[0] += a & mask;
+    s[1] += b & mask;
+    s[2] += c & mask;
+    s[3] += d & mask;
+    s[4] += e & mask;
+    s[5] += f & mask;
+    s[6] += g & mask;
+    s[7] += h & mask;
+}
+
+#define LANE_IDLE ((size_t)-1)
+
+struct lane {
+    size_t job;                 /* Buffer index, LANE_IDLE if there is none */
+    const uint8_t* data;        /* Next block */
+    size_t left;                /* Blocks left at data */
+    size_t tail;                /* Padded blocks still to go after that */
+    uint8_t pad[2 * SHA256_BLOCK_SIZE];
+};
+
+static AVX2 void lane_start(struct lane* lane, v8u* s, int l, size_t job, const uint8_t* data, size_t size)
+{
+    size_t full = size / SHA256_BLOCK_SIZE;
+    lane->job = job;
+    lane->data = data;
+    lane->left = full;
+    lane->tail = pad_tail(lane->pad, data + full * SHA256_BLOCK_SIZE, size % SHA256_BLOCK_SIZE, size);
+
+    for (int i = 0; i < 8; ++i) {
+        s[i][l] = H0[i];
+    }
+}
+
+static AVX2 void multi_avx2(const void* const* data, const size_t* size, size_t count,
+                            uint8_t (*digests)[SHA256_DIGEST_SIZE])
+{
+    static const uint8_t idle_block[SHA256_BLOCK_SIZE];
+    struct lane lanes[SHA256_LANES];
+    v8u s[8];
+    size_t next = 0;
+    unsigned active = 0;
+
+    for (int l = 0; l < SHA256_LANES; ++l) {
+        lanes[l].job = LANE_IDLE;
+        if (next < count) {
+            lane_start(&lanes[l], s, l, next, data[next], size[next]);
+            ++next;
+            ++active;
+        }
+    }
+
+    while (active && (next < count || active >= SHA256_MIN_LANES)) {
+        const uint8_t* p[SHA256_LANES];
+        v8u mask = { 0 };
+
+        for (int l = 0; l < SHA256_LANES; ++l) {
+            struct lane* lane = &lanes[l];
+            if (lane->job == LANE_IDLE) {
+                p[l] = idle_block;
+                continue;
+            }
+
+            if (!lane->left) {
+                lane->data = lane->pad;
+                lane->left = lane->tail;
+                lane->tail = 0;
+            }
+            p[l] = lane->data;
+            lane->data += SHA256_BLOCK_SIZE;
+            lane->left--;
+            mask[l] = ~0u;
+        }
+
+        compress_x8(s, p, mask);
+
+        for (int l = 0; l < SHA256_LANES; ++l) {
+            struct lane* lane = &lanes[l];
+            if (lane->job == LANE_IDLE || lane->left || lane->tail) {
+                continue;
+            }
+
+            uint32_t h[8];
+            for (int i = 0; i < 8; ++i) {
+                h[i] = s[i][l];
+            }
+            write_digest(h, digests[lane->job]);
+
+            lane->job = LANE_IDLE;
+            --active;
+            if (next < count) {
+                lane_start(lane, s, l, next, data[next], size[next]);
+                ++next;
+                ++active;
+            }
+        }
+    }
+
+    /* Too few lanes left to fill a vector, finish them one at a time */
+    for (int l = 0; l < SHA256_LANES; ++l) {
+        struct lane* lane = &lanes[l];
+        if (lane->job == LANE_IDLE) {
+            continue;
+        }
+
+        uint32_t h[8];
+        for (int i = 0; i < 8; ++i) {
+            h[i] = s[i][l];
+        }
+        blocks_c(h, lane->data, lane->left);
+        blocks_c(h, lane->pad, lane->tail);
+        write_digest(h, digests[lane->job]);
+    }
+}
+
+void sha256_multi(const void* const* data, const size_t* size, size_t count, uint8_t (*digests)[SHA256_DIGEST_SIZE])
+{
+    /* A single SHA-NI stream outruns all 8 AVX2 lanes */
+    if (has_sha_ni() || !cpu_has(CPU_FEATURE_AVX2) || count < 2) {
+        for (size_t i = 0; i < count; ++i) {
+            sha256(data[i], size[i], digests[i]);
+        }
+        return;
+    }
+
+    multi_avx2(data, size, count, digests);
+}
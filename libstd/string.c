@@ -0,0 +1,352 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cpu.h"
+
+/**
+ * Memory routines dispatch on cached CPU features (see include/cpu.h):
+ * - Sizes above MEMOPS_NT_THRESHOLD use non-temporal stores, so we don't thrash caches with data we won't read back.
+ * - rep movsb/stosb when CPU has FSRM, or ERMSB and size is large enough to amortize startup cost.
+ * - AVX2 or SSE2 loops otherwise.
+ *
+ * There are no plain C byte or word copy loops in here on purpose:
+ * compiler is free to turn them back into calls to memcpy/memset.
+ */
+
+#define MEMOPS_NT_THRESHOLD     (256ul << 10)
+#define MEMOPS_ERMSB_THRESHOLD  2048
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+
+static inline void movsb(void* dest, const void* src, size_t n)
+{
+    __asm__ volatile ("rep movsb" :"+D"(dest), "+S"(src), "+c"(n) ::"memory");
+}
+
+static inline void movsb_backwards(void* dest, const void* src, size_t n)
+{
+    __asm__ volatile ("std; rep movsb; cld" :"+D"(dest), "+S"(src), "+c"(n) ::"memory");
+}
+
+static inline void stosb(void* dest, uint8_t c, size_t n)
+{
+    __asm__ volatile ("rep stosb" :"+D"(dest), "+c"(n) :"a"(c) :"memory");
+}
+
+/** Copy less than 16 bytes with at most 2 overlapping loads and stores */
+static inline void copy_small(uint8_t* d, const uint8_t* s, size_t n)
+{
+    if (n >= 8) {
+        uint64_t head = *(const unaligned_u64*)s;
+        uint64_t tail = *(const unaligned_u64*)(s + n - 8);
+        *(unaligned_u64*)d = head;
+        *(unaligned_u64*)(d + n - 8) = tail;
+    } else if (n >= 4) {
+        uint32_t head = *(const unaligned_u32*)s;
+        uint32_t tail = *(const unaligned_u32*)(s + n - 4);
+        *(unaligned_u32*)d = head;
+        *(unaligned_u32*)(d + n - 4) = tail;
+    } else if (n) {
+        movsb(d, s, n);
+    }
+}
+
+/** Copy 16 bytes, source and destination may overlap */
+static inline void copy16(uint8_t* d, const uint8_t* s)
+{
+    __asm__ volatile ("movdqu (%1), %%xmm0\n"
+                      "movdqu %%xmm0, (%0)\n"
+                      ::"r"(d), "r"(s) :"xmm0", "memory");
+}
+
+/** Copy 64 bytes, all loads are done before stores */
+static inline void copy64_sse2(uint8_t* d, const uint8_t* s)
+{
+    __asm__ volatile ("movdqu   (%1), %%xmm0\n"
+                      "movdqu 16(%1), %%xmm1\n"
+                      "movdqu 32(%1), %%xmm2\n"
+                      "movdqu 48(%1), %%xmm3\n"
+                      "movdqu %%xmm0,   (%0)\n"
+                      "movdqu %%xmm1, 16(%0)\n"
+                      "movdqu %%xmm2, 32(%0)\n"
+                      "movdqu %%xmm3, 48(%0)\n"
+                      ::"r"(d), "r"(s) :"xmm0", "xmm1", "xmm2", "xmm3", "memory");
+}
+
+static inline void copy64_nt(uint8_t* d, const uint8_t* s)
+{
+    __asm__ volatile ("movdqu   (%1), %%xmm0\n"
+                      "movdqu 16(%1), %%xmm1\n"
+                      "movdqu 32(%1), %%xmm2\n"
+                      "movdqu 48(%1), %%xmm3\n"
+                      "movntdq %%xmm0,   (%0)\n"
+                      "movntdq %%xmm1, 16(%0)\n"
+                      "movntdq %%xmm2, 32(%0)\n"
+                      "movntdq %%xmm3, 48(%0)\n"
+                      ::"r"(d), "r"(s) :"xmm0", "xmm1", "xmm2", "xmm3", "memory");
+}
+
+static inline void copy128_avx2(uint8_t* d, const uint8_t* s)
+{
+    __asm__ volatile ("vmovdqu   (%1), %%ymm0\n"
+                      "vmovdqu 32(%1), %%ymm1\n"
+                      "vmovdqu 64(%1), %%ymm2\n"
+                      "vmovdqu 96(%1), %%ymm3\n"
+                      "vmovdqu %%ymm0,   (%0)\n"
+                      "vmovdqu %%ymm1, 32(%0)\n"
+                      "vmovdqu %%ymm2, 64(%0)\n"
+                      "vmovdqu %%ymm3, 96(%0)\n"
+                      ::"r"(d), "r"(s) :"xmm0", "xmm1", "xmm2", "xmm3", "memory");
+}
+
+static inline void vzeroupper(void)
+{
+    __asm__ volatile ("vzeroupper" :::"xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+static inline void sfence(void)
+{
+    __asm__ volatile ("sfence" :::"memory");
+}
+
+/** Non-overlapping copy of at least 16 bytes, tail is done with an overlapping 16-byte copy */
+static void copy_sse2(uint8_t* d, const uint8_t* s, size_t n)
+{
+    uint8_t* dend = d + n;
+    const uint8_t* send = s + n;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        copy64_sse2(d, s);
+    }
+
+    for (; n >= 16; n -= 16, d += 16, s += 16) {
+        copy16(d, s);
+    }
+
+    if (n) {
+        copy16(dend - 16, send - 16);
+    }
+}
+
+static void copy_avx2(uint8_t* d, const uint8_t* s, size_t n)
+{
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        copy128_avx2(d, s);
+    }
+    vzeroupper();
+
+    if (n >= 16) {
+        copy_sse2(d, s, n);
+    } else {
+        copy_small(d, s, n);
+    }
+}
+
+static void copy_nt(uint8_t* d, const uint8_t* s, size_t n)
+{
+    /* Align destination, we have plenty of bytes to spare */
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    copy16(d, s);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        copy64_nt(d, s);
+    }
+    sfence();
+
+    if (n >= 16) {
+        copy_sse2(d, s, n);
+    } else {
+        copy_small(d, s, n);
+    }
+}
+
+void* memcpy(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+
+    if (n < 16) {
+        copy_small(d, s, n);
+    } else if (n >= MEMOPS_NT_THRESHOLD) {
+        copy_nt(d, s, n);
+    } else if (cpu_has(CPU_FEATURE_FSRM) || (n >= MEMOPS_ERMSB_THRESHOLD && cpu_has(CPU_FEATURE_ERMSB))) {
+        movsb(d, s, n);
+    } else if (cpu_has(CPU_FEATURE_AVX2)) {
+        copy_avx2(d, s, n);
+    } else {
+        copy_sse2(d, s, n);
+    }
+
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+
+    if (d == s || n == 0) {
+        return dest;
+    }
+
+    /* No overlap at all */
+    if (d + n <= s || s + n <= d) {
+        return memcpy(dest, src, n);
+    }
+
+    /* Overlapping chunks are safe to copy as long as each chunk is loaded before it is stored
+     * and chunks go in the same direction as destination is from source. */
+    if (d < s) {
+        for (; n >= 64; n -= 64, d += 64, s += 64) {
+            copy64_sse2(d, s);
+        }
+        movsb(d, s, n);
+    } else {
+        for (; n >= 64; n -= 64) {
+            copy64_sse2(d + n - 64, s + n - 64);
+        }
+        if (n) {
+            movsb_backwards(d + n - 1, s + n - 1, n);
+        }
+    }
+
+    return dest;
+}
+
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+
+static inline void set16(uint8_t* d, v2u64 v)
+{
+    __asm__ volatile ("movdqu %1, (%0)" ::"r"(d), "x"(v) :"memory");
+}
+
+static inline void set64_sse2(uint8_t* d, v2u64 v)
+{
+    __asm__ volatile ("movdqu %1,   (%0)\n"
+                      "movdqu %1, 16(%0)\n"
+                      "movdqu %1, 32(%0)\n"
+                      "movdqu %1, 48(%0)\n"
+                      ::"r"(d), "x"(v) :"memory");
+}
+
+static inline void set64_nt(uint8_t* d, v2u64 v)
+{
+    __asm__ volatile ("movntdq %1,   (%0)\n"
+                      "movntdq %1, 16(%0)\n"
+                      "movntdq %1, 32(%0)\n"
+                      "movntdq %1, 48(%0)\n"
+                      ::"r"(d), "x"(v) :"memory");
+}
+
+/** Set n / 128 blocks of 128 bytes, returns pointer past the last one */
+static inline uint8_t* set_avx2(uint8_t* d, v2u64 v, size_t n)
+{
+    size_t nblocks = n >> 7;
+    if (!nblocks) {
+        return d;
+    }
+
+    __asm__ volatile ("vmovdqa %2, %%xmm0\n"
+                      "vinsertf128 $1, %%xmm0, %%ymm0, %%ymm0\n"
+                      "1:\n"
+                      "vmovdqu %%ymm0,   (%0)\n"
+                      "vmovdqu %%ymm0, 32(%0)\n"
+                      "vmovdqu %%ymm0, 64(%0)\n"
+                      "vmovdqu %%ymm0, 96(%0)\n"
+                      "add $128, %0\n"
+                      "dec %1\n"
+                      "jnz 1b\n"
+                      "vzeroupper\n"
+                      :"+r"(d), "+r"(nblocks) :"x"(v) :"xmm0", "memory");
+    return d;
+}
+
+/** Set at least 16 bytes, tail is done with an overlapping 16-byte store */
+static void set_simd(uint8_t* d, uint8_t c, size_t n, bool nt)
+{
+    uint8_t* dend = d + n;
+    uint64_t pattern = 0x0101010101010101ull * c;
+    v2u64 v = { pattern, pattern };
+
+    set16(d, v);
+
+    if (nt) {
+        /* Align destination, head is covered by the store above */
+        size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+        d += head;
+        n -= head;
+
+        for (; n >= 64; n -= 64, d += 64) {
+            set64_nt(d, v);
+        }
+        sfence();
+    } else if (cpu_has(CPU_FEATURE_AVX2)) {
+        uint8_t* end = set_avx2(d, v, n);
+        n -= end - d;
+        d = end;
+    }
+
+    for (; n >= 64; n -= 64, d += 64) {
+        set64_sse2(d, v);
+    }
+
+    for (; n >= 16; n -= 16, d += 16) {
+        set16(d, v);
+    }
+
+    set16(dend - 16, v);
+}
+
+void* memset(void* s, int c, size_t n)
+{
+    if (n < 16) {
+        stosb(s, (uint8_t)c, n);
+    } else if (n >= MEMOPS_NT_THRESHOLD) {
+        set_simd(s, (uint8_t)c, n, true);
+    } else if (cpu_has(CPU_FEATURE_FSRM) || (n >= MEMOPS_ERMSB_THRESHOLD && cpu_has(CPU_FEATURE_ERMSB))) {
+        stosb(s, (uint8_t)c, n);
+    } else {
+        set_simd(s, (uint8_t)c, n, false);
+    }
+
+    return s;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n)
+{
+    const uint8_t* a = s1;
+    const uint8_t* b = s2;
+    for (; n; --n, ++a, ++b) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+    }
+
+    return 0;
+}
+
+size_t strlen(const char* s)
+{
+    size_t len = 0;
+    while (*s++ != '\0') {
+        ++len;
+    }
+
+    return len;
+}
+
+int strncmp(const char* s1, const char* s2, size_t n)
+{
+    for (; n; --n, ++s1, ++s2) {
+        if (*s1 != *s2 || *s1 == '\0') {
+            return (unsigned char)*s1 - (unsigned char)*s2;
+        }
+    }
+
+    return 0;
+}
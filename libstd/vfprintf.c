@@ -3,10 +3,7 @@
 #include <string.h>
 #include <assert.h>
 
-static void _debugcon_putc(char c)
-{
-    __asm__ volatile("out %%al, %%dx" ::"a"(c), "d"(0x402):);
-}
+#include "logring.h"
 
 /**
  * Printf-like format string parsing
@@ -81,8 +78,8 @@ static int format_number(struct fmt_parse* fmt, FILE* filp, va_list* ap, bool is
 
     if (base != 10 || !is_signed) {
         switch (fmt->length) {
-        case FMT_LENGTH_CHAR: ull = va_arg(*ap, unsigned char); break;
-        case FMT_LENGTH_SHORT: ull = va_arg(*ap, unsigned short); break;
+        case FMT_LENGTH_CHAR: ull = (unsigned char)va_arg(*ap, unsigned int); break;
+        case FMT_LENGTH_SHORT: ull = (unsigned short)va_arg(*ap, unsigned int); break;
         case FMT_LENGTH_INT: ull = va_arg(*ap, unsigned int); break;
         case FMT_LENGTH_LONG: ull = va_arg(*ap, unsigned long); break;
         case FMT_LENGTH_LONGLONG: ull = va_arg(*ap, unsigned long long); break;
@@ -93,8 +90,8 @@ static int format_number(struct fmt_parse* fmt, FILE* filp, va_list* ap, bool is
         neg = false;
     } else if (is_signed) {
         switch (fmt->length) {
-        case FMT_LENGTH_CHAR: sll = va_arg(*ap, signed char); break;
-        case FMT_LENGTH_SHORT: sll = va_arg(*ap, signed short); break;
+        case FMT_LENGTH_CHAR: sll = (signed char)va_arg(*ap, signed int); break;
+        case FMT_LENGTH_SHORT: sll = (signed short)va_arg(*ap, signed int); break;
         case FMT_LENGTH_INT: sll = va_arg(*ap, signed int); break;
         case FMT_LENGTH_LONG: sll = va_arg(*ap, signed long); break;
         case FMT_LENGTH_LONGLONG: sll = va_arg(*ap, signed long long); break;
@@ -118,23 +115,24 @@ static int format_number(struct fmt_parse* fmt, FILE* filp, va_list* ap, bool is
         ull /= base;
     } while (ull);
 
-    if (neg || (fmt->flags & FMT_FLAG_SIGN)) {
-        *pbuf-- = neg ? '-' : '+';
-    }
-
+    /* Prefix goes to the buffer, so that it is counted and padded along with digits */
     if (fmt->flags & FMT_FLAG_ALTERNATE) {
-        if (base == 8) {
-            filp('0');
+        if (base == 8 && pbuf[1] != '0') {
+            *pbuf-- = '0';
         } else if (base == 16) {
-            filp('0');
-            filp('x');
+            *pbuf-- = fmt->upcase ? 'X' : 'x';
+            *pbuf-- = '0';
         }
     }
 
+    if (neg || (fmt->flags & FMT_FLAG_SIGN)) {
+        *pbuf-- = neg ? '-' : '+';
+    }
+
     return format_str(fmt, filp, ++pbuf);
 }
 
-static int _vfprintf(FILE* filp, const char* s, va_list ap)
+static int _vfprintf(FILE* filp, const char* s, va_list* ap)
 {
     int res = 0;
 
@@ -202,15 +200,15 @@ static int _vfprintf(FILE* filp, const char* s, va_list ap)
         /* Required conversion specifier */
         switch (*s++) {
         case 'd':
-        case 'i': res += format_number(&fmt, filp, &ap, true, 10); break;
-        case 'u': res += format_number(&fmt, filp, &ap, false, 10); break;
-        case 'o': res += format_number(&fmt, filp, &ap, false, 8); break;
-        case 'x': res += format_number(&fmt, filp, &ap, false, 16); break;
+        case 'i': res += format_number(&fmt, filp, ap, true, 10); break;
+        case 'u': res += format_number(&fmt, filp, ap, false, 10); break;
+        case 'o': res += format_number(&fmt, filp, ap, false, 8); break;
+        case 'x': res += format_number(&fmt, filp, ap, false, 16); break;
         case 'X': fmt.upcase = true;
-                  res += format_number(&fmt, filp, &ap, false, 16); break;
-        case 'p': res += format_number(&fmt, filp, &ap, false, 16); break;
-        case 'c': res += format_char(&fmt, filp, va_arg(ap, char)); break;
-        case 's': res += format_str(&fmt, filp, va_arg(ap, const char*)); break;
+                  res += format_number(&fmt, filp, ap, false, 16); break;
+        case 'p': res += format_number(&fmt, filp, ap, false, 16); break;
+        case 'c': res += format_char(&fmt, filp, (char)va_arg(*ap, int)); break;
+        case 's': res += format_str(&fmt, filp, va_arg(*ap, const char*)); break;
         default: /* Invalid, ignore the whole thing */ break;
         }
     }
@@ -220,19 +218,25 @@ static int _vfprintf(FILE* filp, const char* s, va_list ap)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-FILE* stdout = _debugcon_putc;
-FILE* stderr = _debugcon_putc;
+FILE* stdout = log_ring_putc;
+FILE* stderr = log_ring_putc;
 
+/** va_list parameter has decayed to a pointer, formatting takes it by address, so it works on a local copy */
 int vfprintf(FILE* filp, const char* format, va_list ap)
 {
-    return _vfprintf(filp, format, ap);
+    va_list args;
+    va_copy(args, ap);
+    int res = _vfprintf(filp, format, &args);
+    va_end(args);
+
+    return res;
 }
 
 int fprintf(FILE* filp, const char* format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    int res = _vfprintf(filp, format, ap);
+    int res = _vfprintf(filp, format, &ap);
     va_end(ap);
 
     return res;
@@ -240,14 +244,14 @@ int fprintf(FILE* filp, const char* format, ...)
 
 int vprintf(const char* format, va_list ap)
 {
-    return _vfprintf(stdout, format, ap);
+    return vfprintf(stdout, format, ap);
 }
 
 int printf(const char* format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    int res = _vfprintf(stdout, format, ap);
+    int res = _vfprintf(stdout, format, &ap);
     va_end(ap);
 
     return res;
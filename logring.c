@@ -0,0 +1,83 @@
+#include <inttypes.h>
+
+#include "logring.h"
+#include "datamap.h"
+
+#if !defined(LOG_RING_BASE) || !defined(LOG_RING_SIZE)
+#   error LOG_RING_BASE and LOG_RING_SIZE should be defined
+#endif
+
+_Static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "Log ring size should be a power of 2");
+
+#define DEBUGCON_PORT 0x402
+
+#define LOG_RING ((struct log_ring*)LOG_RING_BASE)
+
+static inline void outsb(uint16_t port, const char* buf, size_t n)
+{
+    __asm__ volatile ("rep outsb" :"+S"(buf), "+c"(n) :"d"(port) :"memory");
+}
+
+void init_log_ring(void)
+{
+    struct log_ring* ring = LOG_RING;
+    ring->size = LOG_RING_SIZE;
+    ring->head = 0;
+    ring->flushed = 0;
+    ring->magic = LOG_RING_MAGIC;
+}
+
+void log_flush(void)
+{
+    struct log_ring* ring = LOG_RING;
+
+    /* Ring is left for memory dump readers, debugcon port is never touched */
+    if (!LOG_RING_FLUSH) {
+        return;
+    }
+
+    while (ring->flushed != ring->head) {
+        size_t pos = ring->flushed & (ring->size - 1);
+        size_t n = ring->head - ring->flushed;
+
+        /* Flush up to the end of data, wrapped part goes on next iteration */
+        if (pos + n > ring->size) {
+            n = ring->size - pos;
+        }
+
+        outsb(DEBUGCON_PORT, &ring->data[pos], n);
+        ring->flushed += n;
+    }
+}
+
+void log_ring_putc(char c)
+{
+    struct log_ring* ring = LOG_RING;
+
+    if (ring->head - ring->flushed == ring->size) {
+        if (LOG_RING_FLUSH) {
+            log_flush();
+        } else {
+            /* Oldest byte is overwritten */
+            ring->flushed++;
+        }
+    }
+
+    ring->data[ring->head & (ring->size - 1)] = c;
+    ring->head++;
+}
+
+void log_ring_write(const void* buf, size_t n)
+{
+    const char* p = buf;
+    while (n--) {
+        log_ring_putc(*p++);
+    }
+}
+
+void log_emit_token(uint32_t id, unsigned nargs, const uint64_t* args)
+{
+    uint32_t tag = (id << LOG_TOKEN_NARGS_BITS) | nargs;
+    log_ring_write(&tag, sizeof(tag));
+    log_ring_write(args, nargs * sizeof(*args));
+}
@@ -0,0 +1,214 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "measure.h"
+#include "dataseg.h"
+#include "fw_cfg.h"
+#include "page_alloc.h"
+#include "logging.h"
+
+/** Expected digests file is parsed into the log table, so it should be no bigger than this */
+#define MEASURE_MAX_FILE_SIZE (4 * PAGE_SIZE)
+
+struct expected_digest {
+    char name[MEASURE_MAX_NAME];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+};
+
+/** Measurement log, allocated from dataseg */
+struct measure_log {
+    uint32_t count;
+    uint32_t expected_count;
+    bool policy;            /* Expected digests file is present */
+    bool policy_broken;     /* File could not be parsed, nothing will verify */
+    struct measurement entries[MEASURE_MAX_ENTRIES];
+    struct expected_digest expected[MEASURE_MAX_ENTRIES];
+};
+
+static struct measure_log* measure_log;
+
+/** FIPS 180-2 "abc" */
+static const uint8_t self_test_digest[SHA256_DIGEST_SIZE] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+
+/** Digest words for logs, printed as 4 %016llx, which tokenized logging can carry */
+static uint64_t digest_word(const uint8_t* digest, int i)
+{
+    uint64_t v;
+    memcpy(&v, digest + i * 8, sizeof(v));
+    return __builtin_bswap64(v);
+}
+
+#define DIGEST_FMT "%016llx%016llx%016llx%016llx"
+#define DIGEST_ARGS(d) digest_word(d, 0), digest_word(d, 1), digest_word(d, 2), digest_word(d, 3)
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/** Parse one "<hex digest>  <name>" or "<hex digest> *<name>" line */
+static bool parse_line(const char* line, size_t len, struct expected_digest* out)
+{
+    if (len < SHA256_DIGEST_SIZE * 2 + 2 || line[SHA256_DIGEST_SIZE * 2] != ' ') {
+        return false;
+    }
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+        int hi = hex_nibble(line[i * 2]);
+        int lo = hex_nibble(line[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out->digest[i] = (hi << 4) | lo;
+    }
+
+    /* Second character of the separator is ' ' for text mode and '*' for binary mode */
+    const char* name = line + SHA256_DIGEST_SIZE * 2 + 2;
+    size_t name_len = len - SHA256_DIGEST_SIZE * 2 - 2;
+    if (line[SHA256_DIGEST_SIZE * 2 + 1] != ' ' && line[SHA256_DIGEST_SIZE * 2 + 1] != '*') {
+        return false;
+    }
+    if (!name_len || name_len >= MEASURE_MAX_NAME) {
+        return false;
+    }
+
+    memcpy(out->name, name, name_len);
+    out->name[name_len] = '\0';
+    return true;
+}
+
+static bool parse_digests(struct measure_log* log, const char* text, size_t size)
+{
+    for (size_t pos = 0; pos < size; ) {
+        size_t end = pos;
+        while (end < size && text[end] != '\n') {
+            ++end;
+        }
+
+        size_t len = end - pos;
+        if (len && text[pos + len - 1] == '\r') {
+            --len;
+        }
+
+        if (len) {
+            if (log->expected_count == MEASURE_MAX_ENTRIES ||
+                !parse_line(text + pos, len, &log->expected[log->expected_count])) {
+                return false;
+            }
+            log->expected_count++;
+        }
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+static void read_digests(struct measure_log* log)
+{
+    const struct fw_cfg_file* file = fw_cfg_find(MEASURE_DIGESTS_FILE);
+    if (!file) {
+        return;
+    }
+
+    log->policy = true;
+    if (file->size > MEASURE_MAX_FILE_SIZE) {
+        LOG_ERROR("measure: %s is too big\n", MEASURE_DIGESTS_FILE);
+        log->policy_broken = true;
+        return;
+    }
+
+    unsigned order = page_order(file->size);
+    char* text = page_alloc(order);
+    assert(text);
+    fw_cfg_read_file(file, 0, text, file->size);
+
+    if (!parse_digests(log, text, file->size)) {
+        LOG_ERROR("measure: %s is malformed\n", MEASURE_DIGESTS_FILE);
+        log->policy_broken = true;
+    }
+
+    page_free(text, order);
+}
+
+void init_measure(void)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256("abc", 3, digest);
+    if (memcmp(digest, self_test_digest, sizeof(digest))) {
+        LOG_ERROR("measure: sha256 %s self-test failed\n", sha256_impl());
+        abort();
+    }
+
+    struct measure_log* log = dataseg_alloc(sizeof(*log));
+    memset(log, 0, sizeof(*log));
+    read_digests(log);
+    measure_log = log;
+
+    LOG_INFO("measure: sha256 %s, %u expected digests%s\n", sha256_impl(), log->expected_count,
+             log->policy ? "" : ", not enforced");
+}
+
+void measure_record(const char* name, uint64_t size, const uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    struct measure_log* log = measure_log;
+    assert(log);
+    assert(log->count < MEASURE_MAX_ENTRIES);
+
+    struct measurement* m = &log->entries[log->count++];
+    m->name = name;
+    m->size = size;
+    memcpy(m->digest, digest, SHA256_DIGEST_SIZE);
+}
+
+static const struct expected_digest* find_expected(const struct measure_log* log, const char* name)
+{
+    for (uint32_t i = 0; i < log->expected_count; ++i) {
+        if (!strncmp(log->expected[i].name, name, MEASURE_MAX_NAME)) {
+            return &log->expected[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool measure_verify(void)
+{
+    const struct measure_log* log = measure_log;
+    assert(log);
+    bool ok = !log->policy_broken;
+
+    for (uint32_t i = 0; i < log->count; ++i) {
+        const struct measurement* m = &log->entries[i];
+        const char* status = "";
+        if (log->policy) {
+            const struct expected_digest* e = find_expected(log, m->name);
+            if (!e) {
+                status = " not listed";
+                ok = false;
+            } else if (memcmp(e->digest, m->digest, SHA256_DIGEST_SIZE)) {
+                status = " MISMATCH";
+                ok = false;
+            } else {
+                status = " ok";
+            }
+        }
+
+        LOG_INFO("measure: %-8s %10llu bytes " DIGEST_FMT "%s\n", m->name, m->size, DIGEST_ARGS(m->digest), status);
+    }
+
+    return ok;
+}
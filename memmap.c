@@ -0,0 +1,208 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "memmap.h"
+#include "fw_cfg.h"
+#include "cmos.h"
+#include "logging.h"
+
+/** VGA window, option ROMs and BIOS, never RAM as far as anyone after us is concerned */
+#define LEGACY_HOLE_BASE 0x000A0000ull
+#define LEGACY_HOLE_SIZE 0x00060000ull
+
+struct memmap {
+    uint32_t count;
+    struct e820_entry entries[MEMMAP_MAX_ENTRIES];
+};
+
+static struct memmap memmap;
+
+static const char* const type_names[] = {
+    [E820_RAM] = "ram",
+    [E820_RESERVED] = "reserved",
+    [E820_ACPI] = "acpi",
+    [E820_NVS] = "nvs",
+    [E820_UNUSABLE] = "unusable",
+};
+
+static const char* type_name(uint32_t type)
+{
+    return type < sizeof(type_names) / sizeof(type_names[0]) && type_names[type] ? type_names[type] : "unknown";
+}
+
+/** Overlapping entries resolve to a non-RAM type, higher type wins among those */
+static uint32_t stronger_type(uint32_t a, uint32_t b)
+{
+    if (a == 0 || a == E820_RAM) {
+        return b;
+    } else if (b == E820_RAM) {
+        return a;
+    }
+
+    return a > b ? a : b;
+}
+
+static void sort_points(uint64_t* points, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; ++i) {
+        uint64_t point = points[i];
+
+        uint32_t j = i;
+        for (; j > 0 && points[j - 1] > point; --j) {
+            points[j] = points[j - 1];
+        }
+        points[j] = point;
+    }
+}
+
+/**
+ * Cut address space at every entry boundary, give each piece the strongest type of entries covering it,
+ * then glue adjacent pieces of the same type back together. Result is sorted and overlap-free.
+ */
+static uint32_t sanitize(struct e820_entry* map, uint32_t count)
+{
+    uint64_t points[2 * MEMMAP_MAX_ENTRIES];
+    uint32_t npoints = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        /* Drop empty entries and entries that wrap around */
+        if (!map[i].size || map[i].addr + map[i].size < map[i].addr) {
+            map[i].size = 0;
+            continue;
+        }
+        points[npoints++] = map[i].addr;
+        points[npoints++] = map[i].addr + map[i].size;
+    }
+    sort_points(points, npoints);
+
+    struct e820_entry out[MEMMAP_MAX_ENTRIES];
+    uint32_t nout = 0;
+    for (uint32_t i = 0; i + 1 < npoints; ++i) {
+        uint64_t start = points[i];
+        uint64_t end = points[i + 1];
+        if (start == end) {
+            continue;
+        }
+
+        uint32_t type = 0;
+        for (uint32_t j = 0; j < count; ++j) {
+            if (start >= map[j].addr && start < map[j].addr + map[j].size) {
+                type = stronger_type(type, map[j].type);
+            }
+        }
+
+        if (!type) {
+            continue;
+        }
+
+        struct e820_entry* last = nout ? &out[nout - 1] : NULL;
+        if (last && last->type == type && last->addr + last->size == start) {
+            last->size += end - start;
+            continue;
+        }
+
+        if (nout == MEMMAP_MAX_ENTRIES) {
+            LOG_ERROR("memmap: too many entries, dropping 0x%llx and above\n", start);
+            break;
+        }
+        out[nout++] = (struct e820_entry){ start, end - start, type };
+    }
+
+    memcpy(map, out, nout * sizeof(*out));
+    return nout;
+}
+
+/** Legacy layout: conventional RAM, RAM from 1M to low RAM top, RAM above 4G */
+static uint32_t read_cmos(struct e820_entry* map)
+{
+    uint32_t count = 0;
+    map[count++] = (struct e820_entry){ 0, LEGACY_HOLE_BASE, E820_RAM };
+    map[count++] = (struct e820_entry){ 0x100000, cmos_low_ram_top() - 0x100000, E820_RAM };
+
+    uint64_t high = cmos_high_ram_size();
+    if (high) {
+        map[count++] = (struct e820_entry){ 1ull << 32, high, E820_RAM };
+    }
+
+    return count;
+}
+
+void init_memmap(void)
+{
+    /* Leave room for the legacy hole entry */
+    uint32_t max = MEMMAP_MAX_ENTRIES - 1;
+    uint32_t size = fw_cfg_read_early("etc/e820", memmap.entries, max * sizeof(struct e820_entry));
+
+    uint32_t count;
+    const char* source;
+    if (size) {
+        count = size / sizeof(struct e820_entry);
+        if (count > max) {
+            LOG_ERROR("memmap: etc/e820 has %u entries, using first %u\n", count, max);
+            count = max;
+        }
+        source = "etc/e820";
+    } else {
+        count = read_cmos(memmap.entries);
+        source = "cmos";
+    }
+
+    /* QEMU reports RAM from 0 to low RAM top in one piece, hole is left for firmware to punch */
+    memmap.entries[count++] = (struct e820_entry){ LEGACY_HOLE_BASE, LEGACY_HOLE_SIZE, E820_RESERVED };
+    memmap.count = sanitize(memmap.entries, count);
+
+    LOG_INFO("memmap: %u entries from %s, %llu MB RAM\n", memmap.count, source, memmap_ram_size() >> 20);
+    for (uint32_t i = 0; i < memmap.count; ++i) {
+        const struct e820_entry* e = &memmap.entries[i];
+        LOG_INFO("  0x%llx - 0x%llx %s\n", e->addr, e->addr + e->size, type_name(e->type));
+    }
+}
+
+uint32_t memmap_count(void)
+{
+    return memmap.count;
+}
+
+const struct e820_entry* memmap_at(uint32_t idx)
+{
+    return idx < memmap.count ? &memmap.entries[idx] : NULL;
+}
+
+uint64_t memmap_ram_size(void)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < memmap.count; ++i) {
+        if (memmap.entries[i].type == E820_RAM) {
+            total += memmap.entries[i].size;
+        }
+    }
+
+    return total;
+}
+
+bool memmap_mark(uint64_t addr, uint64_t size, uint32_t type)
+{
+    /* Range in the middle of an entry splits it in three */
+    if (memmap.count + 2 > MEMMAP_MAX_ENTRIES) {
+        LOG_ERROR("memmap: no room to mark 0x%llx - 0x%llx %s\n", addr, addr + size, type_name(type));
+        return false;
+    }
+
+    memmap.entries[memmap.count++] = (struct e820_entry){ addr, size, type };
+    memmap.count = sanitize(memmap.entries, memmap.count);
+
+    LOG_DEBUG("memmap: marked 0x%llx - 0x%llx %s\n", addr, addr + size, type_name(type));
+    return true;
+}
+
+size_t memmap_scale(unsigned shift, size_t min, size_t max)
+{
+    uint64_t size = memmap_ram_size() >> shift;
+    if (size <= min) {
+        return min;
+    } else if (size >= max) {
+        return max;
+    }
+
+    return 1ull << (63 - __builtin_clzll(size));
+}
@@ -0,0 +1,287 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "page_alloc.h"
+#include "hbitmap.h"
+#include "alloc_stats.h"
+#include "logging.h"
+
+/**
+ * Managed RAM range.
+ * Zone header and bitmaps sit at the beginning of the range, before the first managed page.
+ */
+struct page_zone {
+    struct page_zone* next;
+
+    /* Block indexes are counted from origin, which is aligned to the largest block size */
+    uintptr_t origin;
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t max_order;
+
+    /* Set bit means block of that order is free */
+    struct hbitmap free[PAGE_ORDER_MAX + 1];
+    uint64_t bitmap_storage[];
+};
+
+/** Zone list head */
+static struct page_zone* page_zones;
+
+static struct {
+    struct alloc_class_stats classes[PAGE_ORDER_MAX + 1];
+    struct alloc_usage usage;
+} page_stats;
+
+static inline uint32_t zone_nbits(uintptr_t origin, uintptr_t end, unsigned order)
+{
+    return (end - origin) >> (PAGE_SHIFT + order);
+}
+
+static inline uintptr_t block_addr(const struct page_zone* zone, uint32_t idx, unsigned order)
+{
+    return zone->origin + ((uintptr_t)idx << (PAGE_SHIFT + order));
+}
+
+static inline uint32_t block_idx(const struct page_zone* zone, uintptr_t addr, unsigned order)
+{
+    return (addr - zone->origin) >> (PAGE_SHIFT + order);
+}
+
+static void zone_add_free(struct page_zone* zone, uintptr_t start, uintptr_t end)
+{
+    /* Cover range with largest naturally aligned blocks */
+    while (start < end) {
+        unsigned order = zone->max_order;
+        while ((start & ((PAGE_SIZE << order) - 1)) || start + (PAGE_SIZE << order) > end) {
+            --order;
+        }
+
+        hbitmap_set(&zone->free[order], block_idx(zone, start, order));
+        start += PAGE_SIZE << order;
+    }
+}
+
+static struct page_zone* find_zone(uintptr_t addr)
+{
+    struct page_zone* zone = page_zones;
+    while (zone && (addr < zone->start || addr >= zone->end)) {
+        zone = zone->next;
+    }
+
+    return zone;
+}
+
+void init_pages(void)
+{
+    page_zones = NULL;
+    memset(&page_stats, 0, sizeof(page_stats));
+}
+
+void pages_add_range(uintptr_t base, size_t size)
+{
+    uintptr_t end = (base + size) & ~(PAGE_SIZE - 1);
+    base = (base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    /* Clamp range so that order 0 bitmap can track it */
+    uintptr_t origin = base & ~((PAGE_SIZE << PAGE_ORDER_MAX) - 1);
+    if (end - origin > ((uintptr_t)1 << (PAGE_SHIFT + 6 * HBITMAP_MAX_LEVELS))) {
+        end = origin + ((uintptr_t)1 << (PAGE_SHIFT + 6 * HBITMAP_MAX_LEVELS));
+    }
+
+    if (end <= base) {
+        return;
+    }
+
+    unsigned max_order = PAGE_ORDER_MAX;
+    while (zone_nbits(origin, end, max_order) == 0) {
+        --max_order;
+    }
+
+    size_t words = 0;
+    for (unsigned i = 0; i <= max_order; ++i) {
+        words += hbitmap_storage_words(zone_nbits(origin, end, i));
+    }
+
+    uintptr_t start = base + sizeof(struct page_zone) + words * sizeof(uint64_t);
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (start >= end) {
+        return;
+    }
+
+    struct page_zone* zone = (struct page_zone*)base;
+    zone->origin = origin;
+    zone->start = start;
+    zone->end = end;
+    zone->max_order = max_order;
+
+    uint64_t* storage = zone->bitmap_storage;
+    for (unsigned i = 0; i <= max_order; ++i) {
+        uint32_t nbits = zone_nbits(origin, end, i);
+        hbitmap_init(&zone->free[i], storage, nbits);
+        storage += hbitmap_storage_words(nbits);
+    }
+
+    zone_add_free(zone, start, end);
+
+    zone->next = page_zones;
+    page_zones = zone;
+
+    LOG_INFO("pages: zone 0x%llx - 0x%llx, %llu pages, metadata %llu bytes\n",
+        start, end, (end - start) >> PAGE_SHIFT, start - base);
+}
+
+static void* zone_alloc(struct page_zone* zone, unsigned order)
+{
+    for (unsigned k = order; k <= zone->max_order; ++k) {
+        if (hbitmap_empty(&zone->free[k])) {
+            continue;
+        }
+
+        uint32_t idx = hbitmap_find_next(&zone->free[k], 0);
+        hbitmap_clear(&zone->free[k], idx);
+
+        /* Split down to requested order, upper halves become free */
+        while (k > order) {
+            --k;
+            idx <<= 1;
+            hbitmap_set(&zone->free[k], idx + 1);
+        }
+
+        return (void*)block_addr(zone, idx, order);
+    }
+
+    return NULL;
+}
+
+void* page_alloc(unsigned order)
+{
+    if (order > PAGE_ORDER_MAX) {
+        return NULL;
+    }
+
+    void* ptr = NULL;
+    for (struct page_zone* zone = page_zones; zone != NULL && !ptr; zone = zone->next) {
+        ptr = zone_alloc(zone, order);
+    }
+
+    if (ptr) {
+        alloc_stats_alloc(&page_stats.classes[order], &page_stats.usage, PAGE_SIZE << order, 0);
+    } else {
+        page_stats.classes[order].failed++;
+    }
+    alloc_trace(ALLOC_TRACE_PAGE_ALLOC, order, PAGE_SIZE << order, !ptr, __builtin_return_address(0));
+
+    return ptr;
+}
+
+void page_free(void* ptr, unsigned order)
+{
+    if (!ptr) {
+        return;
+    }
+
+    uintptr_t addr = (uintptr_t)ptr;
+    assert((addr & ((PAGE_SIZE << order) - 1)) == 0);
+
+    struct page_zone* zone = find_zone(addr);
+    assert(zone);
+    assert(order <= zone->max_order);
+
+    alloc_stats_free(&page_stats.classes[order], &page_stats.usage, PAGE_SIZE << order, 0);
+    alloc_trace(ALLOC_TRACE_PAGE_FREE, order, PAGE_SIZE << order, false, __builtin_return_address(0));
+
+    /* Merge with free buddies as long as we can */
+    uint32_t idx = block_idx(zone, addr, order);
+    while (order < zone->max_order) {
+        uint32_t buddy = idx ^ 1;
+        if (buddy >= zone->free[order].nbits || !hbitmap_test(&zone->free[order], buddy)) {
+            break;
+        }
+
+        hbitmap_clear(&zone->free[order], buddy);
+        idx >>= 1;
+        ++order;
+    }
+
+    hbitmap_set(&zone->free[order], idx);
+}
+
+void pages_for_each_free(void (*fn)(uintptr_t base, size_t size, void* arg), void* arg)
+{
+    for (struct page_zone* zone = page_zones; zone != NULL; zone = zone->next) {
+        for (unsigned order = 0; order <= zone->max_order; ++order) {
+            const struct hbitmap* free = &zone->free[order];
+
+            /* find_next wraps around, so stop once it goes backwards */
+            uint32_t start = 0;
+            while (start < free->nbits) {
+                uint32_t idx = hbitmap_find_next(free, start);
+                if (idx == HBITMAP_NONE || idx < start) {
+                    break;
+                }
+
+                fn(block_addr(zone, idx, order), PAGE_SIZE << order, arg);
+                start = idx + 1;
+            }
+        }
+    }
+}
+
+/** Find free block of any order which contains page at addr */
+static bool zone_find_free(const struct page_zone* zone, uintptr_t addr, unsigned* order, uint32_t* idx)
+{
+    for (unsigned k = 0; k <= zone->max_order; ++k) {
+        uint32_t i = block_idx(zone, addr, k);
+        if (i < zone->free[k].nbits && hbitmap_test(&zone->free[k], i)) {
+            *order = k;
+            *idx = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool page_reserve(uintptr_t base, size_t size)
+{
+    uintptr_t end = (base + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    base &= ~(PAGE_SIZE - 1);
+
+    /* Check that every page is free first, so that a failure doesn't leave range half-reserved */
+    for (uintptr_t addr = base; addr < end; ) {
+        struct page_zone* zone = find_zone(addr);
+        unsigned order;
+        uint32_t idx;
+        if (!zone || !zone_find_free(zone, addr, &order, &idx)) {
+            return false;
+        }
+
+        addr = block_addr(zone, idx, order) + (PAGE_SIZE << order);
+    }
+
+    /* Remove each covering block and give back the parts outside of the range */
+    for (uintptr_t addr = base; addr < end; ) {
+        struct page_zone* zone = find_zone(addr);
+        unsigned order;
+        uint32_t idx;
+        zone_find_free(zone, addr, &order, &idx);
+        hbitmap_clear(&zone->free[order], idx);
+
+        uintptr_t block_start = block_addr(zone, idx, order);
+        uintptr_t block_end = block_start + (PAGE_SIZE << order);
+        zone_add_free(zone, block_start, base > block_start ? base : block_start);
+        zone_add_free(zone, end < block_end ? end : block_end, block_end);
+
+        addr = block_end;
+    }
+
+    return true;
+}
+
+void pages_report(void)
+{
+    /* Callers pass an order rather than a size, so waste is theirs to know */
+    alloc_stats_log("pages", page_stats.classes, PAGE_ORDER_MAX + 1, 0, PAGE_SHIFT, &page_stats.usage);
+}
@@ -0,0 +1,191 @@
+#include <inttypes.h>
+#include <assert.h>
+
+#include "pci.h"
+#include "io.h"
+#include "logging.h"
+
+static struct pci_config pci_config;
+
+#define PCI_VENDOR_ID 0x00
+
+/** q35 MCH */
+#define Q35_MCH_ID              0x29C08086
+#define Q35_PCIEXBAR            0x60
+#define Q35_PCIEXBAR_EN         (1ull << 0)
+#define Q35_PCIEXBAR_LENGTH(x)  (((x) >> 1) & 0x3)
+#define Q35_PCIEXBAR_ADDR_MASK  0x0000000FF0000000ull   /* bits 35:28 for 256 buses */
+
+_Static_assert((PCI_ECAM_BASE & ~Q35_PCIEXBAR_ADDR_MASK) == 0, "ECAM base should be 256M-aligned and below 64G");
+
+/*
+ * CF8/CFC access
+ */
+
+static inline uint32_t cf8_address(uint32_t bdf, uint16_t reg)
+{
+    return 0x80000000 | (bdf << 8) | (reg & 0xFC);
+}
+
+static inline uint8_t cf8_read8(uint32_t bdf, uint16_t reg)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    return in8(PCI_CONFDATA + (reg & 3));
+}
+
+static inline uint16_t cf8_read16(uint32_t bdf, uint16_t reg)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    return in16(PCI_CONFDATA + (reg & 2));
+}
+
+static inline uint32_t cf8_read32(uint32_t bdf, uint16_t reg)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    return in32(PCI_CONFDATA);
+}
+
+static inline void cf8_write8(uint32_t bdf, uint16_t reg, uint8_t val)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    out8(PCI_CONFDATA + (reg & 3), val);
+}
+
+static inline void cf8_write16(uint32_t bdf, uint16_t reg, uint16_t val)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    out16(PCI_CONFDATA + (reg & 2), val);
+}
+
+static inline void cf8_write32(uint32_t bdf, uint16_t reg, uint32_t val)
+{
+    out32(PCI_CONFADDR, cf8_address(bdf, reg));
+    out32(PCI_CONFDATA, val);
+}
+
+/*
+ * ECAM access
+ */
+
+/** Returns NULL if register can only be reached through CF8/CFC, or not at all */
+static inline volatile void* ecam_ptr(uint32_t bdf, uint16_t reg)
+{
+    const struct pci_config* cfg = &pci_config;
+    if (!cfg->ecam_base || (bdf >> 8) >= cfg->ecam_buses) {
+        return NULL;
+    }
+
+    return (volatile void*)(uintptr_t)(cfg->ecam_base + ((uint64_t)bdf << 12) + reg);
+}
+
+static inline int cf8_reachable(uint16_t reg)
+{
+    return reg < PCI_CONFIG_LEGACY_SIZE;
+}
+
+uint8_t pci_read8(uint32_t bdf, uint16_t reg)
+{
+    volatile uint8_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        return *ptr;
+    }
+    return cf8_reachable(reg) ? cf8_read8(bdf, reg) : 0xFF;
+}
+
+uint16_t pci_read16(uint32_t bdf, uint16_t reg)
+{
+    assert((reg & 1) == 0);
+
+    volatile uint16_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        return *ptr;
+    }
+    return cf8_reachable(reg) ? cf8_read16(bdf, reg) : 0xFFFF;
+}
+
+uint32_t pci_read32(uint32_t bdf, uint16_t reg)
+{
+    assert((reg & 3) == 0);
+
+    volatile uint32_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        return *ptr;
+    }
+    return cf8_reachable(reg) ? cf8_read32(bdf, reg) : 0xFFFFFFFF;
+}
+
+void pci_write8(uint32_t bdf, uint16_t reg, uint8_t val)
+{
+    volatile uint8_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        *ptr = val;
+    } else if (cf8_reachable(reg)) {
+        cf8_write8(bdf, reg, val);
+    }
+}
+
+void pci_write16(uint32_t bdf, uint16_t reg, uint16_t val)
+{
+    assert((reg & 1) == 0);
+
+    volatile uint16_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        *ptr = val;
+    } else if (cf8_reachable(reg)) {
+        cf8_write16(bdf, reg, val);
+    }
+}
+
+void pci_write32(uint32_t bdf, uint16_t reg, uint32_t val)
+{
+    assert((reg & 3) == 0);
+
+    volatile uint32_t* ptr = ecam_ptr(bdf, reg);
+    if (ptr) {
+        *ptr = val;
+    } else if (cf8_reachable(reg)) {
+        cf8_write32(bdf, reg, val);
+    }
+}
+
+enum pci_host pci_host(void)
+{
+    return pci_config.host;
+}
+
+/** Read PCIEXBAR, enabling it at PCI_ECAM_BASE first if needed */
+static void init_q35_ecam(struct pci_config* cfg)
+{
+    uint32_t mch = pci_make_bdf(0, 0, 0);
+    uint64_t bar = ((uint64_t)cf8_read32(mch, Q35_PCIEXBAR + 4) << 32) | cf8_read32(mch, Q35_PCIEXBAR);
+
+    if (!(bar & Q35_PCIEXBAR_EN)) {
+        /* 256 buses. High dword goes first, so that window doesn't get enabled at a wrong address */
+        bar = PCI_ECAM_BASE | Q35_PCIEXBAR_EN;
+        cf8_write32(mch, Q35_PCIEXBAR + 4, (uint32_t)(bar >> 32));
+        cf8_write32(mch, Q35_PCIEXBAR, (uint32_t)bar);
+    }
+
+    /* Length field: 0 - 256 buses, 1 - 128 buses, 2 - 64 buses */
+    uint32_t length = Q35_PCIEXBAR_LENGTH(bar);
+    assert(length < 3);
+
+    cfg->ecam_buses = 256 >> length;
+    cfg->ecam_base = bar & (Q35_PCIEXBAR_ADDR_MASK | (((1ull << length) - 1) << (28 - length)));
+}
+
+void init_pci(void)
+{
+    struct pci_config* cfg = &pci_config;
+    cfg->ecam_base = 0;
+    cfg->ecam_buses = 0;
+    cfg->host = PCI_HOST_I440FX;
+
+    if (cf8_read32(pci_make_bdf(0, 0, 0), PCI_VENDOR_ID) == Q35_MCH_ID) {
+        cfg->host = PCI_HOST_Q35;
+        init_q35_ecam(cfg);
+    }
+
+    LOG_DEBUG("pci: host %s, ecam at 0x%llx, %u buses\n",
+              cfg->host == PCI_HOST_Q35 ? "q35" : "i440fx", cfg->ecam_base, cfg->ecam_buses);
+}
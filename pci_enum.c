@@ -0,0 +1,353 @@
+#include <inttypes.h>
+#include <assert.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "pci_enum.h"
+#include "pci.h"
+#include "page_alloc.h"
+#include "heap.h"
+#include "cmos.h"
+#include "logging.h"
+
+/** Config registers */
+#define PCI_REG_ID          0x00
+#define PCI_REG_COMMAND     0x04
+#define PCI_REG_CLASS_REV   0x08
+#define PCI_REG_HEADER      0x0C    /* cache line size, latency timer, header type, BIST */
+#define PCI_REG_BAR0        0x10
+
+#define PCI_COMMAND_IO      (1u << 0)
+#define PCI_COMMAND_MEM     (1u << 1)
+
+#define PCI_HEADER_TYPE(x)          (((x) >> 16) & 0x7F)
+#define PCI_HEADER_MULTIFUNCTION(x) ((x) & (1u << 23))
+
+#define PCI_HEADER_TYPE_NORMAL  0
+#define PCI_HEADER_TYPE_BRIDGE  1
+
+/** BAR register low bits */
+#define PCI_BAR_REG_IO          0x1
+#define PCI_BAR_REG_MEM64       0x4
+#define PCI_BAR_REG_PREFETCH    0x8
+
+#define PCI_DEVICES_PER_BUS     32
+#define PCI_FUNCTIONS_PER_DEV   8
+
+/** Resource windows BARs are assigned from */
+#define PCI_IO_BASE             0xC000ull
+#define PCI_IO_END              0x10000ull
+#define PCI_MMIO_BASE_I440FX    0xE0000000ull
+#define PCI_MMIO_BASE_Q35       (PCI_ECAM_BASE + (256ull << 20))
+#define PCI_MMIO_END            0xFEC00000ull
+
+/**
+ * Device table, allocated from page allocator.
+ * Sized for a fully populated bus so that enumeration never has to grow it.
+ */
+struct pci_table {
+    size_t count;
+    struct pci_device devices[PCI_DEVICES_PER_BUS * PCI_FUNCTIONS_PER_DEV];
+};
+
+static struct pci_table* pci_table;
+
+/** Reference to a BAR, used to order all BARs by size for assignment */
+struct bar_ref {
+    struct pci_device* dev;
+    unsigned index;
+};
+
+static inline uint64_t bsf64(uint64_t val)
+{
+    uint64_t res;
+    __asm__ volatile ("bsf %1, %0" :"=r"(res) :"rm"(val) :);
+    return res;
+}
+
+/**
+ * Size BAR at index, returns number of BAR slots it takes.
+ * Previous BAR value is not restored: decoding is off and every BAR gets a new address anyway.
+ */
+static unsigned size_bar(struct pci_device* dev, unsigned index)
+{
+    struct pci_bar* bar = &dev->bars[index];
+    uint16_t reg = PCI_REG_BAR0 + index * 4;
+
+    pci_write32(dev->bdf, reg, 0xFFFFFFFF);
+    uint32_t val = pci_read32(dev->bdf, reg);
+    if (val == 0) {
+        return 1;
+    }
+
+    if (val & PCI_BAR_REG_IO) {
+        bar->flags = PCI_BAR_IO;
+        bar->size_order = bsf64((val & ~0x3ull) | 0xFFFF0000ull);
+        return 1;
+    }
+
+    uint64_t mask = (val & ~0xFull) | 0xFFFFFFFF00000000ull;
+    unsigned slots = 1;
+
+    if ((val & PCI_BAR_REG_MEM64) && index + 1 < dev->nbars) {
+        pci_write32(dev->bdf, reg + 4, 0xFFFFFFFF);
+        mask = (mask & 0xFFFFFFFFull) | ((uint64_t)pci_read32(dev->bdf, reg + 4) << 32);
+        bar->flags |= PCI_BAR_MEM64;
+        slots = 2;
+    }
+
+    if (val & PCI_BAR_REG_PREFETCH) {
+        bar->flags |= PCI_BAR_PREFETCH;
+    }
+
+    if (mask) {
+        bar->size_order = bsf64(mask);
+    }
+
+    return slots;
+}
+
+/** Record function and size its BARs, decoding stays off only if it has some */
+static void probe_function(struct pci_device* dev, uint32_t bdf, uint32_t id, uint32_t header)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->bdf = bdf;
+    dev->vendor = id & 0xFFFF;
+    dev->device = id >> 16;
+    dev->class_rev = pci_read32(bdf, PCI_REG_CLASS_REV);
+    dev->header_type = PCI_HEADER_TYPE(header);
+
+    switch (dev->header_type) {
+    case PCI_HEADER_TYPE_NORMAL:
+        dev->nbars = 6;
+        break;
+    case PCI_HEADER_TYPE_BRIDGE:
+        dev->nbars = 2;
+        break;
+    default:
+        dev->nbars = 0;
+        break;
+    }
+
+    dev->command = pci_read16(bdf, PCI_REG_COMMAND);
+    if (!dev->nbars) {
+        return;
+    }
+
+    /* Sizing writes all-ones to BARs, which must not decode meanwhile */
+    bool decoding = dev->command & (PCI_COMMAND_IO | PCI_COMMAND_MEM);
+    if (decoding) {
+        pci_write16(bdf, PCI_REG_COMMAND, dev->command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEM));
+    }
+
+    bool sized = false;
+    for (unsigned i = 0; i < dev->nbars; ) {
+        unsigned slots = size_bar(dev, i);
+        sized |= dev->bars[i].size_order != 0;
+        i += slots;
+    }
+
+    /* Functions without implemented BARs, like host and ISA bridges, keep whatever decoding they had */
+    if (decoding && !sized) {
+        pci_write16(bdf, PCI_REG_COMMAND, dev->command);
+    }
+}
+
+/** Sort BAR references by size, largest first, so that sequential placement keeps them naturally aligned */
+static void sort_bars(struct bar_ref* refs, size_t count)
+{
+    for (size_t i = 1; i < count; ++i) {
+        struct bar_ref ref = refs[i];
+        uint8_t order = ref.dev->bars[ref.index].size_order;
+
+        size_t j = i;
+        for (; j > 0 && refs[j - 1].dev->bars[refs[j - 1].index].size_order < order; --j) {
+            refs[j] = refs[j - 1];
+        }
+        refs[j] = ref;
+    }
+}
+
+/** Place BARs from their windows and write them out */
+static void assign_bars(struct pci_table* table)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < table->count; ++i) {
+        for (unsigned b = 0; b < PCI_MAX_BARS; ++b) {
+            count += table->devices[i].bars[b].size_order != 0;
+        }
+    }
+
+    if (!count) {
+        return;
+    }
+
+    struct bar_ref* refs = heap_alloc(sizeof(*refs) * count);
+    assert(refs);
+
+    size_t n = 0;
+    for (size_t i = 0; i < table->count; ++i) {
+        for (unsigned b = 0; b < PCI_MAX_BARS; ++b) {
+            if (table->devices[i].bars[b].size_order) {
+                refs[n++] = (struct bar_ref){ &table->devices[i], b };
+            }
+        }
+    }
+
+    sort_bars(refs, count);
+
+    uint64_t io = PCI_IO_BASE;
+    uint64_t mmio = pci_host() == PCI_HOST_Q35 ? PCI_MMIO_BASE_Q35 : PCI_MMIO_BASE_I440FX;
+    assert(mmio >= cmos_low_ram_top());
+
+    for (size_t i = 0; i < count; ++i) {
+        struct pci_device* dev = refs[i].dev;
+        struct pci_bar* bar = &dev->bars[refs[i].index];
+        uint64_t size = pci_bar_size(bar);
+        bool is_io = bar->flags & PCI_BAR_IO;
+        uint64_t* cursor = is_io ? &io : &mmio;
+        uint64_t end = is_io ? PCI_IO_END : PCI_MMIO_END;
+
+        uint64_t base = (*cursor + size - 1) & ~(size - 1);
+        if (base + size > end) {
+            LOG_ERROR("pci: no space for %s BAR %u of %x, size 0x%llx\n",
+                      is_io ? "io" : "mem", refs[i].index, dev->bdf, size);
+            continue;
+        }
+
+        *cursor = base + size;
+        bar->base = base;
+
+        uint16_t reg = PCI_REG_BAR0 + refs[i].index * 4;
+        pci_write32(dev->bdf, reg, (uint32_t)base);
+        if (bar->flags & PCI_BAR_MEM64) {
+            pci_write32(dev->bdf, reg + 4, (uint32_t)(base >> 32));
+        }
+    }
+
+    heap_free(refs);
+}
+
+/**
+ * Turn on decoding for address spaces where every BAR got an address, and off where some BAR did not.
+ * Spaces without BARs keep decoding the function had before enumeration, e.g. legacy VGA or IDE ports.
+ */
+static void enable_decoding(struct pci_device* dev)
+{
+    bool has_io = false, has_mem = false;
+    bool io_ok = true, mem_ok = true;
+
+    for (unsigned b = 0; b < PCI_MAX_BARS; ++b) {
+        const struct pci_bar* bar = &dev->bars[b];
+        if (!bar->size_order) {
+            continue;
+        }
+
+        if (bar->flags & PCI_BAR_IO) {
+            has_io = true;
+            io_ok &= bar->base != 0;
+        } else {
+            has_mem = true;
+            mem_ok &= bar->base != 0;
+        }
+    }
+
+    if (!has_io && !has_mem) {
+        return;
+    }
+
+    if (has_io) {
+        dev->command = io_ok ? dev->command | PCI_COMMAND_IO : dev->command & ~PCI_COMMAND_IO;
+    }
+    if (has_mem) {
+        dev->command = mem_ok ? dev->command | PCI_COMMAND_MEM : dev->command & ~PCI_COMMAND_MEM;
+    }
+    pci_write16(dev->bdf, PCI_REG_COMMAND, dev->command);
+}
+
+void pci_enumerate(void)
+{
+    struct pci_table* table = page_alloc(page_order(sizeof(*table)));
+    assert(table);
+    table->count = 0;
+    pci_table = table;
+
+    for (uint8_t dev = 0; dev < PCI_DEVICES_PER_BUS; ++dev) {
+        for (uint8_t func = 0; func < PCI_FUNCTIONS_PER_DEV; ++func) {
+            uint32_t bdf = pci_make_bdf(0, dev, func);
+
+            /* Absent function costs a single read */
+            uint32_t id = pci_read32(bdf, PCI_REG_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                if (func == 0) {
+                    break;
+                }
+                continue;
+            }
+
+            uint32_t header = pci_read32(bdf, PCI_REG_HEADER);
+            probe_function(&table->devices[table->count++], bdf, id, header);
+
+            if (func == 0 && !PCI_HEADER_MULTIFUNCTION(header)) {
+                break;
+            }
+        }
+    }
+
+    assign_bars(table);
+
+    for (size_t i = 0; i < table->count; ++i) {
+        struct pci_device* dev = &table->devices[i];
+        enable_decoding(dev);
+
+        LOG_DEBUG("pci: %x %hx:%hx class %x\n", dev->bdf, dev->vendor, dev->device, dev->class_rev);
+        for (unsigned b = 0; b < PCI_MAX_BARS; ++b) {
+            if (dev->bars[b].size_order) {
+                LOG_DEBUG("  BAR%u: 0x%llx, size 0x%llx, flags %hhx\n",
+                          b, dev->bars[b].base, pci_bar_size(&dev->bars[b]), dev->bars[b].flags);
+            }
+        }
+    }
+
+    LOG_INFO("pci: %u functions on bus 0\n", table->count);
+}
+
+size_t pci_device_count(void)
+{
+    return pci_table->count;
+}
+
+const struct pci_device* pci_device_at(size_t i)
+{
+    assert(i < pci_table->count);
+    return &pci_table->devices[i];
+}
+
+static const struct pci_device* next_device(const struct pci_device* prev)
+{
+    const struct pci_table* table = pci_table;
+    const struct pci_device* dev = prev ? prev + 1 : table->devices;
+    return dev < table->devices + table->count ? dev : NULL;
+}
+
+const struct pci_device* pci_find_device(uint16_t vendor, uint16_t device, const struct pci_device* prev)
+{
+    for (const struct pci_device* dev = next_device(prev); dev; dev = next_device(dev)) {
+        if ((vendor == 0xFFFF || dev->vendor == vendor) && (device == 0xFFFF || dev->device == device)) {
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+const struct pci_device* pci_find_class(uint8_t class, uint8_t subclass, const struct pci_device* prev)
+{
+    for (const struct pci_device* dev = next_device(prev); dev; dev = next_device(dev)) {
+        if (pci_device_class(dev) == class && pci_device_subclass(dev) == subclass) {
+            return dev;
+        }
+    }
+
+    return NULL;
+}
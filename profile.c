@@ -0,0 +1,118 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "profile.h"
+#include "isr.h"
+#include "apic.h"
+#include "io.h"
+#include "logging.h"
+
+/** Legacy PIC mask registers */
+#define PIC1_DATA ((uint16_t)0x21)
+#define PIC2_DATA ((uint16_t)0xA1)
+
+/** Histogram takes 64K of .bss when profiler is built in */
+#define PROFILE_MAX_BUCKETS (PROFILE ? 16384 : 1)
+
+/** Image bounds, see image.lds */
+extern const char _image_start[];
+extern const char _image_end[];
+
+struct profile {
+    uintptr_t base;
+    uint32_t shift;
+    uint32_t nbuckets;
+    uint64_t samples;
+    uint64_t outside;
+    volatile uint32_t* eoi;
+    uint32_t counts[PROFILE_MAX_BUCKETS];
+};
+
+static struct profile profile_state;
+
+/**
+ * Timer tick, called from entry16.asm with interrupts off.
+ * Vector registers of interrupted code are not saved, so this should not touch them.
+ */
+__attribute__((target("general-regs-only")))
+void profile_tick(struct interrupt_frame* frame)
+{
+    struct profile* profile = &profile_state;
+
+    /* RIP below image base wraps around and counts as outside too */
+    uint64_t bucket = (frame->rip - profile->base) >> profile->shift;
+    if (bucket < profile->nbuckets) {
+        profile->counts[bucket]++;
+    } else {
+        profile->outside++;
+    }
+    profile->samples++;
+
+    *profile->eoi = 0;
+}
+
+void profile_start(void)
+{
+    if (!PROFILE) {
+        return;
+    }
+
+    struct profile* profile = &profile_state;
+    uintptr_t size = (uintptr_t)_image_end - (uintptr_t)_image_start;
+
+    unsigned shift = 0;
+    while (((size + (1ul << shift) - 1) >> shift) > PROFILE_MAX_BUCKETS) {
+        ++shift;
+    }
+
+    profile->base = (uintptr_t)_image_start;
+    profile->shift = shift;
+    profile->nbuckets = (size + (1ul << shift) - 1) >> shift;
+    profile->samples = 0;
+    profile->outside = 0;
+    memset(profile->counts, 0, profile->nbuckets * sizeof(profile->counts[0]));
+
+    /* QEMU resets BSP LINT0 to ExtINT, so PIT ticks would arrive as exceptions once interrupts are on */
+    out8(PIC1_DATA, 0xFF);
+    out8(PIC2_DATA, 0xFF);
+
+    init_apic();
+    profile->eoi = (volatile uint32_t*)(apic_mmio_base() + APIC_REG_EOI);
+
+    apic_write(APIC_REG_TIMER_DIV, APIC_TIMER_DIV_1);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_TIMER_PERIODIC | PROFILE_VECTOR);
+    apic_write(APIC_REG_TIMER_INIT, PROFILE_PERIOD);
+    __asm__ volatile ("sti" ::: "memory");
+
+    LOG_INFO("profile: period %u ticks, %u buckets of %u bytes\n", PROFILE_PERIOD, profile->nbuckets, 1u << shift);
+}
+
+void profile_stop(void)
+{
+    if (!PROFILE) {
+        return;
+    }
+
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+    apic_write(APIC_REG_TIMER_INIT, 0);
+
+    /* Let a tick that is already pending come in now rather than after whoever enables interrupts next */
+    __asm__ volatile ("sti; nop; cli" ::: "memory");
+}
+
+void profile_report(void)
+{
+    if (!PROFILE) {
+        return;
+    }
+
+    profile_stop();
+
+    const struct profile* profile = &profile_state;
+    LOG_INFO("profile: %llu samples, %llu outside image\n", profile->samples, profile->outside);
+    for (uint32_t i = 0; i < profile->nbuckets; ++i) {
+        if (profile->counts[i]) {
+            LOG_INFO("profile: 0x%llx %u\n", (uint64_t)profile->base + ((uint64_t)i << profile->shift), profile->counts[i]);
+        }
+    }
+}
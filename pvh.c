@@ -0,0 +1,528 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "pvh.h"
+#include "fw_cfg.h"
+#include "page_alloc.h"
+#include "apic.h"
+#include "smp.h"
+#include "memmap.h"
+#include "timeline.h"
+#include "profile.h"
+#include "clock.h"
+#include "virtio_blk.h"
+#include "lz4.h"
+#include "sha256.h"
+#include "measure.h"
+#include "acpi.h"
+#include "alloc_stats.h"
+#include "scrub.h"
+#include "logring.h"
+#include "logging.h"
+
+/** ELF bits we need, 32 and 64-bit program headers are normalized into struct segment */
+#define ELF_MAGIC       0x464C457F
+#define ELF_CLASS32     1
+#define ELF_CLASS64     2
+#define ELF_PT_LOAD     1
+#define ELF_PT_NOTE     4
+
+#define XEN_ELFNOTE_PHYS32_ENTRY 18
+
+#define PVH_MAX_SEGMENTS 16
+
+/**
+ * Bounce buffer size for data that is not read straight to its place:
+ * LZ4 compressed disk payload, decoded chunk by chunk, and kernel file parts outside of PT_LOAD segments
+ */
+#define PVH_CHUNK (1ul << 20)
+
+struct elf_ident {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t pad[9];
+};
+
+struct elf32_ehdr {
+    struct elf_ident ident;
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct elf64_ehdr {
+    struct elf_ident ident;
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct elf32_phdr {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+};
+
+struct elf64_phdr {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+
+struct elf_note {
+    uint32_t namesz;
+    uint32_t descsz;
+    uint32_t type;
+};
+
+struct segment {
+    uint32_t type;
+    uint64_t offset;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+};
+
+/** Leave long mode and jump to entry with ebx pointing to start info, see entry16.asm */
+extern void __attribute__((noreturn)) pvh_enter(uint32_t entry, uint32_t start_info);
+
+static uint32_t read_u32_item(uint16_t select)
+{
+    uint32_t val = 0;
+    fw_cfg_read(select, &val, sizeof(val));
+    return val;
+}
+
+/** Read program headers from ELF headers page, returns number of segments or 0 if ELF is not usable */
+static size_t read_segments(const uint8_t* hdr, size_t hdr_size, struct segment* segs)
+{
+    const struct elf_ident* ident = (const struct elf_ident*)hdr;
+    if (hdr_size < sizeof(struct elf64_ehdr) || ident->magic != ELF_MAGIC) {
+        return 0;
+    }
+
+    uint64_t phoff;
+    size_t phnum, phentsize;
+    if (ident->class == ELF_CLASS64) {
+        const struct elf64_ehdr* eh = (const struct elf64_ehdr*)hdr;
+        phoff = eh->phoff;
+        phnum = eh->phnum;
+        phentsize = eh->phentsize;
+    } else if (ident->class == ELF_CLASS32) {
+        const struct elf32_ehdr* eh = (const struct elf32_ehdr*)hdr;
+        phoff = eh->phoff;
+        phnum = eh->phnum;
+        phentsize = eh->phentsize;
+    } else {
+        return 0;
+    }
+
+    if (phnum > PVH_MAX_SEGMENTS || phoff + phnum * phentsize > hdr_size) {
+        LOG_ERROR("pvh: program headers are out of reach\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < phnum; ++i) {
+        const uint8_t* ph = hdr + phoff + i * phentsize;
+        if (ident->class == ELF_CLASS64) {
+            const struct elf64_phdr* p = (const struct elf64_phdr*)ph;
+            segs[i] = (struct segment){ p->type, p->offset, p->paddr, p->filesz, p->memsz };
+        } else {
+            const struct elf32_phdr* p = (const struct elf32_phdr*)ph;
+            segs[i] = (struct segment){ p->type, p->offset, p->paddr, p->filesz, p->memsz };
+        }
+    }
+
+    return phnum;
+}
+
+/** Find PVH entry in note segments, returns 0 if there is none */
+static uint32_t find_pvh_entry(const struct segment* segs, size_t count)
+{
+    uint32_t entry = 0;
+
+    for (size_t i = 0; i < count && !entry; ++i) {
+        if (segs[i].type != ELF_PT_NOTE || !segs[i].filesz) {
+            continue;
+        }
+
+        unsigned order = page_order(segs[i].filesz);
+        uint8_t* notes = page_alloc(order);
+        assert(notes);
+
+        struct fw_cfg_sg sg = { notes, segs[i].filesz };
+        fw_cfg_read_sg(FW_CFG_KERNEL_DATA, segs[i].offset, &sg, 1);
+
+        /* Sizes come from the kernel file, name and descriptor have to end within the segment */
+        for (uint64_t pos = 0; pos + sizeof(struct elf_note) <= segs[i].filesz; ) {
+            const struct elf_note* note = (const struct elf_note*)(notes + pos);
+            uint64_t name_pos = pos + sizeof(*note);
+            uint64_t desc_pos = name_pos + (((uint64_t)note->namesz + 3) & ~3ull);
+            uint64_t next_pos = desc_pos + (((uint64_t)note->descsz + 3) & ~3ull);
+            if (next_pos > segs[i].filesz) {
+                LOG_ERROR("pvh: note at 0x%llx is truncated\n", segs[i].offset + pos);
+                break;
+            }
+
+            const char* name = (const char*)(notes + name_pos);
+            if (note->type == XEN_ELFNOTE_PHYS32_ENTRY && note->namesz == 4 && note->descsz >= sizeof(uint32_t) &&
+                !strncmp(name, "Xen", 4)) {
+                /* Descriptor is either 32 or 64-bit, physical entry is below 4G either way */
+                entry = *(const uint32_t*)(notes + desc_pos);
+                break;
+            }
+
+            pos = next_pos;
+        }
+
+        page_free(notes, order);
+    }
+
+    return entry;
+}
+
+/**
+ * Read next size bytes of selected fw_cfg item and hash them on the way.
+ * Data lands at dst, or only passes through bounce chunk if dst is NULL.
+ */
+static void read_measured(struct sha256* ctx, uint8_t* dst, uint64_t size, uint8_t* chunk)
+{
+    for (uint64_t pos = 0; pos < size; ) {
+        uint32_t n = size - pos < PVH_CHUNK ? size - pos : PVH_CHUNK;
+        uint8_t* buf = dst ? dst + pos : chunk;
+        fw_cfg_read_next(buf, n);
+        sha256_update(ctx, buf, n);
+        pos += n;
+    }
+}
+
+/**
+ * Reserve PT_LOAD segments and stream kernel file front to back in a single fw_cfg pass.
+ * Segment contents land at their physical addresses, everything else passes through a bounce chunk,
+ * so that measurement covers the whole file and matches sha256sum of it.
+ */
+static bool load_segments(struct segment* segs, size_t count, uint32_t kernel_size)
+{
+    /* Sort loadable segments by file offset, so that file is read front to back */
+    size_t nload = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (segs[i].type != ELF_PT_LOAD || !segs[i].memsz) {
+            continue;
+        }
+
+        struct segment seg = segs[i];
+        size_t j = nload++;
+        for (; j > 0 && segs[j - 1].offset > seg.offset; --j) {
+            segs[j] = segs[j - 1];
+        }
+        segs[j] = seg;
+    }
+
+    uint64_t pos = 0;
+
+    for (size_t i = 0; i < nload; ++i) {
+        const struct segment* seg = &segs[i];
+
+        if (seg->filesz > seg->memsz) {
+            LOG_ERROR("pvh: segment at 0x%llx has more file data than memory\n", seg->paddr);
+            return false;
+        }
+
+        if (!page_reserve(seg->paddr, seg->memsz)) {
+            LOG_ERROR("pvh: segment at 0x%llx, size 0x%llx is not in free RAM\n", seg->paddr, seg->memsz);
+            return false;
+        }
+
+        /*
+         * Free RAM was scrubbed at boot, but pages freed since then, such as ELF header and note buffers, are dirty.
+         * Large bss goes to the scrub engine, so that all CPUs clear it.
+         */
+        if (seg->memsz > seg->filesz) {
+            uint64_t bss = seg->paddr + seg->filesz;
+            uint64_t bss_size = seg->memsz - seg->filesz;
+            if (bss_size >= SCRUB_CHUNK_SIZE) {
+                scrub_range(bss, bss_size, 0);
+            } else {
+                memset((void*)(uintptr_t)bss, 0, bss_size);
+            }
+        }
+
+        if (!seg->filesz) {
+            continue;
+        }
+
+        if (seg->offset < pos) {
+            LOG_ERROR("pvh: overlapping segments are not supported\n");
+            return false;
+        }
+
+        pos = seg->offset + seg->filesz;
+        if (pos > kernel_size) {
+            LOG_ERROR("pvh: segment at file offset 0x%llx is past end of file\n", seg->offset);
+            return false;
+        }
+    }
+
+    uint8_t* chunk = page_alloc(page_order(PVH_CHUNK));
+    assert(chunk);
+    struct sha256 ctx;
+    sha256_init(&ctx);
+
+    fw_cfg_select(FW_CFG_KERNEL_DATA);
+    pos = 0;
+    for (size_t i = 0; i < nload; ++i) {
+        const struct segment* seg = &segs[i];
+        if (!seg->filesz) {
+            continue;
+        }
+
+        read_measured(&ctx, NULL, seg->offset - pos, chunk);
+        read_measured(&ctx, (uint8_t*)(uintptr_t)seg->paddr, seg->filesz, chunk);
+        pos = seg->offset + seg->filesz;
+    }
+    read_measured(&ctx, NULL, kernel_size - pos, chunk);
+    page_free(chunk, page_order(PVH_CHUNK));
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&ctx, digest);
+    measure_record("kernel", kernel_size, digest);
+    return true;
+}
+
+static void measure_buffer(const char* name, const void* buf, uint64_t size)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256(buf, size, digest);
+    measure_record(name, size, digest);
+}
+
+/** Read a whole fw_cfg item into a fresh page allocator block */
+static void* load_item(uint16_t select, uint32_t size)
+{
+    void* buf = page_alloc(page_order(size));
+    assert(buf);
+    fw_cfg_read(select, buf, size);
+    return buf;
+}
+
+/**
+ * Decode LZ4 frame from disk straight to its final place.
+ * Chunks are read into a bounce buffer, so only decoded payload and one chunk are in memory at once.
+ */
+static void* load_disk_lz4(uint64_t content_size, uint32_t* size)
+{
+    uint64_t disk_size = virtio_blk_size();
+    unsigned order = page_order(content_size);
+    uint8_t* buf = order <= PAGE_ORDER_MAX ? page_alloc(order) : NULL;
+    uint8_t* chunk = page_alloc(page_order(PVH_CHUNK));
+    assert(chunk);
+    if (!buf) {
+        LOG_ERROR("pvh: no room for %llu MB disk payload\n", content_size >> 20);
+        page_free(chunk, page_order(PVH_CHUNK));
+        return NULL;
+    }
+
+    struct lz4_stream s;
+    lz4_init(&s, buf, content_size);
+
+    /* Decoded output is measured while it is still in cache */
+    struct sha256 ctx;
+    sha256_init(&ctx);
+    size_t hashed = 0;
+
+    uint64_t start = now_ns();
+    bool ok = true;
+    for (uint64_t pos = 0; ok && pos < disk_size && !lz4_done(&s); pos += PVH_CHUNK) {
+        uint32_t n = disk_size - pos < PVH_CHUNK ? disk_size - pos : PVH_CHUNK;
+        ok = virtio_blk_read(pos / VIRTIO_BLK_SECTOR_SIZE, chunk, n) && lz4_feed(&s, chunk, n) != LZ4_ERROR;
+        sha256_update(&ctx, buf + hashed, lz4_decoded_size(&s) - hashed);
+        hashed = lz4_decoded_size(&s);
+    }
+    page_free(chunk, page_order(PVH_CHUNK));
+
+    if (!ok || !lz4_done(&s) || lz4_decoded_size(&s) != content_size) {
+        LOG_ERROR("pvh: disk payload is not a valid LZ4 frame\n");
+        page_free(buf, order);
+        return NULL;
+    }
+
+    LOG_INFO("pvh: decoded %llu KB LZ4 disk payload in %llu us\n", content_size >> 10, (now_ns() - start) / 1000);
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&ctx, digest);
+    measure_record("initrd", content_size, digest);
+
+    *size = content_size;
+    return buf;
+}
+
+/** Read whole virtio-blk disk into a fresh page allocator block, returns NULL if it does not fit */
+static void* load_disk(uint32_t* size)
+{
+    /* LZ4 frames with content size are decoded, anything else is passed as is */
+    uint8_t* sector = page_alloc(0);
+    assert(sector);
+    uint64_t content_size = virtio_blk_read(0, sector, VIRTIO_BLK_SECTOR_SIZE) ?
+                            lz4_content_size(sector, VIRTIO_BLK_SECTOR_SIZE) : 0;
+    page_free(sector, 0);
+    if (content_size) {
+        return load_disk_lz4(content_size, size);
+    }
+
+    uint64_t disk_size = virtio_blk_size();
+    unsigned order = page_order(disk_size);
+    void* buf = order <= PAGE_ORDER_MAX ? page_alloc(order) : NULL;
+    if (!buf) {
+        LOG_ERROR("pvh: no room for %llu MB disk\n", disk_size >> 20);
+        return NULL;
+    }
+
+    if (!virtio_blk_read(0, buf, disk_size)) {
+        page_free(buf, order);
+        return NULL;
+    }
+
+    measure_buffer("initrd", buf, disk_size);
+    *size = disk_size;
+    return buf;
+}
+
+_Static_assert(E820_RAM == XEN_HVM_MEMMAP_TYPE_RAM && E820_RESERVED == XEN_HVM_MEMMAP_TYPE_RESERVED, "E820 and HVM memory types differ");
+_Static_assert(sizeof(struct hvm_start_info) + sizeof(struct hvm_modlist_entry) +
+               MEMMAP_MAX_ENTRIES * sizeof(struct hvm_memmap_table_entry) <= PAGE_SIZE, "Start info does not fit a page");
+
+/** Memory map is ours as is, E820 and HVM type values are the same */
+static uint32_t build_memmap(struct hvm_memmap_table_entry* map)
+{
+    uint32_t count = memmap_count();
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct e820_entry* e = memmap_at(i);
+        map[i] = (struct hvm_memmap_table_entry){ e->addr, e->size, e->type, 0 };
+    }
+
+    return count;
+}
+
+bool pvh_boot(void)
+{
+    if (!fw_cfg_present()) {
+        return false;
+    }
+
+    uint32_t kernel_size = read_u32_item(FW_CFG_KERNEL_SIZE);
+    if (!kernel_size) {
+        return false;
+    }
+
+    /* ELF header and program headers are expected within the first page */
+    uint8_t* hdr = page_alloc(0);
+    assert(hdr);
+    size_t hdr_size = kernel_size < PAGE_SIZE ? kernel_size : PAGE_SIZE;
+    fw_cfg_read(FW_CFG_KERNEL_DATA, hdr, hdr_size);
+
+    struct segment segs[PVH_MAX_SEGMENTS];
+    size_t nsegs = read_segments(hdr, hdr_size, segs);
+    page_free(hdr, 0);
+
+    uint32_t entry = nsegs ? find_pvh_entry(segs, nsegs) : 0;
+    if (!entry) {
+        LOG_ERROR("pvh: kernel is not an ELF with PVH entry note\n");
+        return false;
+    }
+
+    if (!load_segments(segs, nsegs, kernel_size)) {
+        return false;
+    }
+
+    /* start info, module list and memory map share a page */
+    struct hvm_start_info* info = page_alloc(0);
+    assert(info);
+    memset(info, 0, PAGE_SIZE);
+    struct hvm_modlist_entry* mod = (struct hvm_modlist_entry*)(info + 1);
+    struct hvm_memmap_table_entry* memmap = (struct hvm_memmap_table_entry*)(mod + 1);
+
+    info->magic = HVM_START_MAGIC_VALUE;
+    info->version = 1;
+    info->rsdp_paddr = acpi_rsdp();
+
+    uint32_t cmdline_size = read_u32_item(FW_CFG_CMDLINE_SIZE);
+    if (cmdline_size) {
+        info->cmdline_paddr = (uintptr_t)load_item(FW_CFG_CMDLINE_DATA, cmdline_size);
+        measure_buffer("cmdline", (void*)(uintptr_t)info->cmdline_paddr, cmdline_size);
+    }
+
+    uint32_t initrd_size = read_u32_item(FW_CFG_INITRD_SIZE);
+    if (initrd_size) {
+        mod->paddr = (uintptr_t)load_item(FW_CFG_INITRD_DATA, initrd_size);
+        measure_buffer("initrd", (void*)(uintptr_t)mod->paddr, initrd_size);
+    } else if (virtio_blk_present()) {
+        mod->paddr = (uintptr_t)load_disk(&initrd_size);
+    }
+
+    if (mod->paddr) {
+        mod->size = initrd_size;
+        info->nr_modules = 1;
+        info->modlist_paddr = (uintptr_t)mod;
+    }
+
+    info->memmap_paddr = (uintptr_t)memmap;
+    info->memmap_entries = build_memmap(memmap);
+
+    LOG_INFO("pvh: entry 0x%x, cmdline %u bytes, initrd %u bytes\n", entry, cmdline_size, initrd_size);
+
+    if (!measure_verify()) {
+        LOG_ERROR("pvh: payloads do not match %s, not booting\n", MEASURE_DIGESTS_FILE);
+        return false;
+    }
+
+    timeline_stamp(BOOT_PHASE_KERNEL);
+    virtio_blk_report();
+    alloc_report();
+    profile_report();
+    timeline_report();
+    log_flush();
+
+    clock_shutdown();
+    virtio_blk_shutdown();
+
+    /* Park APs in wait-for-SIPI, kernel will wake them itself */
+    if (smp_cpu_count() > 1) {
+        apic_send_init_all();
+    }
+
+    pvh_enter(entry, (uint32_t)(uintptr_t)info);
+}
@@ -6,6 +6,18 @@ QEMU=$(realpath ${QEMU:-../qemu/x86_64-softmmu/qemu-system-x86_64})
 BIOS=$(realpath ${BIOS:-./bios.bin})
 DEBUGCON=$(realpath ${DEBUGCON:-./debugcon.log})
 
+# Optional raw disk image on a modern-only virtio-blk device
+DRIVE=()
+if [ -n "$DISK" ]; then
+    DRIVE=(-drive file=$(realpath $DISK),if=none,id=disk,format=raw -device virtio-blk-pci,drive=disk,disable-legacy=on)
+fi
+
+# Optional sha256sum output with expected payload digests, see include/measure.h
+FWCFG=()
+if [ -n "$DIGESTS" ]; then
+    FWCFG=(-fw_cfg name=opt/bootleg/sha256sums,file=$(realpath $DIGESTS))
+fi
+
 $QEMU \
     -machine pc,accel=kvm \
     -cpu host \
@@ -17,4 +29,6 @@ $QEMU \
     -chardev file,path=$DEBUGCON,id=debugcon \
     -device isa-debugcon,iobase=0x402,chardev=debugcon \
     -qmp unix:./qmp.sock,server,nowait \
+    "${DRIVE[@]}" \
+    "${FWCFG[@]}" \
 
@@ -0,0 +1,119 @@
+#include <inttypes.h>
+#include <assert.h>
+#include <string.h>
+
+#include "scrub.h"
+#include "smp.h"
+#include "page_alloc.h"
+#include "clock.h"
+#include "logging.h"
+
+/** Ranges are processed in batches, so that bookkeeping fits on the stack */
+#define SCRUB_BATCH 32
+
+/** Job for parallel_for, chunks are numbered across all ranges of a batch */
+struct scrub_job {
+    const struct scrub_range* ranges;
+    size_t first_chunk[SCRUB_BATCH + 1];    /* Index of the first chunk of each range */
+    uint8_t pattern;
+};
+
+static inline uint64_t chunk_floor(uint64_t addr)
+{
+    return addr & ~(SCRUB_CHUNK_SIZE - 1);
+}
+
+static inline uint64_t chunk_ceil(uint64_t addr)
+{
+    return chunk_floor(addr + SCRUB_CHUNK_SIZE - 1);
+}
+
+static void scrub_chunks(size_t begin, size_t end, void* arg)
+{
+    const struct scrub_job* job = arg;
+
+    size_t r = 0;
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+        while (chunk >= job->first_chunk[r + 1]) {
+            ++r;
+        }
+
+        const struct scrub_range* range = &job->ranges[r];
+        uint64_t range_end = range->base + range->size;
+        uint64_t start = chunk_floor(range->base) + (chunk - job->first_chunk[r]) * SCRUB_CHUNK_SIZE;
+        uint64_t stop = start + SCRUB_CHUNK_SIZE;
+
+        if (start < range->base) {
+            start = range->base;
+        }
+        if (stop > range_end) {
+            stop = range_end;
+        }
+
+        memset((void*)(uintptr_t)start, job->pattern, stop - start);
+    }
+}
+
+static void scrub_batch(const struct scrub_range* ranges, size_t count, uint8_t pattern, struct scrub_stats* stats)
+{
+    struct scrub_job job;
+    job.ranges = ranges;
+    job.pattern = pattern;
+
+    size_t nchunks = 0;
+    for (size_t i = 0; i < count; ++i) {
+        job.first_chunk[i] = nchunks;
+        if (ranges[i].size) {
+            nchunks += (chunk_ceil(ranges[i].base + ranges[i].size) - chunk_floor(ranges[i].base)) / SCRUB_CHUNK_SIZE;
+        }
+        stats->bytes += ranges[i].size;
+    }
+    job.first_chunk[count] = nchunks;
+
+    uint64_t start = now_ns();
+    parallel_for(nchunks, 1, scrub_chunks, &job);
+    stats->ns += now_ns() - start;
+}
+
+struct scrub_stats scrub_ranges(const struct scrub_range* ranges, size_t count, uint8_t pattern)
+{
+    struct scrub_stats stats = { 0, 0 };
+
+    for (size_t i = 0; i < count; i += SCRUB_BATCH) {
+        scrub_batch(ranges + i, count - i < SCRUB_BATCH ? count - i : SCRUB_BATCH, pattern, &stats);
+    }
+
+    return stats;
+}
+
+/** Free blocks are gathered into a batch, which is scrubbed once it fills up */
+struct free_batch {
+    struct scrub_range ranges[SCRUB_BATCH];
+    size_t count;
+    struct scrub_stats stats;
+};
+
+static void scrub_free_block(uintptr_t base, size_t size, void* arg)
+{
+    struct free_batch* batch = arg;
+
+    batch->ranges[batch->count++] = (struct scrub_range){ base, size };
+    if (batch->count == SCRUB_BATCH) {
+        scrub_batch(batch->ranges, batch->count, 0, &batch->stats);
+        batch->count = 0;
+    }
+}
+
+void scrub_free_pages(void)
+{
+    struct free_batch batch;
+    batch.count = 0;
+    batch.stats = (struct scrub_stats){ 0, 0 };
+
+    pages_for_each_free(scrub_free_block, &batch);
+    scrub_batch(batch.ranges, batch.count, 0, &batch.stats);
+
+    LOG_INFO("scrub: %llu MB in %llu us on %u cpus, %llu MB/s\n",
+             batch.stats.bytes >> 20, batch.stats.ns / NSEC_PER_USEC, smp_cpu_count(),
+             (batch.stats.bytes >> 20) * NSEC_PER_SEC / (batch.stats.ns | 1));
+}
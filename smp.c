@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "smp.h"
+#include "apic.h"
+#include "cpu.h"
+#include "cache.h"
+#include "cmos.h"
+#include "clock.h"
+#include "page_alloc.h"
+#include "logging.h"
+
+/** QEMU reports number of CPUs - 1 in CMOS */
+#define CMOS_SMP_COUNT 0x5F
+
+/** Delays between IPIs and AP wait timeout, in microseconds */
+#define SMP_INIT_DELAY_US       10000
+#define SMP_SIPI_DELAY_US       200
+#define SMP_ONLINE_TIMEOUT_US   100000
+
+/**
+ * Work queue state.
+ * BSP publishes a job by bumping generation, job fields are not touched until every AP
+ * has reported that it ran out of chunks, so they are stable while any CPU works on them.
+ */
+struct smp_state {
+    uint32_t online;        /* APs that joined, SMP_CLOSED once BSP stops waiting, late APs halt */
+    uint32_t ncpus;         /* Online CPUs, BSP included, fixed once online is closed */
+
+    uint64_t generation;
+    parallel_fn fn;
+    void* arg;
+    size_t count;
+    size_t grain;
+    size_t next;            /* Next item to claim */
+    uint32_t finished;      /* APs done with current generation */
+};
+
+/** Joining and closing are single atomic operations on online, so every AP is either counted or halted */
+#define SMP_CLOSED (1u << 31)
+
+/** Every CPU polls it, keep it off cache lines that hold anything else */
+static struct smp_state smp_state __attribute__((aligned(64)));
+
+#define SMP_BOOT ((struct smp_boot*)SMP_BOOT_ADDR)
+#define SMP_STATE (&smp_state)
+
+extern const char smp_trampoline_start[];
+extern const char smp_trampoline_end[];
+
+static inline void pause(void)
+{
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+static void run_chunks(struct smp_state* state)
+{
+    parallel_fn fn = state->fn;
+    void* arg = state->arg;
+    size_t count = state->count;
+    size_t grain = state->grain;
+
+    for (;;) {
+        size_t begin = __atomic_fetch_add(&state->next, grain, __ATOMIC_RELAXED);
+        if (begin >= count) {
+            break;
+        }
+
+        fn(begin, begin + grain < count ? begin + grain : count, arg);
+    }
+}
+
+/** Entered from trampoline.asm on AP stack */
+void ap_start(unsigned index)
+{
+    struct smp_state* state = SMP_STATE;
+
+    init_cache_ap();
+    init_cpu_ap();
+    init_apic();
+
+    uint64_t seen = __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE);
+
+    uint32_t online = __atomic_load_n(&state->online, __ATOMIC_ACQUIRE);
+    do {
+        if (online & SMP_CLOSED) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&state->online, &online, online + 1, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    for (;;) {
+        uint64_t generation;
+        while ((generation = __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE)) == seen) {
+            pause();
+        }
+        seen = generation;
+
+        run_chunks(state);
+        __atomic_add_fetch(&state->finished, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void init_smp(void)
+{
+    struct smp_state* state = SMP_STATE;
+    struct smp_boot* boot = SMP_BOOT;
+
+    memset(state, 0, sizeof(*state));
+    state->ncpus = 1;
+
+    unsigned expected = cmos_read(CMOS_SMP_COUNT) + 1;
+    if (expected == 1) {
+        return;
+    }
+
+    void* stacks = page_alloc(page_order((expected - 1) * SMP_AP_STACK_SIZE));
+    assert(stacks);
+
+    boot->next_index = 1;
+    boot->max_index = expected - 1;
+    boot->stack_size = SMP_AP_STACK_SIZE;
+    boot->stacks = (uintptr_t)stacks;
+
+    memcpy((void*)SMP_TRAMPOLINE_BASE, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+
+    apic_send_init_all();
+    udelay(SMP_INIT_DELAY_US);
+
+    for (unsigned sipi = 0; sipi < 2; ++sipi) {
+        apic_send_sipi_all(SMP_TRAMPOLINE_BASE >> 12);
+        udelay(SMP_SIPI_DELAY_US);
+    }
+
+    uint64_t deadline = now_ns() + SMP_ONLINE_TIMEOUT_US * NSEC_PER_USEC;
+    while (__atomic_load_n(&state->online, __ATOMIC_ACQUIRE) + 1 < expected && now_ns() < deadline) {
+        pause();
+    }
+
+    /* APs that have not joined by now never will */
+    state->ncpus = (__atomic_fetch_or(&state->online, SMP_CLOSED, __ATOMIC_ACQ_REL) & ~SMP_CLOSED) + 1;
+
+    if (state->ncpus != expected) {
+        LOG_ERROR("smp: only %u of %u cpus came online\n", state->ncpus, expected);
+    }
+
+    LOG_INFO("smp: %u cpus online\n", state->ncpus);
+}
+
+unsigned smp_cpu_count(void)
+{
+    return SMP_STATE->ncpus;
+}
+
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void* arg)
+{
+    struct smp_state* state = SMP_STATE;
+
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    /* Before init_smp there are no CPUs counted, BSP does it all */
+    if (state->ncpus <= 1 || count <= grain) {
+        fn(0, count, arg);
+        return;
+    }
+
+    state->fn = fn;
+    state->arg = arg;
+    state->count = count;
+    state->grain = grain;
+    state->next = 0;
+    state->finished = 0;
+    __atomic_store_n(&state->generation, state->generation + 1, __ATOMIC_RELEASE);
+
+    run_chunks(state);
+
+    while (__atomic_load_n(&state->finished, __ATOMIC_ACQUIRE) != state->ncpus - 1) {
+        pause();
+    }
+}
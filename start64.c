@@ -1,162 +1,194 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pci.h"
+#include "pci_enum.h"
 #include "dataseg.h"
 #include "logging.h"
 #include "heap.h"
 #include "apic.h"
-
-void* memset(void* s, int c, size_t n)
-{
-    /* We just assume we have ERMSB */
-    __asm__ volatile ("rep stosb" : :"D"(s), "c"(n), "a"((uint8_t)c) :"memory");
-    return s;
-}
-
-void* memcpy(void* dest, const void* src, size_t n)
-{
-    uint32_t* pdest32 = (uint32_t*)dest;
-    const uint32_t* psrc32 = (const uint32_t*)src;
-
-    for (size_t i = 0; i < (n >> 2); ++i) {
-        *pdest32++ = *psrc32++;
-    }
-
-    for (size_t i = 0; i < (n & 3); ++i) {
-        *(uint8_t*)pdest32++ = *(uint8_t*)psrc32++;
-    }
-
-    return dest;
-}
-
-size_t strlen(const char* s)
-{
-    size_t len = 0;
-    while (*s++ != '\0') {
-        ++len;
-    }
-
-    return len;
-}
+#include "smp.h"
+#include "scrub.h"
+#include "fw_cfg.h"
+#include "pvh.h"
+#include "timeline.h"
+#include "cpu.h"
+#include "page_alloc.h"
+#include "memmap.h"
+#include "cache.h"
+#include "datamap.h"
+#include "logring.h"
+#include "isr.h"
+#include "profile.h"
+#include "clock.h"
+#include "virtio_blk.h"
+#include "measure.h"
+#include "acpi.h"
+#include "alloc_stats.h"
 
 void _assert(const char* file, unsigned long line, const char* reason)
 {
     LOG_ERROR("Assertion \"%s\" failed at file %s, line %u\n", reason, file, line);
+    log_flush();
     abort();
 }
 
 
-/**
- * Exception frame record.
- * Generated by assembly code, order of fields is important.
- */
-struct exception_frame32 {
-    uint32_t edi;
-    uint32_t esi;
-    uint32_t ebp;
-    uint32_t esp;
-    uint32_t ebx;
-    uint32_t edx;
-    uint32_t ecx;
-    uint32_t eax;
-    uint32_t error_code;
-    uint32_t eip;
-    uint16_t cs;
-    uint16_t _pad;
-    uint32_t eflags;
-};
-
-static uint32_t read_cr0(void)
+static uint64_t read_cr0(void)
 {
-    uint32_t res;
-    __asm__ volatile ("mov %%cr0, %%eax":"=a"(res)::);
+    uint64_t res;
+    __asm__ volatile ("mov %%cr0, %0":"=r"(res)::);
     return res;
 }
 
-static uint32_t read_cr2(void)
+static uint64_t read_cr2(void)
 {
-    uint32_t res;
-    __asm__ volatile ("mov %%cr2, %%eax":"=a"(res)::);
+    uint64_t res;
+    __asm__ volatile ("mov %%cr2, %0":"=r"(res)::);
     return res;
 }
 
-static uint32_t read_cr3(void)
+static uint64_t read_cr3(void)
 {
-    uint32_t res;
-    __asm__ volatile ("mov %%cr3, %%eax":"=a"(res)::);
+    uint64_t res;
+    __asm__ volatile ("mov %%cr3, %0":"=r"(res)::);
     return res;
 }
 
-static uint32_t read_cr4(void)
+static uint64_t read_cr4(void)
 {
-    uint32_t res;
-    __asm__ volatile ("mov %%cr4, %%eax":"=a"(res)::);
+    uint64_t res;
+    __asm__ volatile ("mov %%cr4, %0":"=r"(res)::);
     return res;
 }
 
-void exception_handler(unsigned long num, struct exception_frame32* frame)
+void exception_handler(struct interrupt_frame* frame)
 {
-    LOG_ERROR("Exception 0x%hx\n", num);
-    LOG_ERROR("CS: %hx\n", frame->cs);
-    LOG_ERROR("EIP: %x\n", frame->eip);
-    LOG_ERROR("EFLAGS: %x\n", frame->eflags);
-    LOG_ERROR("Error code: %x\n", frame->error_code);
-    LOG_ERROR("EAX: 0x%x\n", frame->eax);
-    LOG_ERROR("EBX: 0x%x\n", frame->ebx);
-    LOG_ERROR("ECX: 0x%x\n", frame->ecx);
-    LOG_ERROR("EDX: 0x%x\n", frame->edx);
-    LOG_ERROR("EDI: 0x%x\n", frame->edi);
-    LOG_ERROR("ESI: 0x%x\n", frame->esi);
-    LOG_ERROR("EBP: 0x%x\n", frame->ebp);
-    LOG_ERROR("ESP: 0x%x\n", frame->esp);
-    LOG_ERROR("CR0: 0x%x\n", read_cr0());
-    LOG_ERROR("CR2: 0x%x\n", read_cr2());
-    LOG_ERROR("CR3: 0x%x\n", read_cr3());
-    LOG_ERROR("CR4: 0x%x\n", read_cr4());
+    LOG_ERROR("Exception 0x%llx\n", frame->vector);
+    LOG_ERROR("CS: %llx\n", frame->cs);
+    LOG_ERROR("RIP: %llx\n", frame->rip);
+    LOG_ERROR("RFLAGS: %llx\n", frame->rflags);
+    LOG_ERROR("Error code: %llx\n", frame->error_code);
+    LOG_ERROR("RAX: 0x%llx RBX: 0x%llx RCX: 0x%llx RDX: 0x%llx\n", frame->rax, frame->rbx, frame->rcx, frame->rdx);
+    LOG_ERROR("RSI: 0x%llx RDI: 0x%llx RBP: 0x%llx RSP: 0x%llx\n", frame->rsi, frame->rdi, frame->rbp, frame->rsp);
+    LOG_ERROR("R8: 0x%llx R9: 0x%llx R10: 0x%llx R11: 0x%llx\n", frame->r8, frame->r9, frame->r10, frame->r11);
+    LOG_ERROR("R12: 0x%llx R13: 0x%llx R14: 0x%llx R15: 0x%llx\n", frame->r12, frame->r13, frame->r14, frame->r15);
+    LOG_ERROR("CR0: 0x%llx\n", read_cr0());
+    LOG_ERROR("CR2: 0x%llx\n", read_cr2());
+    LOG_ERROR("CR3: 0x%llx\n", read_cr3());
+    LOG_ERROR("CR4: 0x%llx\n", read_cr4());
+    log_flush();
 }
 
+/** PAM0 register of host bridge, followed by PAM1-PAM6 */
+#define I440FX_PAM0 0x59
+#define Q35_PAM0    0x90
+
 static void enable_low_ram(void)
 {
-    uint32_t i440fx = pci_make_bdf(0, 0, 0);
-    uint32_t pam02 = pci_read32(i440fx, 0x58);
-    uint32_t pam36 = pci_read32(i440fx, 0x5C);
-
-    pam02 |= 0x33333000; /* PAM0 starts at 0x59, avoid touching 0x58 */
-    pam36 |= 0x33333333;
-
-    pci_write32(i440fx, 0x58, pam02);
-    pci_write32(i440fx, 0x5C, pam36);
+    uint32_t host = pci_make_bdf(0, 0, 0);
+    uint16_t pam0 = pci_host() == PCI_HOST_Q35 ? Q35_PAM0 : I440FX_PAM0;
 
-    pam02 = pci_read32(i440fx, 0x58);
-    pam36 = pci_read32(i440fx, 0x5C);
+    /* PAM0 covers F-seg in its high nibble, PAM1-6 cover C-, D- and E-segs with both nibbles */
+    pci_write8(host, pam0, pci_read8(host, pam0) | 0x30);
+    for (uint16_t reg = pam0 + 1; reg <= pam0 + 6; ++reg) {
+        pci_write8(host, reg, 0x33);
+    }
 
 #ifdef DEBUG
-    for (uint32_t* ptr = 0x000E0000; ptr < 0x000F0000; ++ptr) {
-        *ptr = 0xEEEEEEEE;
-    }
+    /* APs are not up yet, so this is a single CPU fill with wide stores */
+    memset((void*)0x000E0000, 0xEE, 0x10000);
+    memset((void*)0x000F0000, 0xFF, 0x10000);
+#endif
+}
 
-    for (uint32_t* ptr = 0x000F0000; ptr < 0x00100000; ++ptr) {
-        *ptr = 0xFFFFFFFF;
+/** Hand identity mapped RAM above page tables over to page allocator */
+static void add_ram_pages(void)
+{
+    for (uint32_t i = 0; i < memmap_count(); ++i) {
+        const struct e820_entry* e = memmap_at(i);
+        if (e->type != E820_RAM) {
+            continue;
+        }
+
+        uint64_t start = e->addr > PAGES_BASE ? e->addr : PAGES_BASE;
+        uint64_t end = e->addr + e->size < PAGES_TOP ? e->addr + e->size : PAGES_TOP;
+        start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        end &= ~(PAGE_SIZE - 1);
+        if (start < end) {
+            pages_add_range(start, end - start);
+        }
     }
-#endif
 }
 
 int main(void)
 {
+    init_pci();
     enable_low_ram();
     LOG_DEBUG("low mem enabled at 0x%llx\n", 0x000E0000ull);
+    timeline_stamp(BOOT_PHASE_LOW_RAM);
+
+    init_memmap();
+    timeline_stamp(BOOT_PHASE_MEMMAP);
+
+    init_cache();
+    timeline_stamp(BOOT_PHASE_CACHE);
+
+    init_pages();
+    add_ram_pages();
+    timeline_stamp(BOOT_PHASE_PAGES);
 
     init_dataseg();
+    timeline_stamp(BOOT_PHASE_DATASEG);
+
     init_heap();
+    timeline_stamp(BOOT_PHASE_HEAP);
+
+    init_fw_cfg();
+    timeline_stamp(BOOT_PHASE_FW_CFG);
+
+    init_measure();
+    timeline_stamp(BOOT_PHASE_MEASURE);
+
+    init_acpi();
+    timeline_stamp(BOOT_PHASE_ACPI);
+
+    pci_enumerate();
+    timeline_stamp(BOOT_PHASE_PCI);
+
+    init_virtio_blk();
+    timeline_stamp(BOOT_PHASE_VIRTIO_BLK);
 
     init_apic();
+    timeline_stamp(BOOT_PHASE_APIC);
+
+    init_smp();
+    timeline_stamp(BOOT_PHASE_SMP);
+
+    scrub_free_pages();
+    timeline_stamp(BOOT_PHASE_SCRUB);
+
+    /* Does not return if there is a kernel to boot */
+    pvh_boot();
 
+    virtio_blk_report();
+    alloc_report();
+    profile_report();
+    timeline_report();
+    log_flush();
     return 0;
 }
 
 int _start(void)
 {
+    init_timeline();
+    timeline_stamp(BOOT_PHASE_START);
+    init_log_ring();
+    init_cpu();
+    init_clock();
+    timeline_stamp(BOOT_PHASE_CLOCK);
+    profile_start();
     return main();
 }
@@ -0,0 +1,81 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "datamap.h"
+#include "logging.h"
+#include "io.h"
+#include "clock.h"
+
+#if !defined(TIMELINE_EARLY_BASE) || !defined(TIMELINE_EARLY_SIZE)
+#   error TIMELINE_EARLY_BASE and TIMELINE_EARLY_SIZE should be defined
+#endif
+
+_Static_assert(BOOT_PHASE_COUNT * sizeof(uint64_t) <= TIMELINE_EARLY_SIZE, "Early timeline table is too small");
+
+static const char* const phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_RESET] = "reset",
+    [BOOT_PHASE_PAGE_TABLES] = "page tables",
+    [BOOT_PHASE_LONG_MODE] = "lm switch",
+    [BOOT_PHASE_STAGE] = "stage copy",
+    [BOOT_PHASE_START] = "lm entry",
+    [BOOT_PHASE_CLOCK] = "init_clock",
+    [BOOT_PHASE_LOW_RAM] = "enable_low_ram",
+    [BOOT_PHASE_MEMMAP] = "init_memmap",
+    [BOOT_PHASE_CACHE] = "init_cache",
+    [BOOT_PHASE_PAGES] = "init_pages",
+    [BOOT_PHASE_DATASEG] = "init_dataseg",
+    [BOOT_PHASE_HEAP] = "init_heap",
+    [BOOT_PHASE_FW_CFG] = "init_fw_cfg",
+    [BOOT_PHASE_MEASURE] = "init_measure",
+    [BOOT_PHASE_ACPI] = "init_acpi",
+    [BOOT_PHASE_PCI] = "pci_enumerate",
+    [BOOT_PHASE_VIRTIO_BLK] = "init_virtio_blk",
+    [BOOT_PHASE_APIC] = "init_apic",
+    [BOOT_PHASE_SMP] = "init_smp",
+    [BOOT_PHASE_SCRUB] = "scrub",
+    [BOOT_PHASE_KERNEL] = "kernel load",
+};
+
+static uint64_t timeline_table[BOOT_PHASE_COUNT];
+
+void init_timeline(void)
+{
+    memcpy(timeline_table, (const void*)TIMELINE_EARLY_BASE, sizeof(timeline_table));
+}
+
+void timeline_stamp(enum boot_phase phase)
+{
+    timeline_table[phase] = rdtsc();
+}
+
+void timeline_report(void)
+{
+    const uint64_t* table = timeline_table;
+
+    /* Phases that were not reached are left zeroed, last recorded stamp closes the timeline */
+    uint64_t end = table[BOOT_PHASE_RESET];
+    for (unsigned i = BOOT_PHASE_RESET + 1; i < BOOT_PHASE_COUNT; ++i) {
+        if (table[i] > end) {
+            end = table[i];
+        }
+    }
+
+    uint64_t total = end - table[BOOT_PHASE_RESET];
+    LOG_INFO("timeline: %llu us total, %llu cycles\n", clock_tsc_to_ns(total) / NSEC_PER_USEC, total);
+    if (total == 0) {
+        return;
+    }
+
+    uint64_t prev = table[BOOT_PHASE_RESET];
+    for (unsigned i = BOOT_PHASE_RESET + 1; i < BOOT_PHASE_COUNT; ++i) {
+        if (table[i] == 0) {
+            continue;
+        }
+
+        uint64_t cycles = table[i] - prev;
+        uint64_t permille = cycles * 1000 / total;
+        LOG_INFO("  %-14s %10llu us %3llu.%llu%%\n", phase_names[i], clock_tsc_to_ns(cycles) / NSEC_PER_USEC, permille / 10, permille % 10);
+        prev = table[i];
+    }
+}
@@ -0,0 +1,475 @@
+/**
+ * Host test for ACPI table-loader (see include/acpi.h), built with firmware flags on top of tools/hostenv.c.
+ * fw_cfg, page allocator and memory map are stubbed out: files live in host memory, pages come from a mapped region.
+ *
+ * Usage: acpitest [seed] [scripts]
+ *
+ * QEMU layout: RSDP in F-segment, RSDT and XSDT pointing to FADT and MADT, FADT pointing to FACS and DSDT,
+ * linked and checksummed the way QEMU's linker does it. Every table should checksum to 0 and every pointer
+ * should resolve to its target.
+ *
+ * Random scripts: blobs of random bytes and sizes, pointers and checksums at random places, in random order,
+ * over overlapping ranges. Loaded blobs are compared against a reference which runs the same script
+ * by rescanning every checksum range. Pages are checked for leaks, and HIGH blobs for being marked reserved.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hostenv.h"
+#include "acpi.h"
+#include "fw_cfg.h"
+#include "page_alloc.h"
+#include "memmap.h"
+#include "datamap.h"
+
+#define STUB_PAGES_BASE 0x50000000ul
+#define STUB_PAGES_SIZE 0x1000000ul
+
+#define MAX_FILES       16
+#define MAX_ENTRIES     256
+#define MAX_BLOB_SIZE   0x2000
+
+/** Script entry layout, see hw/acpi/bios-linker-loader.c in QEMU */
+#define ENTRY_SIZE          128
+#define ENTRY_FILE          4
+#define ENTRY_ALLOC_ALIGN   60
+#define ENTRY_ALLOC_ZONE    64
+#define ENTRY_PTR_SRC       60
+#define ENTRY_PTR_OFFSET    116
+#define ENTRY_PTR_SIZE      120
+#define ENTRY_SUM_OFFSET    60
+#define ENTRY_SUM_START     64
+#define ENTRY_SUM_LENGTH    68
+
+#define CMD_ALLOCATE        1
+#define CMD_ADD_POINTER     2
+#define CMD_ADD_CHECKSUM    3
+
+#define ZONE_HIGH           1
+#define ZONE_FSEG           2
+
+/** ACPI table header */
+#define SDT_LENGTH          4
+#define SDT_CHECKSUM        9
+#define SDT_SIZE            36
+
+/**
+ * fw_cfg: file 0 is the script, the rest are blobs
+ */
+
+static struct fw_cfg_file files[MAX_FILES];
+static uint8_t contents[MAX_FILES][MAX_BLOB_SIZE];
+static uint8_t* loaded[MAX_FILES];
+static uint32_t nfiles;
+
+static uint8_t script[MAX_ENTRIES * ENTRY_SIZE];
+static uint32_t nentries;
+
+const struct fw_cfg_file* fw_cfg_find(const char* name)
+{
+    for (uint32_t i = 0; i < nfiles; ++i) {
+        if (!strncmp(files[i].name, name, FW_CFG_MAX_FILE_PATH)) {
+            return &files[i];
+        }
+    }
+
+    return NULL;
+}
+
+void fw_cfg_read_scatter(const struct fw_cfg_file* file, uint32_t offset, const struct fw_cfg_sg* sg, size_t count)
+{
+    uint32_t index = file - files;
+    const uint8_t* src = index ? contents[index] : script;
+
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(offset + sg[i].size <= file->size, "fw_cfg: read past end of %s", file->name);
+        if (sg[i].buf) {
+            memcpy(sg[i].buf, src + offset, sg[i].size);
+            if (offset == 0 && index) {
+                loaded[index] = sg[i].buf;
+            }
+        }
+        offset += sg[i].size;
+    }
+}
+
+/**
+ * Pages: naturally aligned blocks bumped from a mapped region, which is reset between scripts
+ */
+
+static uintptr_t pages_next;
+static uint32_t pages_live;
+
+void* page_alloc(unsigned order)
+{
+    size_t size = PAGE_SIZE << order;
+    uintptr_t base = (pages_next + size - 1) & ~(size - 1);
+    if (base + size > STUB_PAGES_BASE + STUB_PAGES_SIZE) {
+        return NULL;
+    }
+
+    pages_next = base + size;
+    pages_live++;
+
+    /* Free pages are dirty */
+    memset((void*)base, 0xCC, size);
+    return (void*)base;
+}
+
+void page_free(void* ptr, unsigned order)
+{
+    uintptr_t base = (uintptr_t)ptr;
+    CHECK(base >= STUB_PAGES_BASE && base < pages_next && !(base & ((PAGE_SIZE << order) - 1)),
+          "pages: bad free of 0x%llx, order %u", (uint64_t)base, order);
+    pages_live--;
+}
+
+static struct {
+    uint64_t addr;
+    uint64_t size;
+} reserved[MAX_FILES];
+static uint32_t nreserved;
+
+bool memmap_mark(uint64_t addr, uint64_t size, uint32_t type)
+{
+    CHECK(type == E820_RESERVED && nreserved < MAX_FILES, "memmap: unexpected mark of 0x%llx", addr);
+    reserved[nreserved].addr = addr;
+    reserved[nreserved].size = size;
+    nreserved++;
+    return true;
+}
+
+/** Names are short, destinations are zeroed */
+static void set_name(char* dst, const char* name)
+{
+    memcpy(dst, name, strlen(name) + 1);
+}
+
+static void reset(void)
+{
+    nfiles = 1;
+    nentries = 0;
+    nreserved = 0;
+    pages_next = STUB_PAGES_BASE;
+    pages_live = 0;
+    memset(loaded, 0, sizeof(loaded));
+    memset(files, 0, sizeof(files));
+    set_name(files[0].name, "etc/table-loader");
+}
+
+static uint32_t add_file(const char* name, uint32_t size)
+{
+    uint32_t index = nfiles++;
+    files[index].size = size;
+    set_name(files[index].name, name);
+    return index;
+}
+
+static uint8_t* add_entry(uint32_t command, uint32_t file)
+{
+    uint8_t* e = &script[nentries++ * ENTRY_SIZE];
+    memset(e, 0, ENTRY_SIZE);
+    memcpy(e, &command, sizeof(command));
+    set_name((char*)e + ENTRY_FILE, files[file].name);
+    files[0].size = nentries * ENTRY_SIZE;
+    return e;
+}
+
+static void add_allocate(uint32_t file, uint32_t align, uint8_t zone)
+{
+    uint8_t* e = add_entry(CMD_ALLOCATE, file);
+    memcpy(e + ENTRY_ALLOC_ALIGN, &align, sizeof(align));
+    e[ENTRY_ALLOC_ZONE] = zone;
+}
+
+static void add_pointer(uint32_t dest, uint32_t src, uint32_t offset, uint8_t size)
+{
+    uint8_t* e = add_entry(CMD_ADD_POINTER, dest);
+    set_name((char*)e + ENTRY_PTR_SRC, files[src].name);
+    memcpy(e + ENTRY_PTR_OFFSET, &offset, sizeof(offset));
+    e[ENTRY_PTR_SIZE] = size;
+}
+
+static void add_checksum(uint32_t file, uint32_t offset, uint32_t start, uint32_t length)
+{
+    uint8_t* e = add_entry(CMD_ADD_CHECKSUM, file);
+    memcpy(e + ENTRY_SUM_OFFSET, &offset, sizeof(offset));
+    memcpy(e + ENTRY_SUM_START, &start, sizeof(start));
+    memcpy(e + ENTRY_SUM_LENGTH, &length, sizeof(length));
+}
+
+static uint8_t sum_bytes(const uint8_t* p, uint32_t size)
+{
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+        sum += p[i];
+    }
+
+    return sum;
+}
+
+static uint64_t read_le(const uint8_t* p, uint8_t size)
+{
+    uint64_t val = 0;
+    memcpy(&val, p, size);
+    return val;
+}
+
+/** Pages taken by blobs in HIGH zone stay allocated and reserved, everything else is freed */
+static void check_pages(uint32_t nhigh)
+{
+    CHECK(pages_live == nhigh, "pages: %u blocks live, expected %u", pages_live, nhigh);
+    CHECK(nreserved == nhigh, "memmap: %u ranges reserved, expected %u", nreserved, nhigh);
+
+    for (uint32_t i = 0; i < nreserved; ++i) {
+        bool found = false;
+        for (uint32_t f = 1; f < nfiles; ++f) {
+            found |= loaded[f] && reserved[i].addr == (uintptr_t)loaded[f] && reserved[i].size >= files[f].size;
+        }
+        CHECK(found, "memmap: reserved 0x%llx is not a HIGH blob", reserved[i].addr);
+    }
+}
+
+/**
+ * QEMU layout
+ */
+
+static void put_sdt(uint8_t* t, const char* sig, uint32_t length)
+{
+    for (uint32_t i = SDT_SIZE; i < length; ++i) {
+        t[i] = (uint8_t)host_rand();
+    }
+    memcpy(t, sig, 4);
+    memcpy(t + SDT_LENGTH, &length, sizeof(length));
+    t[SDT_CHECKSUM] = 0;
+}
+
+static void test_qemu(void)
+{
+    reset();
+
+    /* Offsets of tables in etc/acpi/tables, FACS has no checksum */
+    enum { FACS = 0, DSDT = 64, FADT = DSDT + 4000, MADT = FADT + 276, RSDT = MADT + 120, XSDT = RSDT + 44,
+           TABLES_SIZE = XSDT + 52 };
+
+    uint32_t tables = add_file("etc/acpi/tables", TABLES_SIZE);
+    uint32_t rsdp = add_file("etc/acpi/rsdp", 36);
+    uint8_t* t = contents[tables];
+
+    memset(t, 0, TABLES_SIZE);
+    memcpy(t + FACS, "FACS", 4);
+    put_sdt(t + DSDT, "DSDT", FADT - DSDT);
+    put_sdt(t + FADT, "FACP", MADT - FADT);
+    put_sdt(t + MADT, "APIC", RSDT - MADT);
+    put_sdt(t + RSDT, "RSDT", XSDT - RSDT);
+    put_sdt(t + XSDT, "XSDT", TABLES_SIZE - XSDT);
+
+    /* Pointers are offsets into source blob until loader adds its address */
+    uint32_t facs = FACS, dsdt = DSDT;
+    uint64_t xdsdt = DSDT;
+    memcpy(t + FADT + 36, &facs, 4);
+    memcpy(t + FADT + 40, &dsdt, 4);
+    memcpy(t + FADT + 140, &xdsdt, 8);
+
+    uint32_t fadt = FADT, madt = MADT;
+    uint64_t xfadt = FADT, xmadt = MADT;
+    memcpy(t + RSDT + 36, &fadt, 4);
+    memcpy(t + RSDT + 40, &madt, 4);
+    memcpy(t + XSDT + 36, &xfadt, 8);
+    memcpy(t + XSDT + 44, &xmadt, 8);
+
+    uint8_t* r = contents[rsdp];
+    memset(r, 0, 36);
+    memcpy(r, "RSD PTR ", 8);
+    r[15] = 2;
+    uint32_t rsdt = RSDT, length = 36;
+    uint64_t xsdt = XSDT;
+    memcpy(r + 16, &rsdt, 4);
+    memcpy(r + 20, &length, 4);
+    memcpy(r + 24, &xsdt, 8);
+
+    /* Tables are linked and checksummed as they are built, RSDP goes last */
+    add_allocate(rsdp, 16, ZONE_FSEG);
+    add_allocate(tables, 64, ZONE_HIGH);
+    add_checksum(tables, DSDT + SDT_CHECKSUM, DSDT, FADT - DSDT);
+    add_pointer(tables, tables, FADT + 36, 4);
+    add_pointer(tables, tables, FADT + 40, 4);
+    add_pointer(tables, tables, FADT + 140, 8);
+    add_checksum(tables, FADT + SDT_CHECKSUM, FADT, MADT - FADT);
+    add_checksum(tables, MADT + SDT_CHECKSUM, MADT, RSDT - MADT);
+    add_pointer(tables, tables, XSDT + 44, 8);
+    add_pointer(tables, tables, XSDT + 36, 8);
+    add_checksum(tables, XSDT + SDT_CHECKSUM, XSDT, TABLES_SIZE - XSDT);
+    add_pointer(tables, tables, RSDT + 40, 4);
+    add_pointer(tables, tables, RSDT + 36, 4);
+    add_checksum(tables, RSDT + SDT_CHECKSUM, RSDT, XSDT - RSDT);
+    add_pointer(rsdp, tables, 16, 4);
+    add_pointer(rsdp, tables, 24, 8);
+    add_checksum(rsdp, 8, 0, 20);
+    add_checksum(rsdp, 32, 0, 36);
+
+    CHECK(init_acpi(), "qemu: init_acpi failed");
+    CHECK(acpi_rsdp() == (uintptr_t)loaded[rsdp], "qemu: rsdp at 0x%llx, expected 0x%llx",
+          acpi_rsdp(), (uint64_t)(uintptr_t)loaded[rsdp]);
+    CHECK(acpi_rsdp() >= FSEG_SHADOW_BASE && acpi_rsdp() + 36 <= FSEG_SHADOW_BASE + FSEG_SHADOW_SIZE &&
+          !(acpi_rsdp() & 15), "qemu: rsdp at 0x%llx is not an aligned F-segment address", acpi_rsdp());
+
+    uintptr_t base = (uintptr_t)loaded[tables];
+    CHECK(base && !(base & 63), "qemu: tables at 0x%llx are not aligned", (uint64_t)base);
+
+    const uint8_t* l = loaded[tables];
+    static const uint32_t sdts[] = { DSDT, FADT, MADT, RSDT, XSDT };
+    for (unsigned i = 0; i < sizeof(sdts) / sizeof(sdts[0]); ++i) {
+        uint32_t len = (uint32_t)read_le(l + sdts[i] + SDT_LENGTH, 4);
+        CHECK(sum_bytes(l + sdts[i], len) == 0, "qemu: table at +0x%x does not checksum to 0", sdts[i]);
+    }
+
+    const uint8_t* rl = loaded[rsdp];
+    CHECK(sum_bytes(rl, 20) == 0 && sum_bytes(rl, 36) == 0, "qemu: rsdp does not checksum to 0");
+    CHECK(read_le(rl + 16, 4) == base + RSDT && read_le(rl + 24, 8) == base + XSDT, "qemu: rsdp pointers are wrong");
+    CHECK(read_le(l + RSDT + 36, 4) == base + FADT && read_le(l + RSDT + 40, 4) == base + MADT &&
+          read_le(l + XSDT + 36, 8) == base + FADT && read_le(l + XSDT + 44, 8) == base + MADT,
+          "qemu: rsdt or xsdt pointers are wrong");
+    CHECK(read_le(l + FADT + 36, 4) == base + FACS && read_le(l + FADT + 40, 4) == base + DSDT &&
+          read_le(l + FADT + 140, 8) == base + DSDT, "qemu: fadt pointers are wrong");
+
+    check_pages(1);
+}
+
+/**
+ * Random scripts
+ */
+
+static uint8_t reference[MAX_FILES][MAX_BLOB_SIZE];
+
+/** Bytes taken by pointers and checksums, pointers are kept clear of anything that could overflow them */
+static bool taken[MAX_FILES][MAX_BLOB_SIZE];
+
+/** Run script by the letter: pointers are added in place, every checksum rescans its range */
+static void run_reference(void)
+{
+    for (uint32_t f = 1; f < nfiles; ++f) {
+        memcpy(reference[f], contents[f], files[f].size);
+    }
+
+    for (uint32_t i = 0; i < nentries; ++i) {
+        const uint8_t* e = &script[i * ENTRY_SIZE];
+        uint32_t command = (uint32_t)read_le(e, 4);
+        uint32_t dest = fw_cfg_find((const char*)e + ENTRY_FILE) - files;
+
+        if (command == CMD_ADD_POINTER) {
+            uint32_t src = fw_cfg_find((const char*)e + ENTRY_PTR_SRC) - files;
+            uint32_t offset = (uint32_t)read_le(e + ENTRY_PTR_OFFSET, 4);
+            uint8_t size = e[ENTRY_PTR_SIZE];
+            uint64_t val = read_le(reference[dest] + offset, size) + (uintptr_t)loaded[src];
+            memcpy(reference[dest] + offset, &val, size);
+        } else if (command == CMD_ADD_CHECKSUM) {
+            uint32_t offset = (uint32_t)read_le(e + ENTRY_SUM_OFFSET, 4);
+            uint32_t start = (uint32_t)read_le(e + ENTRY_SUM_START, 4);
+            uint32_t length = (uint32_t)read_le(e + ENTRY_SUM_LENGTH, 4);
+            reference[dest][offset] -= sum_bytes(reference[dest] + start, length);
+        }
+    }
+}
+
+static void test_random(uint32_t n)
+{
+    reset();
+    memset(taken, 0, sizeof(taken));
+
+    uint32_t nblobs = 1 + host_rand() % (MAX_FILES - 1);
+    uint32_t nhigh = 0;
+    for (uint32_t b = 0; b < nblobs; ++b) {
+        char name[FW_CFG_MAX_FILE_PATH] = "etc/acpi/blob-";
+        name[14] = 'a' + b;
+        uint32_t f = add_file(name, 8 + host_rand() % (MAX_BLOB_SIZE - 8));
+        for (uint32_t i = 0; i < files[f].size; ++i) {
+            contents[f][i] = (uint8_t)host_rand();
+        }
+    }
+
+    /* Allocations go first, FSEG ones fit together in F-segment */
+    uint32_t fseg_left = FSEG_SHADOW_SIZE;
+    for (uint32_t f = 1; f < nfiles; ++f) {
+        uint32_t align = 1u << (host_rand() % 7);
+        if (files[f].size + 64 <= fseg_left && host_rand() % 4 == 0) {
+            fseg_left -= files[f].size + 64;
+            add_allocate(f, align, ZONE_FSEG);
+        } else {
+            add_allocate(f, align, ZONE_HIGH);
+            nhigh++;
+        }
+    }
+
+    uint32_t ncommands = host_rand() % (MAX_ENTRIES - nentries);
+    for (uint32_t i = 0; i < ncommands; ++i) {
+        uint64_t r = host_rand();
+        uint32_t dest = 1 + (r >> 8) % nblobs;
+        uint32_t size = files[dest].size;
+
+        if (r & 1) {
+            uint8_t width = (r & 2) ? 8 : 4;
+            uint32_t offset = (r >> 16) % (size - width + 1);
+            uint32_t src = 1 + (r >> 40) % nblobs;
+
+            bool clear = true;
+            for (uint32_t j = 0; j < width; ++j) {
+                clear &= !taken[dest][offset + j];
+            }
+            if (!clear) {
+                continue;
+            }
+
+            /* Stored offsets are small, so that address + offset fits 4 bytes */
+            memset(&contents[dest][offset], 0, width);
+            memset(&taken[dest][offset], true, width);
+            contents[dest][offset] = (uint8_t)(r >> 48);
+            add_pointer(dest, src, offset, width);
+        } else {
+            /* Ranges overlap freely, including pointers and other checksum bytes */
+            uint32_t start = (r >> 16) % size;
+            uint32_t length = 1 + (r >> 32) % (size - start);
+            uint32_t offset = start + (r >> 48) % length;
+            if (taken[dest][offset]) {
+                continue;
+            }
+
+            taken[dest][offset] = true;
+            add_checksum(dest, offset, start, length);
+        }
+    }
+
+    init_acpi();
+    run_reference();
+
+    for (uint32_t f = 1; f < nfiles; ++f) {
+        CHECK(loaded[f], "random %u: %s was not loaded", n, files[f].name);
+        for (uint32_t i = 0; i < files[f].size; ++i) {
+            CHECK(loaded[f][i] == reference[f][i], "random %u: %s byte 0x%x is 0x%02x, expected 0x%02x",
+                  n, files[f].name, i, loaded[f][i], reference[f][i]);
+        }
+    }
+
+    check_pages(nhigh);
+}
+
+int host_main(int argc, char** argv)
+{
+    uint64_t seed = host_arg(argc > 1 ? argv[1] : NULL, 1);
+    uint64_t scripts = host_arg(argc > 2 ? argv[2] : NULL, 2000);
+    host_srand(seed);
+
+    host_map(STUB_PAGES_BASE, STUB_PAGES_SIZE);
+    host_map(FSEG_SHADOW_BASE, FSEG_SHADOW_SIZE);
+
+    test_qemu();
+    for (uint64_t i = 0; i < scripts; ++i) {
+        test_random(i);
+    }
+
+    printf("%s: seed %llu, %llu random scripts, %u checks passed\n", host_name, seed, scripts, host_checks);
+    return 0;
+}
@@ -0,0 +1,284 @@
+/**
+ * Host check and benchmark for hierarchical bitmap heap arenas use to find free blocks (see include/hbitmap.h),
+ * built with firmware flags on top of tools/hostenv.c.
+ *
+ * Usage: hbitmapbench [blocks] [ops]
+ *
+ * Check: random sets, clears and lookups from random positions on bitmaps of awkward sizes are compared
+ * against a naive one-byte-per-bit bitmap, and so is the old arena scan.
+ *
+ * Benchmark: an arena of blocks (64K by default, 64 byte blocks of a 4M heap) is filled to an occupancy
+ * with free blocks scattered at random, then every step allocates a block and frees a random allocated one.
+ * Hierarchical bitmap with next-fit cursor, the way arena_alloc uses it, runs against the old scan:
+ * first-fit over a byte bitmap read 32 bits at a time. Both replay the same frees. Results are ns per step.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hostenv.h"
+#include "hbitmap.h"
+
+#define MAX_BLOCKS (1u << 20)
+
+#define CHECK_OPS 200000
+
+static const uint32_t check_sizes[] = { 1, 63, 64, 65, 4095, 4096, 4097, 262145 };
+
+/** Per mille, so that nearly full arenas can be told apart */
+static const unsigned occupancies[] = { 0, 500, 900, 990, 999 };
+
+static uint64_t hbitmap_storage[MAX_BLOCKS / 64 + MAX_BLOCKS / 4096 + 64 + 1];
+static uint8_t naive[MAX_BLOCKS];
+
+/** Old arena bitmap, padded so that 32-bit chunk reads stay in bounds */
+static uint8_t legacy[MAX_BLOCKS / 8 + 4] __attribute__((aligned(4)));
+
+/** Allocated blocks, frees pick them at random */
+static uint32_t allocated[MAX_BLOCKS];
+static uint32_t nallocated;
+
+/** Free positions for every step, so both implementations replay the same sequence */
+static uint32_t victims[1u << 22];
+
+#define FAIL(msg, ...) { \
+    printf("hbitmapbench: " msg "\n", ## __VA_ARGS__); \
+    host_exit(1); \
+}
+
+static inline uint32_t bsf32(uint32_t val)
+{
+    uint32_t res;
+    __asm__ volatile ("bsf %1, %0" :"=r"(res) :"rm"(val) :);
+    return res;
+}
+
+/**
+ * Old arena_alloc scan: first set bit of a byte bitmap, 32 bits at a time, remainder copied into a chunk
+ */
+static uint32_t legacy_find(const uint8_t* bitmap, uint32_t nblocks)
+{
+    uint32_t block = 0;
+    uint32_t nchunks = nblocks / 32;
+    uint32_t nrem = nblocks - nchunks * 32;
+    const uint32_t* pchunk = (const uint32_t*)bitmap;
+
+    while (nchunks-- > 0) {
+        if (*pchunk == 0) {
+            block += 32;
+            pchunk++;
+            continue;
+        }
+
+        return block + bsf32(*pchunk);
+    }
+
+    if (nrem) {
+        uint32_t chunk = 0;
+        memcpy(&chunk, pchunk, (nrem >> 3) + ((nrem & 7) != 0));
+        if (chunk != 0) {
+            return block + bsf32(chunk);
+        }
+    }
+
+    return HBITMAP_NONE;
+}
+
+static inline void legacy_set(uint8_t* bitmap, uint32_t block)
+{
+    bitmap[block >> 3] |= 1u << (block & 7);
+}
+
+static inline void legacy_clear(uint8_t* bitmap, uint32_t block)
+{
+    bitmap[block >> 3] &= ~(1u << (block & 7));
+}
+
+static uint32_t naive_find_next(uint32_t nbits, uint32_t start)
+{
+    if (start >= nbits) {
+        start = 0;
+    }
+
+    for (uint32_t i = 0; i < nbits; ++i) {
+        uint32_t bit = start + i < nbits ? start + i : start + i - nbits;
+        if (naive[bit]) {
+            return bit;
+        }
+    }
+
+    return HBITMAP_NONE;
+}
+
+static uint32_t naive_first(uint32_t nbits)
+{
+    for (uint32_t i = 0; i < nbits; ++i) {
+        if (naive[i]) {
+            return i;
+        }
+    }
+
+    return HBITMAP_NONE;
+}
+
+static void set_bit(struct hbitmap* hb, uint32_t bit, bool val)
+{
+    naive[bit] = val;
+    if (val) {
+        hbitmap_set(hb, bit);
+        legacy_set(legacy, bit);
+    } else {
+        hbitmap_clear(hb, bit);
+        legacy_clear(legacy, bit);
+    }
+}
+
+static void check_size(uint32_t nbits)
+{
+    struct hbitmap hb;
+    assert(hbitmap_storage_words(nbits) <= sizeof(hbitmap_storage) / sizeof(hbitmap_storage[0]));
+    hbitmap_init(&hb, hbitmap_storage, nbits);
+    memset(naive, 0, nbits);
+    memset(legacy, 0, sizeof(legacy));
+
+    /* Density drifts from sparse to dense and back, so lookups see both long runs and crowded words */
+    for (uint32_t op = 0; op < CHECK_OPS; ++op) {
+        uint32_t density = op < CHECK_OPS / 2 ? op * 1000 / (CHECK_OPS / 2) : (CHECK_OPS - op) * 1000 / (CHECK_OPS / 2);
+        uint64_t r = host_rand();
+        uint32_t bit = (r >> 16) % nbits;
+
+        switch (r & 3) {
+        case 0:
+        case 1:
+            set_bit(&hb, bit, (r >> 8) % 1000 < density);
+            break;
+        case 2: {
+            uint32_t start = (r >> 40) % (nbits + 1);
+            uint32_t got = hbitmap_find_next(&hb, start);
+            uint32_t expected = naive_find_next(nbits, start);
+            if (got != expected) {
+                FAIL("%u bits: find_next(%u) is %u, expected %u", nbits, start, got, expected);
+            }
+            break;
+        }
+        default: {
+            uint32_t got = legacy_find(legacy, nbits);
+            uint32_t expected = naive_first(nbits);
+            if (got != expected) {
+                FAIL("%u bits: old scan found %u, expected %u", nbits, got, expected);
+            }
+            if (hbitmap_test(&hb, bit) != naive[bit] || hbitmap_empty(&hb) != (expected == HBITMAP_NONE)) {
+                FAIL("%u bits: bit %u or emptiness is wrong", nbits, bit);
+            }
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * Fill arena to occupancy, free blocks are scattered at random, set bit is a free block
+ */
+static void fill(struct hbitmap* hb, uint32_t nblocks, unsigned occupancy, bool use_legacy)
+{
+    if (use_legacy) {
+        memset(legacy, 0, sizeof(legacy));
+    } else {
+        hbitmap_init(hb, hbitmap_storage, nblocks);
+    }
+
+    /* Same seed for both, so they start from the same layout */
+    host_srand(occupancy + 1);
+    nallocated = 0;
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        if (host_rand() % 1000 < occupancy) {
+            allocated[nallocated++] = i;
+        } else if (use_legacy) {
+            legacy_set(legacy, i);
+        } else {
+            hbitmap_set(hb, i);
+        }
+    }
+}
+
+static uint64_t run(struct hbitmap* hb, uint32_t nblocks, uint64_t ops, bool use_legacy)
+{
+    uint32_t cursor = 0;
+    uint64_t start = host_now_ns();
+
+    for (uint64_t op = 0; op < ops; ++op) {
+        uint32_t block;
+        if (use_legacy) {
+            block = legacy_find(legacy, nblocks);
+            legacy_clear(legacy, block);
+        } else {
+            block = hbitmap_find_next(hb, cursor);
+            hbitmap_clear(hb, block);
+            cursor = block + 1;
+        }
+        allocated[nallocated++] = block;
+
+        uint32_t victim = victims[op] % nallocated;
+        uint32_t freed = allocated[victim];
+        allocated[victim] = allocated[--nallocated];
+        if (use_legacy) {
+            legacy_set(legacy, freed);
+        } else {
+            hbitmap_set(hb, freed);
+        }
+    }
+
+    return host_now_ns() - start;
+}
+
+static void print_ns(uint64_t ns, uint64_t ops)
+{
+    uint64_t tenths = ns * 10 / ops;
+    printf("%6llu.%llu ns", tenths / 10, tenths % 10);
+}
+
+int host_main(int argc, char** argv)
+{
+    uint32_t nblocks = host_arg(argc > 1 ? argv[1] : NULL, 65536);
+    uint64_t ops = host_arg(argc > 2 ? argv[2] : NULL, 1000000);
+    if (!nblocks || nblocks > MAX_BLOCKS || ops > sizeof(victims) / sizeof(victims[0])) {
+        FAIL("up to %u blocks and %llu ops", MAX_BLOCKS, (uint64_t)(sizeof(victims) / sizeof(victims[0])));
+    }
+
+    host_srand(1);
+    for (unsigned i = 0; i < sizeof(check_sizes) / sizeof(check_sizes[0]); ++i) {
+        check_size(check_sizes[i]);
+    }
+    printf("hbitmapbench: %u bitmap sizes match naive bitmap\n", (unsigned)(sizeof(check_sizes) / sizeof(check_sizes[0])));
+
+    for (uint64_t op = 0; op < ops; ++op) {
+        victims[op] = host_rand();
+    }
+
+    printf("hbitmapbench: %u blocks, %llu alloc/free steps\n", nblocks, ops);
+    for (unsigned i = 0; i < sizeof(occupancies) / sizeof(occupancies[0]); ++i) {
+        unsigned occupancy = occupancies[i];
+        struct hbitmap hb;
+
+        /* Arena should never run dry, steps keep occupancy where it is */
+        fill(&hb, nblocks, occupancy, false);
+        if (nallocated == nblocks) {
+            continue;
+        }
+        uint64_t hb_ns = run(&hb, nblocks, ops, false);
+
+        fill(&hb, nblocks, occupancy, true);
+        uint64_t legacy_ns = run(&hb, nblocks, ops, true);
+
+        printf("  %2u.%u%% full: hbitmap", occupancy / 10, occupancy % 10);
+        print_ns(hb_ns, ops);
+        printf(", old scan");
+        print_ns(legacy_ns, ops);
+        printf(" per step\n");
+    }
+
+    return 0;
+}
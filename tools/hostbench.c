@@ -0,0 +1,222 @@
+/**
+ * Host benchmarks for heap, dataseg and libstd vfprintf, built with firmware flags on top of tools/hostenv.c.
+ *
+ * Usage: hostbench [ops]
+ *
+ * Heap: each arena is filled up, random blocks are freed down to an occupancy, then every step allocates a block
+ * and frees a random live one, so occupancy and scatter stay put. Throughput is ns per alloc/free pair over
+ * the whole run, PRNG included. Latency is TSC cycles per call as p50/p99/max, rdtsc overhead included.
+ * Dataseg: ns per allocation. vfprintf: ns per formatted log line and MB/s of output into a counting sink.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hostenv.h"
+#include "heap.h"
+#include "dataseg.h"
+
+/** Latency histogram has one bucket per cycle, slower calls land in the last one */
+#define LATENCY_BUCKETS 4096
+
+static const unsigned occupancies[] = { 99, 90, 50, 0 };
+
+static uint8_t* blocks[HEAP_SIZE >> HEAP_ORDER_BASE];
+static uint32_t nblocks;
+
+struct latency {
+    uint32_t hist[LATENCY_BUCKETS];
+    uint64_t max;
+    uint64_t count;
+};
+
+static struct latency alloc_latency;
+static struct latency free_latency;
+
+static void latency_add(struct latency* l, uint64_t cycles)
+{
+    l->hist[cycles < LATENCY_BUCKETS ? cycles : LATENCY_BUCKETS - 1]++;
+    l->count++;
+    if (cycles > l->max) {
+        l->max = cycles;
+    }
+}
+
+static uint64_t latency_percentile(const struct latency* l, unsigned pct)
+{
+    uint64_t target = (l->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint64_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += l->hist[i];
+        if (seen >= target) {
+            return i;
+        }
+    }
+
+    return l->max;
+}
+
+/** ns per op with one decimal */
+static void print_rate(const char* what, uint64_t ns, uint64_t ops)
+{
+    uint64_t tenths = ns * 10 / ops;
+    printf("%s %llu.%llu ns", what, tenths / 10, tenths % 10);
+}
+
+/** Allocate a block and free a random live one, which may be the new block */
+static inline void heap_step(size_t size)
+{
+    uint8_t* ptr = heap_alloc(size);
+    assert(ptr);
+
+    blocks[nblocks] = ptr;
+    uint32_t victim = host_rand() % (nblocks + 1);
+    heap_free(blocks[victim]);
+    blocks[victim] = ptr;
+}
+
+static void heap_step_timed(size_t size)
+{
+    uint64_t t0 = host_rdtsc();
+    uint8_t* ptr = heap_alloc(size);
+    uint64_t t1 = host_rdtsc();
+    assert(ptr);
+
+    blocks[nblocks] = ptr;
+    uint32_t victim = host_rand() % (nblocks + 1);
+    uint8_t* old = blocks[victim];
+    blocks[victim] = ptr;
+
+    uint64_t t2 = host_rdtsc();
+    heap_free(old);
+    uint64_t t3 = host_rdtsc();
+
+    latency_add(&alloc_latency, t1 - t0);
+    latency_add(&free_latency, t3 - t2);
+}
+
+static void bench_heap_order(unsigned order, uint64_t ops)
+{
+    size_t size = (1ul << order) - HEAP_PTR_ALIGNMENT;
+
+    /* Take the whole heap, regions other orders used are free by now */
+    nblocks = 0;
+    uint8_t* ptr;
+    while ((ptr = heap_alloc(size)) != NULL) {
+        blocks[nblocks++] = ptr;
+    }
+    uint32_t capacity = nblocks;
+
+    for (unsigned i = 0; i < sizeof(occupancies) / sizeof(occupancies[0]); ++i) {
+        uint32_t target = (uint64_t)capacity * occupancies[i] / 100;
+        while (nblocks > target) {
+            uint32_t victim = host_rand() % nblocks;
+            heap_free(blocks[victim]);
+            blocks[victim] = blocks[--nblocks];
+        }
+
+        uint64_t start = host_now_ns();
+        for (uint64_t op = 0; op < ops; ++op) {
+            heap_step(size);
+        }
+        uint64_t ns = host_now_ns() - start;
+
+        memset(&alloc_latency, 0, sizeof(alloc_latency));
+        memset(&free_latency, 0, sizeof(free_latency));
+        for (uint64_t op = 0; op < ops; ++op) {
+            heap_step_timed(size);
+        }
+
+        printf("heap order %2u %5u B, %2u%% full:", order, (unsigned)size, occupancies[i]);
+        print_rate("", ns, ops);
+        printf(" per pair, alloc p50/p99/max %llu/%llu/%llu, free %llu/%llu/%llu cycles\n",
+               latency_percentile(&alloc_latency, 50), latency_percentile(&alloc_latency, 99), alloc_latency.max,
+               latency_percentile(&free_latency, 50), latency_percentile(&free_latency, 99), free_latency.max);
+    }
+
+    while (nblocks) {
+        heap_free(blocks[--nblocks]);
+    }
+}
+
+static void bench_heap(uint64_t ops)
+{
+    init_dataseg();
+    init_heap();
+
+    for (unsigned order = HEAP_ORDER_BASE; order <= HEAP_ORDER_MAX; ++order) {
+        bench_heap_order(order, ops);
+    }
+}
+
+static void bench_dataseg(void)
+{
+    init_dataseg();
+
+    uint64_t count = DATASEG_SIZE / HEAP_PTR_ALIGNMENT;
+    uint64_t start = host_now_ns();
+    for (uint64_t i = 0; i < count; ++i) {
+        void* volatile ptr = dataseg_alloc(HEAP_PTR_ALIGNMENT);
+        (void)ptr;
+    }
+    uint64_t ns = host_now_ns() - start;
+
+    print_rate("dataseg:", ns, count);
+    printf(" per allocation, %llu allocations\n", count);
+}
+
+static uint64_t sink_bytes;
+
+static void count_putc(char c)
+{
+    (void)c;
+    sink_bytes++;
+}
+
+static void bench_format(const char* name, uint64_t ops, uint64_t ns)
+{
+    print_rate(name, ns, ops);
+    printf(" per line, %llu MB/s\n", sink_bytes * 1000 / ns);
+}
+
+static void bench_vfprintf(uint64_t ops)
+{
+    uint64_t start;
+
+    sink_bytes = 0;
+    start = host_now_ns();
+    for (uint64_t i = 0; i < ops; ++i) {
+        fprintf(count_putc, "virtio-blk: %u requests, %llu KB in %llu us\n", (unsigned)i, i << 4, i >> 2);
+    }
+    bench_format("vfprintf numbers:", ops, host_now_ns() - start);
+
+    sink_bytes = 0;
+    start = host_now_ns();
+    for (uint64_t i = 0; i < ops; ++i) {
+        fprintf(count_putc, "  order %2u %10llu B: live %u, peak %u, allocs %u, failed %u, waste %llu B\n",
+                (unsigned)(i & 15), 1ull << (i & 31), (unsigned)i, (unsigned)i * 2, (unsigned)i * 3, 0u, i * 7);
+    }
+    bench_format("vfprintf padded:", ops, host_now_ns() - start);
+
+    sink_bytes = 0;
+    start = host_now_ns();
+    for (uint64_t i = 0; i < ops; ++i) {
+        fprintf(count_putc, "acpi: %s at 0x%llx, %u bytes\n", "etc/acpi/tables", 0x7FFE0000ull + i, (unsigned)i);
+    }
+    bench_format("vfprintf strings:", ops, host_now_ns() - start);
+}
+
+int host_main(int argc, char** argv)
+{
+    uint64_t ops = host_arg(argc > 1 ? argv[1] : NULL, 1000000);
+    host_srand(1);
+
+    bench_heap(ops);
+    bench_dataseg();
+    bench_vfprintf(ops);
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hostenv.h"
+#include "cpu.h"
+#include "logring.h"
+#include "page_alloc.h"
+#include "scrub.h"
+#include "logging.h"
+
+#define SYS_WRITE           1
+#define SYS_MMAP            9
+#define SYS_CLOCK_GETTIME   228
+#define SYS_EXIT_GROUP      231
+
+#define PROT_RW             3
+#define MAP_PRIVATE         0x02
+#define MAP_ANONYMOUS       0x20
+#define MAP_FIXED_NOREPLACE 0x100000
+
+#define CLOCK_MONOTONIC     1
+
+#define XCR0_SSE            (1ul << 1)
+#define XCR0_AVX            (1ul << 2)
+
+#define HOST_OUT_SIZE       (64ul << 10)
+
+/** Entry: argc is on top of the stack, argv follows it */
+__asm__(
+    ".globl _start\n"
+    "_start:\n"
+    "    xor %rbp, %rbp\n"
+    "    mov %rsp, %rdi\n"
+    "    and $-16, %rsp\n"
+    "    call host_start\n"
+    "    ud2\n"
+);
+
+static struct {
+    size_t len;
+    char buf[HOST_OUT_SIZE];
+} host_out;
+
+static uint64_t host_rand_state = 1;
+
+const char* host_name = "host";
+unsigned host_checks;
+
+struct cpu_info cpu_info_cache;
+
+static inline long syscall6(long nr, long a0, long a1, long a2, long a3, long a4, long a5)
+{
+    register long r10 __asm__("r10") = a3;
+    register long r8 __asm__("r8") = a4;
+    register long r9 __asm__("r9") = a5;
+    long res;
+    __asm__ volatile ("syscall"
+                      :"=a"(res)
+                      :"a"(nr), "D"(a0), "S"(a1), "d"(a2), "r"(r10), "r"(r8), "r"(r9)
+                      :"rcx", "r11", "memory");
+    return res;
+}
+
+void host_flush(void)
+{
+    size_t pos = 0;
+    while (pos < host_out.len) {
+        long res = syscall6(SYS_WRITE, 1, (long)&host_out.buf[pos], host_out.len - pos, 0, 0, 0);
+        if (res <= 0) {
+            break;
+        }
+        pos += res;
+    }
+
+    host_out.len = 0;
+}
+
+void host_exit(int code)
+{
+    host_flush();
+    syscall6(SYS_EXIT_GROUP, code, 0, 0, 0, 0, 0);
+    __builtin_unreachable();
+}
+
+/** stdio sink, vfprintf points stdout and stderr at it */
+void log_ring_putc(char c)
+{
+    if (host_out.len == HOST_OUT_SIZE) {
+        host_flush();
+    }
+
+    host_out.buf[host_out.len++] = c;
+}
+
+void _assert(const char* file, unsigned long line, const char* reason)
+{
+    LOG_ERROR("Assertion \"%s\" failed at file %s, line %u\n", reason, file, line);
+    abort();
+}
+
+void abort(void)
+{
+    LOG_ERROR("abort\n");
+    host_exit(134);
+}
+
+void host_map(uintptr_t base, size_t size)
+{
+    long res = syscall6(SYS_MMAP, base, size, PROT_RW, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if ((uintptr_t)res != base) {
+        LOG_ERROR("host: can't map %llu KB at 0x%llx\n", (uint64_t)size >> 10, (uint64_t)base);
+        abort();
+    }
+
+    /* Fault pages in now, so that first touches don't show up in benchmarks */
+    memset((void*)base, 0, size);
+}
+
+uint64_t host_now_ns(void)
+{
+    struct {
+        int64_t sec;
+        int64_t nsec;
+    } ts;
+
+    syscall6(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (long)&ts, 0, 0, 0, 0);
+    return ts.sec * 1000000000ull + ts.nsec;
+}
+
+void host_srand(uint64_t seed)
+{
+    host_rand_state = seed ? seed : 1;
+}
+
+uint64_t host_rand(void)
+{
+    host_rand_state ^= host_rand_state >> 12;
+    host_rand_state ^= host_rand_state << 25;
+    host_rand_state ^= host_rand_state >> 27;
+    return host_rand_state * 0x2545F4914F6CDD1Dull;
+}
+
+uint64_t host_arg(const char* s, uint64_t def)
+{
+    if (!s) {
+        return def;
+    }
+
+    unsigned base = 10;
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+
+    uint64_t val = 0;
+    for (; *s; ++s) {
+        unsigned digit;
+        if (*s >= '0' && *s <= '9') {
+            digit = *s - '0';
+        } else if (base == 16 && *s >= 'a' && *s <= 'f') {
+            digit = *s - 'a' + 10;
+        } else if (base == 16 && *s >= 'A' && *s <= 'F') {
+            digit = *s - 'A' + 10;
+        } else {
+            LOG_ERROR("host: bad number argument\n");
+            host_exit(2);
+        }
+        val = val * base + digit;
+    }
+
+    return val;
+}
+
+/** Same words init_cpu caches, AVX bits are dropped unless host kernel has enabled AVX state */
+static void host_cpuid(void)
+{
+    struct cpu_info* info = &cpu_info_cache;
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &info->max_leaf, &ebx, &ecx, &edx);
+    cpuid(0x80000000, 0, &info->max_ext_leaf, &ebx, &ecx, &edx);
+    cpuid(1, 0, &eax, &ebx, &info->words[CPU_WORD_1_ECX], &info->words[CPU_WORD_1_EDX]);
+
+    if (info->max_leaf >= 7) {
+        cpuid(7, 0, &eax, &info->words[CPU_WORD_7_EBX], &info->words[CPU_WORD_7_ECX], &info->words[CPU_WORD_7_EDX]);
+    }
+    if (info->max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &info->words[CPU_WORD_81_ECX], &info->words[CPU_WORD_81_EDX]);
+    }
+
+    bool avx = false;
+    if (cpu_has(CPU_FEATURE_OSXSAVE)) {
+        uint32_t lo, hi;
+        __asm__ volatile ("xgetbv" :"=a"(lo), "=d"(hi) :"c"(0) :);
+        avx = (lo & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX);
+    }
+    if (!avx) {
+        info->words[CPU_FEATURE_AVX >> 5] &= ~(1u << (CPU_FEATURE_AVX & 31));
+        info->words[CPU_FEATURE_AVX2 >> 5] &= ~(1u << (CPU_FEATURE_AVX2 & 31));
+    }
+}
+
+void host_start(uint64_t* sp) __attribute__((noreturn));
+void host_start(uint64_t* sp)
+{
+    host_cpuid();
+
+    char** argv = (char**)(sp + 1);
+    if (sp[0] && argv[0]) {
+        host_name = argv[0];
+        for (const char* p = argv[0]; *p; ++p) {
+            if (*p == '/') {
+                host_name = p + 1;
+            }
+        }
+    }
+
+#if defined(HEAP_BASE) && defined(HEAP_SIZE)
+    host_map(HEAP_BASE, HEAP_SIZE);
+#endif
+#if defined(DATASEG_BASE) && defined(DATASEG_SIZE)
+    host_map(DATASEG_BASE, DATASEG_SIZE);
+#endif
+
+    host_exit(host_main((int)sp[0], argv));
+}
+
+/**
+ * Rest of the firmware that host modules reach
+ */
+
+/** Heap and dataseg are pinned, page allocator is not part of host builds */
+void pages_report(void)
+{
+}
+
+struct scrub_stats scrub_ranges(const struct scrub_range* ranges, size_t count, uint8_t pattern)
+{
+    struct scrub_stats stats = { 0, 0 };
+    uint64_t start = host_now_ns();
+
+    for (size_t i = 0; i < count; ++i) {
+        memset((void*)ranges[i].base, pattern, ranges[i].size);
+        stats.bytes += ranges[i].size;
+    }
+
+    stats.ns = host_now_ns() - start;
+    return stats;
+}
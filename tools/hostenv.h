@@ -0,0 +1,77 @@
+/**
+ * Linux userspace environment for firmware modules.
+ * Host tests and benchmarks are built from the same sources and with the same flags as the ROM: against libstd headers,
+ * without host libc. This stands in for the rest of the firmware: process entry and raw system calls,
+ * HEAP_ and DATASEG_ regions mapped at the addresses build defines pin them to,
+ * stdio and logging going to a memory buffer instead of the log ring and debugcon,
+ * and CPUID feature cache filled from the host CPU, so memory routines dispatch the way they would on it.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * Tool entry point, called once the environment is set up.
+ * Return value is the process exit code.
+ */
+int host_main(int argc, char** argv);
+
+/**
+ * Tool name, argv[0] without directories
+ */
+extern const char* host_name;
+
+/**
+ * Number of CHECKs evaluated so far
+ */
+extern unsigned host_checks;
+
+/**
+ * Test assertion: failing one prints tool name, location and message, then exits with 1
+ */
+#define CHECK(cond, msg, ...) { \
+    host_checks++; \
+    if (!(cond)) { \
+        printf("%s: %s:%u: " msg "\n", host_name, __FILE__, __LINE__, ## __VA_ARGS__); \
+        host_exit(1); \
+    } \
+}
+
+/**
+ * Map anonymous RW memory at a fixed address and fault it in, aborts if anything is mapped there already
+ */
+void host_map(uintptr_t base, size_t size);
+
+/**
+ * CLOCK_MONOTONIC in ns
+ */
+uint64_t host_now_ns(void);
+
+static inline uint64_t host_rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" :"=a"(lo), "=d"(hi) ::);
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Write out stdio buffer to fd 1.
+ * Buffer is also flushed when it fills up and on exit.
+ */
+void host_flush(void);
+
+void host_exit(int code) __attribute__((noreturn));
+
+/**
+ * xorshift64* PRNG, deterministic for a given seed
+ */
+void host_srand(uint64_t seed);
+uint64_t host_rand(void);
+
+/**
+ * Parse decimal or 0x-prefixed number from command line, returns def if s is NULL
+ */
+uint64_t host_arg(const char* s, uint64_t def);
@@ -0,0 +1,320 @@
+/**
+ * Host tests for heap, dataseg and libstd vfprintf, built with firmware flags on top of tools/hostenv.c.
+ *
+ * Usage: hosttest [seed] [steps]
+ *
+ * vfprintf output is compared against expected strings for every flag, width and length modifier it supports.
+ * Dataseg allocations are checked for alignment and packing. Heap runs a randomized alloc/free stress:
+ * every block is checked against a shadow map of the heap for overlaps and alignment, and filled with a tag
+ * that is verified on free. Once everything is freed, each arena should be able to take the whole heap.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hostenv.h"
+#include "heap.h"
+#include "dataseg.h"
+
+/** Largest request a heap block can serve, its header takes the rest */
+#define HEAP_MAX_REQUEST ((1ul << HEAP_ORDER_MAX) - HEAP_PTR_ALIGNMENT)
+
+#define STRESS_MAX_LIVE 16384
+
+/** Fill bias flips every this many steps, so heap keeps filling up and draining */
+#define STRESS_PHASE    20000
+
+/**
+ * vfprintf
+ */
+
+static struct {
+    size_t len;
+    char buf[256];
+} capture;
+
+static void capture_putc(char c)
+{
+    if (capture.len < sizeof(capture.buf) - 1) {
+        capture.buf[capture.len++] = c;
+    }
+}
+
+static void check_format(const char* expected, const char* format, ...)
+{
+    capture.len = 0;
+
+    va_list ap;
+    va_start(ap, format);
+    int res = vfprintf(capture_putc, format, ap);
+    va_end(ap);
+
+    capture.buf[capture.len] = '\0';
+    CHECK(!strncmp(capture.buf, expected, sizeof(capture.buf)) && res == (int)strlen(expected),
+          "format \"%s\": got \"%s\" (%d), expected \"%s\"", format, capture.buf, res, expected);
+}
+
+static void test_vfprintf(void)
+{
+    check_format("", "");
+    check_format("plain text", "plain text");
+    check_format("100%", "100%%");
+
+    check_format("0", "%d", 0);
+    check_format("42", "%d", 42);
+    check_format("-42", "%i", -42);
+    check_format("-2147483648", "%d", (int)0x80000000);
+    check_format("4294967295", "%u", 0xFFFFFFFFu);
+    check_format("deadbeef", "%x", 0xDEADBEEFu);
+    check_format("DEADBEEF", "%X", 0xDEADBEEFu);
+    check_format("0x1f", "%#x", 0x1Fu);
+    check_format("755", "%o", 0755u);
+    check_format("0X1F", "%#X", 0x1Fu);
+    check_format("0755", "%#o", 0755u);
+    check_format("0", "%#o", 0u);
+    check_format("+42", "%+d", 42);
+
+    check_format("-9223372036854775808", "%lld", (long long)0x8000000000000000ull);
+    check_format("18446744073709551615", "%llu", ~0ull);
+    check_format("ffffffffffffffff", "%llx", ~0ull);
+    check_format("123456789012", "%lu", 123456789012ul);
+    check_format("4096", "%zu", (size_t)4096);
+    check_format("ff", "%hhx", 0x1FFu);
+    check_format("-1", "%hhd", 0xFF);
+    check_format("ffff", "%hx", 0xFFFFFu);
+
+    check_format("   42", "%5d", 42);
+    check_format("42   |", "%-5d|", 42);
+    check_format("00042", "%05d", 42);
+    check_format("0000beef", "%08x", 0xBEEFu);
+    check_format("  -42", "%5d", -42);
+    check_format("12345", "%3d", 12345);
+    check_format("      0x1f", "%#10x", 0x1Fu);
+
+    check_format("abc", "%s", "abc");
+    check_format("", "%s", "");
+    check_format("       abc", "%10s", "abc");
+    check_format("abc       |", "%-10s|", "abc");
+    check_format("x", "%c", 'x');
+
+    check_format("dataseg: 0x48000000, 256 KB", "dataseg: 0x%llx, %llu KB", 0x48000000ull, 256ull);
+    check_format("  order  6         64 B: live 3",
+                 "  order %2u %10llu B: live %u", 6u, 64ull, 3u);
+    check_format("virtio  ok", "%-8s%s", "virtio", "ok");
+}
+
+/**
+ * Dataseg
+ */
+
+static void test_dataseg(void)
+{
+    init_dataseg();
+
+    uintptr_t next = DATASEG_BASE;
+    size_t used = 0;
+    for (;;) {
+        size_t size = host_rand() % 300;
+        size_t aligned = (size + HEAP_PTR_ALIGNMENT - 1) & ~(HEAP_PTR_ALIGNMENT - 1);
+        if (used + aligned > DATASEG_SIZE) {
+            break;
+        }
+
+        uintptr_t ptr = (uintptr_t)dataseg_alloc(size);
+        CHECK(ptr == next, "dataseg: allocation at 0x%llx, expected 0x%llx", (uint64_t)ptr, (uint64_t)next);
+        memset((void*)ptr, 0xA5, size);
+
+        next += aligned;
+        used += aligned;
+    }
+
+    dataseg_report();
+}
+
+/**
+ * Heap
+ */
+
+struct live_block {
+    uint8_t* ptr;
+    uint32_t size;
+    uint8_t tag;
+};
+
+static struct live_block live[STRESS_MAX_LIVE];
+static uint32_t nlive;
+
+/** Which live block + 1 covers each smallest heap block, 0 for none */
+static uint16_t shadow[HEAP_SIZE >> HEAP_ORDER_BASE];
+
+_Static_assert(STRESS_MAX_LIVE < 0xFFFF, "Shadow map entries are 16-bit");
+
+static unsigned block_order(size_t size)
+{
+    unsigned order = HEAP_ORDER_BASE;
+    while ((1ul << order) < size + HEAP_PTR_ALIGNMENT) {
+        ++order;
+    }
+
+    return order;
+}
+
+static void shadow_mark(uint8_t* ptr, size_t size, uint16_t owner)
+{
+    unsigned order = block_order(size);
+    uintptr_t block = (uintptr_t)ptr - HEAP_PTR_ALIGNMENT;
+    uintptr_t offset = block - HEAP_BASE;
+
+    CHECK(block >= HEAP_BASE && offset + (1ul << order) <= HEAP_SIZE, "heap: block 0x%llx is outside heap",
+          (uint64_t)block);
+    CHECK((offset & ((1ul << order) - 1)) == 0, "heap: block 0x%llx is not aligned to order %u",
+          (uint64_t)block, order);
+
+    uint16_t overlap = 0;
+    for (uintptr_t i = offset >> HEAP_ORDER_BASE; i < (offset + (1ul << order)) >> HEAP_ORDER_BASE; ++i) {
+        if (owner && shadow[i]) {
+            overlap = shadow[i];
+        }
+        shadow[i] = owner;
+    }
+    CHECK(!overlap, "heap: block 0x%llx overlaps live block %u", (uint64_t)block, overlap - 1);
+}
+
+static size_t random_size(void)
+{
+    uint64_t r = host_rand();
+    switch (r % 16) {
+    case 0:
+        return 0;
+    case 1:
+        return HEAP_MAX_REQUEST;
+    case 2:
+    case 3:
+    case 4:
+        return (r >> 8) % (HEAP_MAX_REQUEST + 1);
+    case 5:
+    case 6:
+    case 7:
+        return (r >> 8) % 249;
+    default:
+        return (r >> 8) % 57;
+    }
+}
+
+static void stress_alloc(void)
+{
+    size_t size = random_size();
+    uint8_t* ptr = heap_alloc(size);
+    if (!ptr) {
+        return;
+    }
+
+    CHECK(((uintptr_t)ptr & (HEAP_PTR_ALIGNMENT - 1)) == 0, "heap: 0x%llx is misaligned", (uint64_t)(uintptr_t)ptr);
+
+    uint32_t slot = nlive++;
+    shadow_mark(ptr, size, slot + 1);
+
+    uint8_t tag = (uint8_t)(host_rand() | 1);
+    memset(ptr, tag, size);
+    live[slot] = (struct live_block){ ptr, size, tag };
+}
+
+static void stress_free(uint32_t slot)
+{
+    struct live_block* b = &live[slot];
+    uint32_t i = 0;
+    while (i < b->size && b->ptr[i] == b->tag) {
+        ++i;
+    }
+    CHECK(i == b->size, "heap: block 0x%llx byte %u was overwritten", (uint64_t)(uintptr_t)b->ptr, i);
+
+    shadow_mark(b->ptr, b->size, 0);
+    heap_free(b->ptr);
+
+    /* Last live block takes the freed slot, its shadow entries follow it */
+    if (slot != --nlive) {
+        live[slot] = live[nlive];
+        shadow_mark(live[slot].ptr, live[slot].size, 0);
+        shadow_mark(live[slot].ptr, live[slot].size, slot + 1);
+    }
+}
+
+/** After everything is freed an arena of any order should be able to take every region */
+static void check_drained(void)
+{
+    for (unsigned order = HEAP_ORDER_BASE; order <= HEAP_ORDER_MAX; ++order) {
+        /* Blocks are chained through their first word */
+        uint8_t* chain = NULL;
+        size_t count = 0;
+        uint8_t* ptr;
+        while ((ptr = heap_alloc((1ul << order) - HEAP_PTR_ALIGNMENT)) != NULL) {
+            *(uint8_t**)ptr = chain;
+            chain = ptr;
+            ++count;
+        }
+
+        CHECK(count == HEAP_SIZE >> order, "heap: order %u arena got %llu blocks of %llu",
+              order, (uint64_t)count, (uint64_t)(HEAP_SIZE >> order));
+
+        while (chain) {
+            ptr = chain;
+            chain = *(uint8_t**)ptr;
+            heap_free(ptr);
+        }
+    }
+}
+
+static void test_heap(uint64_t steps)
+{
+    init_dataseg();
+    init_heap();
+
+    CHECK(heap_alloc(HEAP_MAX_REQUEST + 1) == NULL, "heap: oversized request succeeded");
+    heap_free(NULL);
+
+    uint64_t failed = 0;
+    uint32_t peak = 0;
+    for (uint64_t step = 0; step < steps; ++step) {
+        unsigned bias = (step / STRESS_PHASE) & 1 ? 30 : 75;
+        if (nlive < STRESS_MAX_LIVE && (nlive == 0 || host_rand() % 100 < bias)) {
+            uint32_t before = nlive;
+            stress_alloc();
+            failed += nlive == before;
+        } else {
+            stress_free(host_rand() % nlive);
+        }
+
+        if (nlive > peak) {
+            peak = nlive;
+        }
+    }
+
+    while (nlive) {
+        stress_free(nlive - 1);
+    }
+
+    for (size_t i = 0; i < sizeof(shadow) / sizeof(shadow[0]); ++i) {
+        CHECK(shadow[i] == 0, "heap: shadow map is not empty");
+    }
+
+    printf("hosttest: %llu heap steps, %u peak live blocks, %llu failed allocations\n", steps, peak, failed);
+    heap_report();
+
+    check_drained();
+}
+
+int host_main(int argc, char** argv)
+{
+    uint64_t seed = host_arg(argc > 1 ? argv[1] : NULL, 1);
+    uint64_t steps = host_arg(argc > 2 ? argv[2] : NULL, 2000000);
+    host_srand(seed);
+
+    test_vfprintf();
+    test_dataseg();
+    test_heap(steps);
+
+    printf("%s: seed %llu, %u checks passed\n", host_name, seed, host_checks);
+    return 0;
+}
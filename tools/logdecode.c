@@ -0,0 +1,234 @@
+/**
+ * Host-side decoder for tokenized boot log (LOG_TOKENIZED=1).
+ *
+ * Usage: logdecode bootleg.elf64 log.bin
+ *
+ * log.bin is either raw debugcon output, or a memory dump starting at log ring header
+ * (see include/logring.h), in which case ring data is unwrapped starting from the oldest byte.
+ * Format strings are read from .logfmt section of the ELF image, %s arguments are resolved
+ * against loadable sections of the same image, so only strings that live in ROM can be printed.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "logring.h"
+
+struct image {
+    const uint8_t* data;
+    size_t size;
+    const char* fmt;
+    size_t fmt_size;
+};
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* buf = malloc(*size + 1);
+    if (!buf || fread(buf, 1, *size, f) != *size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(f);
+    return buf;
+}
+
+/* bootleg.elf64 is elf32-x86-64 */
+static const Elf32_Shdr* section(const struct image* img, unsigned i)
+{
+    const Elf32_Ehdr* eh = (const Elf32_Ehdr*)img->data;
+    return (const Elf32_Shdr*)(img->data + eh->e_shoff + i * eh->e_shentsize);
+}
+
+static void load_image(struct image* img, const char* path)
+{
+    img->data = read_file(path, &img->size);
+
+    const Elf32_Ehdr* eh = (const Elf32_Ehdr*)img->data;
+    if (img->size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS32) {
+        fprintf(stderr, "%s: not an elf32 image\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    const char* names = (const char*)img->data + section(img, eh->e_shstrndx)->sh_offset;
+    for (unsigned i = 0; i < eh->e_shnum; ++i) {
+        const Elf32_Shdr* sh = section(img, i);
+        if (!strcmp(names + sh->sh_name, ".logfmt")) {
+            img->fmt = (const char*)img->data + sh->sh_offset;
+            img->fmt_size = sh->sh_size;
+            return;
+        }
+    }
+
+    fprintf(stderr, "%s: no .logfmt section, was it built with LOG_TOKENIZED=1?\n", path);
+    exit(EXIT_FAILURE);
+}
+
+/** Find string at guest address in loadable sections */
+static const char* image_string(const struct image* img, uint64_t addr)
+{
+    const Elf32_Ehdr* eh = (const Elf32_Ehdr*)img->data;
+    for (unsigned i = 0; i < eh->e_shnum; ++i) {
+        const Elf32_Shdr* sh = section(img, i);
+        if ((sh->sh_flags & SHF_ALLOC) && sh->sh_type == SHT_PROGBITS &&
+            addr >= sh->sh_addr && addr < (uint64_t)sh->sh_addr + sh->sh_size) {
+            const char* s = (const char*)img->data + sh->sh_offset + (addr - sh->sh_addr);
+            if (memchr(s, '\0', sh->sh_addr + sh->sh_size - addr)) {
+                return s;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/** Print one message, conversions are handed to host printf one at a time with 64-bit arguments */
+static void print_message(const struct image* img, const char* fmt, const uint64_t* args, unsigned nargs)
+{
+    unsigned next = 0;
+
+    while (*fmt) {
+        if (*fmt != '%') {
+            putchar(*fmt++);
+            continue;
+        }
+
+        const char* start = fmt++;
+        if (*fmt == '%') {
+            putchar('%');
+            fmt++;
+            continue;
+        }
+
+        fmt += strspn(fmt, "-+ #0123456789.");
+        size_t speclen = fmt - start;
+        fmt += strspn(fmt, "hlzjt");
+
+        char conv = *fmt;
+        if (!conv) {
+            break;
+        }
+        fmt++;
+
+        char spec[64];
+        if (speclen > sizeof(spec) - 4) {
+            speclen = sizeof(spec) - 4;
+        }
+        memcpy(spec, start, speclen);
+
+        uint64_t arg = next < nargs ? args[next] : 0;
+        next++;
+
+        switch (conv) {
+        case 's': {
+            const char* s = image_string(img, arg);
+            if (s) {
+                spec[speclen] = 's';
+                spec[speclen + 1] = '\0';
+                printf(spec, s);
+            } else {
+                printf("<%#llx>", (unsigned long long)arg);
+            }
+            break;
+        }
+        case 'c':
+            spec[speclen] = 'c';
+            spec[speclen + 1] = '\0';
+            printf(spec, (int)arg);
+            break;
+        case 'p':
+            printf("%#llx", (unsigned long long)arg);
+            break;
+        default:
+            spec[speclen] = 'l';
+            spec[speclen + 1] = 'l';
+            spec[speclen + 2] = conv;
+            spec[speclen + 3] = '\0';
+            printf(spec, (unsigned long long)arg);
+            break;
+        }
+    }
+}
+
+/** Valid tag points to the beginning of a format string */
+static int valid_tag(const struct image* img, uint32_t tag)
+{
+    uint32_t id = tag >> LOG_TOKEN_NARGS_BITS;
+    unsigned nargs = tag & ((1u << LOG_TOKEN_NARGS_BITS) - 1);
+    return nargs <= LOG_TOKEN_MAX_ARGS && id < img->fmt_size && img->fmt[id] != '\0' && (id == 0 || img->fmt[id - 1] == '\0');
+}
+
+static void decode(const struct image* img, const uint8_t* buf, size_t size)
+{
+    size_t pos = 0;
+    while (pos + sizeof(uint32_t) <= size) {
+        uint32_t tag;
+        memcpy(&tag, buf + pos, sizeof(tag));
+
+        /* Oldest record may have been partially overwritten in a ring dump, resync on next valid tag */
+        if (!valid_tag(img, tag)) {
+            pos++;
+            continue;
+        }
+
+        unsigned nargs = tag & ((1u << LOG_TOKEN_NARGS_BITS) - 1);
+        uint64_t args[LOG_TOKEN_MAX_ARGS];
+        if (pos + sizeof(tag) + nargs * sizeof(uint64_t) > size) {
+            break;
+        }
+        memcpy(args, buf + pos + sizeof(tag), nargs * sizeof(uint64_t));
+        pos += sizeof(tag) + nargs * sizeof(uint64_t);
+
+        print_message(img, img->fmt + (tag >> LOG_TOKEN_NARGS_BITS), args, nargs);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s bootleg.elf64 log.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct image img;
+    load_image(&img, argv[1]);
+
+    size_t size;
+    uint8_t* buf = read_file(argv[2], &size);
+
+    struct log_ring ring;
+    if (size >= sizeof(ring) && (memcpy(&ring, buf, sizeof(ring)), ring.magic == LOG_RING_MAGIC)) {
+        const uint8_t* data = buf + sizeof(ring);
+        size_t avail = size - sizeof(ring);
+        size_t used = ring.head < ring.size ? ring.head : ring.size;
+        if (used > avail || ring.size > avail) {
+            fprintf(stderr, "%s: truncated log ring dump\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+
+        /* Unwrap ring so that oldest byte goes first */
+        uint8_t* lin = malloc(used);
+        size_t start = (ring.head - used) & (ring.size - 1);
+        size_t first = used < ring.size - start ? used : ring.size - start;
+        memcpy(lin, data + start, first);
+        memcpy(lin + first, data, used - first);
+        decode(&img, lin, used);
+    } else {
+        decode(&img, buf, size);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * Host-side benchmark for libstd LZ4 frame decoder (see include/libstd/lz4.h).
+ *
+ * Usage: lz4bench payload.lz4 [payload] [chunk size]
+ *
+ * Frame is decoded three ways: in one call, fed in chunks (64K by default) the way transfer paths deliver it,
+ * and in place from the tail of a single LZ4_INPLACE_BUFFER_SIZE buffer. Each is repeated for at least a second
+ * and reported in GB/s of decoded output. If the original payload is given, every result is compared against it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lz4.h"
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* buf = malloc(*size + 1);
+    if (!buf || fread(buf, 1, *size, f) != *size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(f);
+    return buf;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t decode_once(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size)
+{
+    return lz4_decode(dst, dst_size, src, src_size);
+}
+
+static size_t decode_chunked(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, size_t chunk)
+{
+    struct lz4_stream s;
+    lz4_init(&s, dst, dst_size);
+
+    for (size_t pos = 0; pos < src_size && !lz4_done(&s); pos += chunk) {
+        size_t n = src_size - pos < chunk ? src_size - pos : chunk;
+        if (lz4_feed(&s, src + pos, n) == LZ4_ERROR) {
+            return LZ4_ERROR;
+        }
+    }
+
+    return lz4_done(&s) ? lz4_decoded_size(&s) : LZ4_ERROR;
+}
+
+/** Compressed frame is copied to the tail of buf, as a transfer path would place it, then decoded to its start */
+static size_t decode_inplace(uint8_t* buf, size_t buf_size, const uint8_t* src, size_t src_size, size_t chunk)
+{
+    uint8_t* in = buf + buf_size - src_size;
+    memcpy(in, src, src_size);
+    return decode_chunked(buf, buf_size, in, src_size, chunk);
+}
+
+static void check(const char* what, size_t size, const uint8_t* out, const uint8_t* ref, size_t ref_size)
+{
+    if (size == LZ4_ERROR) {
+        fprintf(stderr, "%s: decode failed\n", what);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ref && (size != ref_size || memcmp(out, ref, size))) {
+        fprintf(stderr, "%s: output does not match original\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s payload.lz4 [payload] [chunk size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t src_size;
+    uint8_t* src = read_file(argv[1], &src_size);
+
+    size_t ref_size = 0;
+    uint8_t* ref = argc > 2 ? read_file(argv[2], &ref_size) : NULL;
+    size_t chunk = argc > 3 ? strtoull(argv[3], NULL, 0) : (64 << 10);
+    if (!chunk) {
+        chunk = 64 << 10;
+    }
+
+    uint64_t decoded = lz4_content_size(src, src_size);
+    if (!decoded) {
+        decoded = ref ? ref_size : src_size * 8;
+    }
+
+    size_t buf_size = LZ4_INPLACE_BUFFER_SIZE(decoded);
+    if (buf_size < src_size) {
+        buf_size = src_size;
+    }
+    uint8_t* dst = malloc(buf_size);
+    uint8_t* inplace = malloc(buf_size);
+
+    const char* names[] = { "one call", "chunked", "in place" };
+    for (int mode = 0; mode < 3; ++mode) {
+        size_t size = 0;
+        unsigned iters = 0;
+        double start = now_s();
+        double elapsed;
+
+        do {
+            uint8_t* out = mode == 2 ? inplace : dst;
+            if (mode == 0) {
+                size = decode_once(out, buf_size, src, src_size);
+            } else if (mode == 1) {
+                size = decode_chunked(out, buf_size, src, src_size, chunk);
+            } else {
+                size = decode_inplace(out, buf_size, src, src_size, chunk);
+            }
+            check(names[mode], size, out, ref, ref_size);
+            ++iters;
+            elapsed = now_s() - start;
+        } while (elapsed < 1.0);
+
+        printf("%-8s: %zu -> %zu bytes, %u runs, %.2f GB/s\n",
+               names[mode], src_size, size, iters, (double)size * iters / elapsed / 1e9);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/**
+ * Host-side symbolizer for sampling profiler output (PROFILE=1, see include/profile.h).
+ *
+ * Usage: profsym bootleg.elf64.map debugcon.log
+ *
+ * Histogram buckets are taken from "profile: 0x<addr> <count>" log lines (decode tokenized logs with
+ * tools/logdecode first) and attributed to the nearest global symbol at or below bucket address
+ * found in the linker map. Static functions are not in the map, their samples go to the preceding global symbol.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+struct symbol {
+    unsigned long long addr;
+    unsigned long long samples;
+    char name[64];
+};
+
+static struct symbol* symbols;
+static size_t nsymbols;
+
+static int by_addr(const void* a, const void* b)
+{
+    const struct symbol* x = a;
+    const struct symbol* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int by_samples(const void* a, const void* b)
+{
+    const struct symbol* x = a;
+    const struct symbol* y = b;
+    return x->samples > y->samples ? -1 : x->samples < y->samples;
+}
+
+static FILE* open_file(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    return f;
+}
+
+/** Symbol lines in ld map are just an address followed by a name */
+static void load_map(const char* path)
+{
+    FILE* f = open_file(path);
+    size_t cap = 0;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long addr;
+        char name[64], extra[2];
+        if (sscanf(line, " 0x%llx %63s %1s", &addr, name, extra) != 2) {
+            continue;
+        }
+        if (!isalpha((unsigned char)name[0]) && name[0] != '_') {
+            continue;
+        }
+
+        if (nsymbols == cap) {
+            cap = cap ? cap * 2 : 256;
+            symbols = realloc(symbols, cap * sizeof(*symbols));
+        }
+        symbols[nsymbols].addr = addr;
+        symbols[nsymbols].samples = 0;
+        strcpy(symbols[nsymbols].name, name);
+        nsymbols++;
+    }
+
+    fclose(f);
+
+    if (!nsymbols) {
+        fprintf(stderr, "%s: no symbols found\n", path);
+        exit(EXIT_FAILURE);
+    }
+    qsort(symbols, nsymbols, sizeof(*symbols), by_addr);
+}
+
+static struct symbol* find_symbol(unsigned long long addr)
+{
+    size_t lo = 0, hi = nsymbols;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbols[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo ? &symbols[lo - 1] : NULL;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s bootleg.elf64.map debugcon.log\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    load_map(argv[1]);
+
+    FILE* f = open_file(argv[2]);
+    unsigned long long total = 0, unknown = 0;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        const char* p = strstr(line, "profile: 0x");
+        unsigned long long addr, count;
+        if (!p || sscanf(p, "profile: 0x%llx %llu", &addr, &count) != 2) {
+            continue;
+        }
+
+        struct symbol* sym = find_symbol(addr);
+        if (sym) {
+            sym->samples += count;
+        } else {
+            unknown += count;
+        }
+        total += count;
+    }
+
+    fclose(f);
+
+    if (!total) {
+        fprintf(stderr, "%s: no profile samples, was it built with PROFILE=1?\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    qsort(symbols, nsymbols, sizeof(*symbols), by_samples);
+    for (size_t i = 0; i < nsymbols && symbols[i].samples; ++i) {
+        printf("%6.2f%% %10llu  %s\n", 100.0 * symbols[i].samples / total, symbols[i].samples, symbols[i].name);
+    }
+    if (unknown) {
+        printf("%6.2f%% %10llu  <unknown>\n", 100.0 * unknown / total, unknown);
+    }
+
+    return EXIT_SUCCESS;
+}
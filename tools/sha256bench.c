@@ -0,0 +1,245 @@
+/**
+ * Host-side known-answer tests and benchmark for libstd SHA-256 (see include/libstd/sha256.h).
+ *
+ * Usage: sha256bench [size in MB]
+ *
+ * Every implementation the host CPU can run is selected in turn by editing the cached CPUID words
+ * libstd dispatches on. Each one is checked against FIPS 180-2 vectors, against portable code for random
+ * sizes fed in random chunks, and then timed: single stream over one buffer, multi-buffer over 8 buffers
+ * of the same total size. Results are in GB/s of hashed input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "sha256.h"
+
+struct cpu_info cpu_info_cache;
+
+static struct cpu_info host_cpu;
+
+enum impl {
+    IMPL_C,
+    IMPL_SHA_NI,
+    IMPL_AVX2,
+
+    IMPL_COUNT
+};
+
+static const char* impl_names[IMPL_COUNT] = { "c", "sha-ni", "avx2 x8" };
+
+static const struct {
+    const char* msg;
+    size_t repeat;
+    const char* digest;
+} vectors[] = {
+    { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrs"
+      "mnopqrstnopqrstu", 1, "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static void host_cpuid(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &host_cpu.max_leaf, &ebx, &ecx, &edx);
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    host_cpu.words[CPU_WORD_1_ECX] = ecx;
+    host_cpu.words[CPU_WORD_1_EDX] = edx;
+
+    if (host_cpu.max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        host_cpu.words[CPU_WORD_7_EBX] = ebx;
+        host_cpu.words[CPU_WORD_7_ECX] = ecx;
+        host_cpu.words[CPU_WORD_7_EDX] = edx;
+    }
+}
+
+static void clear_feature(enum cpu_feature feature)
+{
+    cpu_info_cache.words[feature >> 5] &= ~(1u << (feature & 31));
+}
+
+/** Point libstd dispatch at impl, returns false if host cannot run it */
+static bool select_impl(enum impl impl)
+{
+    cpu_info_cache = host_cpu;
+
+    switch (impl) {
+    case IMPL_C:
+        clear_feature(CPU_FEATURE_SHA);
+        clear_feature(CPU_FEATURE_AVX2);
+        return true;
+    case IMPL_SHA_NI:
+        return cpu_has(CPU_FEATURE_SHA) && cpu_has(CPU_FEATURE_SSSE3);
+    case IMPL_AVX2:
+        clear_feature(CPU_FEATURE_SHA);
+        return cpu_has(CPU_FEATURE_AVX2);
+    default:
+        return false;
+    }
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void hex(const uint8_t* digest, char* out)
+{
+    for (int i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+        sprintf(out + i * 2, "%02x", digest[i]);
+    }
+}
+
+static void fail(enum impl impl, const char* what, size_t size)
+{
+    fprintf(stderr, "%s: %s mismatch, size %zu\n", impl_names[impl], what, size);
+    exit(EXIT_FAILURE);
+}
+
+static void known_answers(enum impl impl)
+{
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); ++v) {
+        size_t len = strlen(vectors[v].msg);
+        size_t size = len * vectors[v].repeat;
+        uint8_t* buf = malloc(size + 1);
+        for (size_t i = 0; i < vectors[v].repeat; ++i) {
+            memcpy(buf + i * len, vectors[v].msg, len);
+        }
+
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        char str[SHA256_DIGEST_SIZE * 2 + 1];
+        if (impl == IMPL_AVX2) {
+            /* Same message in every lane, plus an empty one to keep lanes uneven */
+            const void* data[SHA256_LANES + 1];
+            size_t sizes[SHA256_LANES + 1];
+            uint8_t digests[SHA256_LANES + 1][SHA256_DIGEST_SIZE];
+            for (int i = 0; i <= SHA256_LANES; ++i) {
+                data[i] = buf;
+                sizes[i] = i == SHA256_LANES / 2 ? 0 : size;
+            }
+            sha256_multi(data, sizes, SHA256_LANES + 1, digests);
+            for (int i = 0; i <= SHA256_LANES; ++i) {
+                hex(digests[i], str);
+                if (strcmp(str, i == SHA256_LANES / 2 ? vectors[0].digest : vectors[v].digest)) {
+                    fail(impl, "known answer", sizes[i]);
+                }
+            }
+        } else {
+            sha256(buf, size, digest);
+            hex(digest, str);
+            if (strcmp(str, vectors[v].digest)) {
+                fail(impl, "known answer", size);
+            }
+        }
+
+        free(buf);
+    }
+}
+
+/** Random sizes against portable one-shot hashing, streams are fed in random chunks */
+static void cross_check(enum impl impl, const uint8_t* buf, size_t buf_size)
+{
+    for (int iter = 0; iter < 200; ++iter) {
+        size_t count = 1 + rand() % 20;
+        const void* data[20];
+        size_t sizes[20];
+        uint8_t ref[20][SHA256_DIGEST_SIZE], out[20][SHA256_DIGEST_SIZE];
+
+        select_impl(IMPL_C);
+        for (size_t i = 0; i < count; ++i) {
+            sizes[i] = rand() % (iter < 100 ? 300 : 20000);
+            data[i] = buf + rand() % (buf_size - sizes[i]);
+            sha256(data[i], sizes[i], ref[i]);
+        }
+
+        select_impl(impl);
+        if (impl == IMPL_AVX2) {
+            sha256_multi(data, sizes, count, out);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                struct sha256 ctx;
+                sha256_init(&ctx);
+                for (size_t pos = 0; pos < sizes[i]; ) {
+                    size_t n = rand() % 200;
+                    n = n < sizes[i] - pos ? n : sizes[i] - pos;
+                    sha256_update(&ctx, (const uint8_t*)data[i] + pos, n);
+                    pos += n;
+                }
+                sha256_final(&ctx, out[i]);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (memcmp(ref[i], out[i], SHA256_DIGEST_SIZE)) {
+                fail(impl, "cross check", sizes[i]);
+            }
+        }
+    }
+}
+
+static void bench(enum impl impl, const uint8_t* buf, size_t size)
+{
+    const void* data[SHA256_LANES];
+    size_t sizes[SHA256_LANES];
+    uint8_t digests[SHA256_LANES][SHA256_DIGEST_SIZE];
+    for (int i = 0; i < SHA256_LANES; ++i) {
+        data[i] = buf + i * (size / SHA256_LANES);
+        sizes[i] = size / SHA256_LANES;
+    }
+
+    unsigned iters = 0;
+    double start = now_s();
+    double elapsed;
+    do {
+        if (impl == IMPL_AVX2) {
+            sha256_multi(data, sizes, SHA256_LANES, digests);
+        } else {
+            sha256(buf, size, digests[0]);
+        }
+        ++iters;
+        elapsed = now_s() - start;
+    } while (elapsed < 1.0);
+
+    printf("%-8s: %zu MB, %u runs, %.2f GB/s\n", impl_names[impl], size >> 20, iters, (double)size * iters / elapsed / 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = (argc > 1 ? strtoull(argv[1], NULL, 0) : 64) << 20;
+    if (argc > 2 || size < (1 << 20)) {
+        fprintf(stderr, "usage: %s [size in MB]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t* buf = malloc(size);
+    srand(1);
+    for (size_t i = 0; i < size; ++i) {
+        buf[i] = rand();
+    }
+
+    host_cpuid();
+    for (int impl = 0; impl < IMPL_COUNT; ++impl) {
+        if (!select_impl(impl)) {
+            printf("%-8s: not supported by host CPU\n", impl_names[impl]);
+            continue;
+        }
+
+        known_answers(impl);
+        cross_check(impl, buf, size);
+        select_impl(impl);
+        bench(impl, buf, size);
+    }
+
+    return EXIT_SUCCESS;
+}
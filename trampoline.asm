@@ -0,0 +1,116 @@
+;
+; Application processor startup trampoline
+;
+; init_smp copies code between smp_trampoline_start and smp_trampoline_end to SMP_TRAMPOLINE_BASE,
+; APs start executing it in real mode after SIPI. Like the BSP, they go from real mode straight to long mode,
+; reusing identity map page tables BSP has built, then pick their stack and call ap_start.
+;
+
+; keep in sync with include/datamap.h
+%define SMP_BOOT_ADDR       0x7000
+%define SMP_TRAMPOLINE_BASE 0x8000
+%define PML4_BASE           0x100000
+
+; GDT selectors, keep in sync with entry16.asm
+%define SEL_CODE64  0x18
+%define SEL_DATA    0x10
+
+; keep in sync with struct smp_boot in include/smp.h
+struc smp_boot
+    .next_index:    resd 1
+    .stack_size:    resd 1
+    .stacks:        resq 1
+    .max_index:     resd 1
+endstruc
+
+; Trampoline is position dependent: addresses are computed from its final location
+%define TRAMPOLINE_REL(label)   ((label) - smp_trampoline_start)
+%define TRAMPOLINE_ADDR(label)  (TRAMPOLINE_REL(label) + SMP_TRAMPOLINE_BASE)
+
+extern gdt64
+extern idt64
+extern ap_start
+
+; Trampoline is only copied from ROM, it is never executed in place
+section .rodata
+
+global smp_trampoline_start
+global smp_trampoline_end
+
+use16
+smp_trampoline_start:
+    cli
+    cld
+
+    ; CS is SIPI vector page
+    mov     ax, cs
+    mov     ds, ax
+    o32 lgdt [TRAMPOLINE_REL(trampoline_gdt_ptr)]
+
+    ; Same CR4, CR3, EFER and CR0 setup as BSP does in entry16.asm
+    mov     eax, 0x00000620
+    mov     cr4, eax
+
+    mov     eax, PML4_BASE
+    mov     cr3, eax
+
+    mov     ecx, 0xC0000080
+    rdmsr
+    or      eax, 0x100
+    wrmsr
+
+    mov     eax, 0x80000003
+    mov     cr0, eax
+
+    jmp     SEL_CODE64:dword TRAMPOLINE_ADDR(.now_in_64bit_mode)
+
+use64
+.now_in_64bit_mode:
+    mov     ax, SEL_DATA
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     gs, ax
+    mov     ss, ax
+
+    ; Switch to ROM GDT and IDT
+    lgdt    [a32 gdt64]
+    lidt    [a32 idt64]
+
+    ; Claim AP index, BSP is 0
+    mov     eax, 1
+    lock xadd [SMP_BOOT_ADDR + smp_boot.next_index], eax
+
+    ; More APs than CMOS count have no stack, park them
+    cmp     eax, [SMP_BOOT_ADDR + smp_boot.max_index]
+    ja      .halt
+
+    ; Stack for AP N ends at stacks + N * stack_size
+    mov     edi, eax
+    mov     ecx, [SMP_BOOT_ADDR + smp_boot.stack_size]
+    imul    rcx, rdi
+    add     rcx, [SMP_BOOT_ADDR + smp_boot.stacks]
+    mov     rsp, rcx
+
+    mov     rax, ap_start
+    call    rax
+
+.halt:
+    cli
+    hlt
+    jmp     .halt
+
+; Temporary GDT to get into long mode, selectors match the ROM one
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0
+    dq 0x00CF93000000FFFF   ; SEL_DATA
+    dq 0x00AF9F000000FFFF   ; SEL_CODE64
+trampoline_gdt_end:
+
+trampoline_gdt_ptr:
+    dw trampoline_gdt_end - trampoline_gdt - 1
+    dd TRAMPOLINE_ADDR(trampoline_gdt)
+
+smp_trampoline_end:
@@ -0,0 +1,601 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "virtio_blk.h"
+#include "pci.h"
+#include "pci_enum.h"
+#include "page_alloc.h"
+#include "clock.h"
+#include "logging.h"
+
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK       0x1042  /* Modern-only */
+#define VIRTIO_PCI_DEVICE_BLK_TRANS 0x1001  /* Transitional, modern interface is there if capabilities are */
+
+/** Config registers */
+#define PCI_REG_COMMAND     0x04
+#define PCI_REG_STATUS      0x06
+#define PCI_REG_CAP_PTR     0x34
+
+#define PCI_COMMAND_MEM     (1u << 1)
+#define PCI_COMMAND_MASTER  (1u << 2)
+#define PCI_STATUS_CAP_LIST (1u << 4)
+
+#define PCI_CAP_ID_VENDOR   0x09
+
+/** Vendor capability layout: cfg_type, bar, offset and length of a config structure */
+#define VIRTIO_CAP_CFG_TYPE 3
+#define VIRTIO_CAP_BAR      4
+#define VIRTIO_CAP_OFFSET   8
+#define VIRTIO_CAP_LENGTH   12
+#define VIRTIO_CAP_NOTIFY_MULT 16
+
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+/** Device status bits */
+#define VIRTIO_STATUS_ACKNOWLEDGE   1
+#define VIRTIO_STATUS_DRIVER        2
+#define VIRTIO_STATUS_DRIVER_OK     4
+#define VIRTIO_STATUS_FEATURES_OK   8
+#define VIRTIO_STATUS_FAILED        0x80
+
+/** Feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX       (1ull << 1)
+#define VIRTIO_BLK_F_SEG_MAX        (1ull << 2)
+#define VIRTIO_RING_F_EVENT_IDX     (1ull << 29)
+#define VIRTIO_F_VERSION_1          (1ull << 32)
+
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
+
+/** Request types and status */
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_S_OK     0
+
+/** Descriptor flags */
+#define VRING_DESC_F_NEXT   1
+#define VRING_DESC_F_WRITE  2
+
+/** Queue and request shape, clamped to what device offers */
+#define VIRTIO_BLK_QUEUE_MAX    256
+#define VIRTIO_BLK_REQ_SEGS     8
+#define VIRTIO_BLK_SEG_SIZE     (128u << 10)
+
+/** A request that does not complete in this time means device is gone */
+#define VIRTIO_BLK_TIMEOUT_NS   (5000ull * 1000 * 1000)
+
+/** Common config structure */
+struct virtio_pci_common_cfg {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint64_t queue_desc;
+    uint64_t queue_driver;
+    uint64_t queue_device;
+};
+
+_Static_assert(sizeof(struct virtio_pci_common_cfg) == 0x38, "Unexpected common config layout");
+
+/** Device config structure, fields we use */
+struct virtio_blk_config {
+    uint64_t capacity;      /* In 512-byte sectors */
+    uint32_t size_max;
+    uint32_t seg_max;
+};
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];        /* Followed by used_event */
+};
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];  /* Followed by avail_event */
+};
+
+struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+/** Header and status byte of a request, one per slot */
+struct virtio_blk_slot {
+    struct virtio_blk_req_hdr hdr;
+    uint8_t status;
+} __attribute__((aligned(32)));
+
+/**
+ * Descriptor table is split into fixed slots of header, data and status descriptors.
+ * Chains never change shape, only lengths and data addresses, so there is no free descriptor list:
+ * a slot is free or in flight as a whole, and used ring id is slot number times slot size.
+ */
+struct virtio_blk {
+    volatile struct virtio_pci_common_cfg* common;
+    volatile struct virtio_blk_config* config;
+    volatile uint16_t* notify;
+
+    struct vring_desc* desc;
+    volatile struct vring_avail* avail;
+    volatile struct vring_used* used;
+    struct virtio_blk_slot* slots;
+    void* rings;
+    unsigned rings_order;
+
+    uint64_t capacity;
+    uint16_t qsize;
+    uint16_t slot_descs;    /* Descriptors per slot: header, data segments, status */
+    uint16_t nslots;
+    uint16_t avail_idx;     /* Shadow of avail->idx */
+    uint16_t last_used;     /* Used ring entries up to here are reaped */
+    uint16_t nfree;
+    uint16_t free_slots[VIRTIO_BLK_QUEUE_MAX];
+    uint32_t seg_size;
+    bool event_idx;
+    bool present;
+
+    /* Stats */
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t requests;
+    uint64_t notifications;
+};
+
+static struct virtio_blk virtio_blk;
+
+static inline void pause(void)
+{
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+/** Full barrier: avail idx store should be visible before we look at avail_event */
+static inline void mb(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/** Compiler barrier, enough for ordering of WB memory stores and loads against device on x86 */
+static inline void barrier(void)
+{
+    __asm__ volatile ("" ::: "memory");
+}
+
+static inline volatile uint16_t* used_event(struct virtio_blk* blk)
+{
+    return &blk->avail->ring[blk->qsize];
+}
+
+static inline volatile uint16_t* avail_event(struct virtio_blk* blk)
+{
+    return (volatile uint16_t*)&blk->used->ring[blk->qsize];
+}
+
+/** Map a structure described by vendor capability at cap, returns NULL if its BAR is not usable */
+static volatile void* map_cap(const struct pci_device* dev, uint8_t cap)
+{
+    uint8_t bar = pci_read8(dev->bdf, cap + VIRTIO_CAP_BAR);
+    if (bar >= PCI_MAX_BARS || !dev->bars[bar].base || (dev->bars[bar].flags & PCI_BAR_IO)) {
+        return NULL;
+    }
+
+    uint32_t offset = pci_read32(dev->bdf, cap + VIRTIO_CAP_OFFSET);
+    uint32_t length = pci_read32(dev->bdf, cap + VIRTIO_CAP_LENGTH);
+    if ((uint64_t)offset + length > pci_bar_size(&dev->bars[bar])) {
+        return NULL;
+    }
+
+    return (volatile void*)(uintptr_t)(dev->bars[bar].base + offset);
+}
+
+/** Walk vendor capabilities for common, notify and device config structures */
+static bool find_caps(struct virtio_blk* blk, const struct pci_device* dev, uint32_t* notify_mult, uint8_t* notify_cap)
+{
+    if (!(pci_read16(dev->bdf, PCI_REG_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return false;
+    }
+
+    *notify_cap = 0;
+    for (uint8_t cap = pci_read8(dev->bdf, PCI_REG_CAP_PTR) & ~3; cap; cap = pci_read8(dev->bdf, cap + 1) & ~3) {
+        if (pci_read8(dev->bdf, cap) != PCI_CAP_ID_VENDOR) {
+            continue;
+        }
+
+        switch (pci_read8(dev->bdf, cap + VIRTIO_CAP_CFG_TYPE)) {
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            blk->common = blk->common ? blk->common : map_cap(dev, cap);
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            if (!*notify_cap && map_cap(dev, cap)) {
+                *notify_cap = cap;
+                *notify_mult = pci_read32(dev->bdf, cap + VIRTIO_CAP_NOTIFY_MULT);
+            }
+            break;
+        case VIRTIO_PCI_CAP_DEVICE_CFG:
+            blk->config = blk->config ? blk->config : map_cap(dev, cap);
+            break;
+        }
+    }
+
+    return blk->common && blk->config && *notify_cap;
+}
+
+static uint64_t read_device_features(volatile struct virtio_pci_common_cfg* common)
+{
+    common->device_feature_select = 0;
+    uint64_t lo = common->device_feature;
+    common->device_feature_select = 1;
+    uint64_t hi = common->device_feature;
+    return (hi << 32) | lo;
+}
+
+static void write_driver_features(volatile struct virtio_pci_common_cfg* common, uint64_t features)
+{
+    common->driver_feature_select = 0;
+    common->driver_feature = (uint32_t)features;
+    common->driver_feature_select = 1;
+    common->driver_feature = (uint32_t)(features >> 32);
+}
+
+/** Allocate rings and request slots in one block and hand queue 0 to device */
+static bool setup_queue(struct virtio_blk* blk, uint8_t notify_cap, uint32_t notify_mult, const struct pci_device* dev)
+{
+    volatile struct virtio_pci_common_cfg* common = blk->common;
+
+    common->queue_select = 0;
+    uint16_t qsize = common->queue_size;
+    if (!qsize) {
+        return false;
+    }
+
+    /* Split ring queue size is a power of 2, so halving keeps it valid */
+    while (qsize > VIRTIO_BLK_QUEUE_MAX) {
+        qsize >>= 1;
+    }
+    if (qsize < blk->slot_descs) {
+        return false;
+    }
+
+    size_t desc_size = qsize * sizeof(struct vring_desc);
+    size_t avail_size = sizeof(struct vring_avail) + (qsize + 1) * sizeof(uint16_t);
+    size_t used_off = (desc_size + avail_size + 3) & ~3ul;
+    size_t used_size = sizeof(struct vring_used) + qsize * sizeof(struct vring_used_elem) + sizeof(uint16_t);
+    size_t slots_off = (used_off + used_size + 31) & ~31ul;
+    size_t nslots = qsize / blk->slot_descs;
+    size_t total = slots_off + nslots * sizeof(struct virtio_blk_slot);
+
+    blk->rings_order = page_order(total);
+    uint8_t* rings = page_alloc(blk->rings_order);
+    assert(rings);
+    memset(rings, 0, PAGE_SIZE << blk->rings_order);
+
+    blk->rings = rings;
+    blk->desc = (struct vring_desc*)rings;
+    blk->avail = (volatile struct vring_avail*)(rings + desc_size);
+    blk->used = (volatile struct vring_used*)(rings + used_off);
+    blk->slots = (struct virtio_blk_slot*)(rings + slots_off);
+    blk->qsize = qsize;
+    blk->nslots = nslots;
+
+    /* Chain shape is fixed: header, data segments, status. Only data lengths and addresses change per request */
+    for (uint16_t s = 0; s < nslots; ++s) {
+        struct vring_desc* d = &blk->desc[s * blk->slot_descs];
+        d[0] = (struct vring_desc){ (uintptr_t)&blk->slots[s].hdr, sizeof(struct virtio_blk_req_hdr), VRING_DESC_F_NEXT, s * blk->slot_descs + 1 };
+        blk->free_slots[s] = s;
+    }
+    blk->nfree = nslots;
+
+    /* We never take interrupts: used_event trails used idx so device never thinks we want one */
+    *used_event(blk) = (uint16_t)(blk->last_used - 1);
+
+    common->queue_size = qsize;
+    common->queue_msix_vector = VIRTIO_MSI_NO_VECTOR;
+    common->queue_desc = (uintptr_t)blk->desc;
+    common->queue_driver = (uintptr_t)blk->avail;
+    common->queue_device = (uintptr_t)blk->used;
+
+    volatile uint8_t* notify_base = map_cap(dev, notify_cap);
+    blk->notify = (volatile uint16_t*)(notify_base + (uint32_t)common->queue_notify_off * notify_mult);
+
+    common->queue_enable = 1;
+    return true;
+}
+
+bool init_virtio_blk(void)
+{
+    struct virtio_blk* blk = &virtio_blk;
+    memset(blk, 0, sizeof(*blk));
+
+    const struct pci_device* dev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, NULL);
+    if (!dev) {
+        dev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK_TRANS, NULL);
+    }
+    if (!dev) {
+        return false;
+    }
+
+    uint8_t notify_cap;
+    uint32_t notify_mult = 0;
+    if (!find_caps(blk, dev, &notify_mult, &notify_cap)) {
+        LOG_ERROR("virtio-blk: %x: no usable modern capabilities, legacy interface is not supported\n", dev->bdf);
+        return false;
+    }
+
+    pci_write16(dev->bdf, PCI_REG_COMMAND, dev->command | PCI_COMMAND_MEM | PCI_COMMAND_MASTER);
+
+    volatile struct virtio_pci_common_cfg* common = blk->common;
+    common->device_status = 0;
+    while (common->device_status != 0) {
+        pause();
+    }
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+    uint64_t features = read_device_features(common);
+    if (!(features & VIRTIO_F_VERSION_1)) {
+        LOG_ERROR("virtio-blk: device does not offer VIRTIO_F_VERSION_1\n");
+        common->device_status = VIRTIO_STATUS_FAILED;
+        return false;
+    }
+
+    features &= VIRTIO_F_VERSION_1 | VIRTIO_RING_F_EVENT_IDX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_SIZE_MAX;
+    write_driver_features(common, features);
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK;
+    if (!(common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        LOG_ERROR("virtio-blk: device did not accept features 0x%llx\n", features);
+        common->device_status = VIRTIO_STATUS_FAILED;
+        return false;
+    }
+
+    blk->event_idx = (features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    blk->capacity = blk->config->capacity;
+
+    uint32_t segs = VIRTIO_BLK_REQ_SEGS;
+    if ((features & VIRTIO_BLK_F_SEG_MAX) && blk->config->seg_max && blk->config->seg_max < segs) {
+        segs = blk->config->seg_max;
+    }
+    blk->slot_descs = segs + 2;
+
+    blk->seg_size = VIRTIO_BLK_SEG_SIZE;
+    if ((features & VIRTIO_BLK_F_SIZE_MAX) && blk->config->size_max && blk->config->size_max < blk->seg_size) {
+        blk->seg_size = blk->config->size_max & ~(VIRTIO_BLK_SECTOR_SIZE - 1);
+    }
+
+    if (!blk->seg_size || !setup_queue(blk, notify_cap, notify_mult, dev)) {
+        LOG_ERROR("virtio-blk: could not set up request queue\n");
+        common->device_status = VIRTIO_STATUS_FAILED;
+        return false;
+    }
+
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK;
+    blk->present = true;
+
+    LOG_INFO("virtio-blk: %x: %llu MB, queue %u, %u requests of %u x %u KB in flight, event idx %s\n",
+             dev->bdf, (blk->capacity * VIRTIO_BLK_SECTOR_SIZE) >> 20, blk->qsize, blk->nslots,
+             segs, blk->seg_size >> 10, blk->event_idx ? "on" : "off");
+    return true;
+}
+
+bool virtio_blk_present(void)
+{
+    return virtio_blk.present;
+}
+
+uint64_t virtio_blk_size(void)
+{
+    return virtio_blk.capacity * VIRTIO_BLK_SECTOR_SIZE;
+}
+
+/** Cursor over scatter list, skipped regions are consumed when request is built */
+struct sg_cursor {
+    const struct virtio_blk_sg* sg;
+    size_t count;
+    uint32_t offset;    /* Within current element */
+    uint64_t sector;    /* Disk position of cursor */
+};
+
+/** Fill data descriptors of slot from cursor, returns bytes covered, 0 if cursor is done */
+static uint32_t build_request(struct virtio_blk* blk, uint16_t slot, struct sg_cursor* cur)
+{
+    /* Skips do not take descriptors, they just move disk position */
+    while (cur->count && (!cur->sg->buf || cur->offset == cur->sg->size)) {
+        cur->sector += (cur->sg->size - cur->offset) / VIRTIO_BLK_SECTOR_SIZE;
+        cur->sg++;
+        cur->count--;
+        cur->offset = 0;
+    }
+
+    if (!cur->count) {
+        return 0;
+    }
+
+    struct vring_desc* d = &blk->desc[slot * blk->slot_descs];
+    uint16_t head = slot * blk->slot_descs;
+    uint16_t n = 1;
+    uint32_t bytes = 0;
+
+    /* Request ends at a skip or when data descriptors run out, each descriptor links to the next slot entry */
+    while (n < blk->slot_descs - 1 && cur->count && cur->sg->buf && cur->offset != cur->sg->size) {
+        uint32_t len = cur->sg->size - cur->offset;
+        if (len > blk->seg_size) {
+            len = blk->seg_size;
+        }
+
+        d[n] = (struct vring_desc){ (uintptr_t)cur->sg->buf + cur->offset, len, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE, head + n + 1 };
+        ++n;
+        bytes += len;
+
+        cur->offset += len;
+        if (cur->offset == cur->sg->size) {
+            cur->sg++;
+            cur->count--;
+            cur->offset = 0;
+        }
+    }
+
+    struct virtio_blk_slot* s = &blk->slots[slot];
+    s->hdr = (struct virtio_blk_req_hdr){ VIRTIO_BLK_T_IN, 0, cur->sector };
+    s->status = 0xFF;
+    d[n] = (struct vring_desc){ (uintptr_t)&s->status, 1, VRING_DESC_F_WRITE, 0 };
+
+    cur->sector += bytes / VIRTIO_BLK_SECTOR_SIZE;
+    return bytes;
+}
+
+/** Publish queued avail entries, ring doorbell unless device told us it does not need it yet */
+static void kick(struct virtio_blk* blk, uint16_t old_idx)
+{
+    barrier();
+    blk->avail->idx = blk->avail_idx;
+    mb();
+
+    bool notify = true;
+    if (blk->event_idx) {
+        uint16_t event = *avail_event(blk);
+        notify = (uint16_t)(blk->avail_idx - event - 1) < (uint16_t)(blk->avail_idx - old_idx);
+    }
+
+    if (notify) {
+        *blk->notify = 0;
+        blk->notifications++;
+    }
+}
+
+/** Reap completed requests, returns false on device error */
+static bool reap(struct virtio_blk* blk)
+{
+    bool ok = true;
+    uint16_t used_idx = blk->used->idx;
+    barrier();
+
+    for (; blk->last_used != used_idx; ++blk->last_used) {
+        uint16_t slot = blk->used->ring[blk->last_used & (blk->qsize - 1)].id / blk->slot_descs;
+        if (blk->slots[slot].status != VIRTIO_BLK_S_OK) {
+            LOG_ERROR("virtio-blk: read at sector %llu failed with status %u\n", blk->slots[slot].hdr.sector, blk->slots[slot].status);
+            ok = false;
+        }
+        blk->free_slots[blk->nfree++] = slot;
+    }
+
+    *used_event(blk) = (uint16_t)(blk->last_used - 1);
+    return ok;
+}
+
+bool virtio_blk_read_sg(uint64_t sector, const struct virtio_blk_sg* sg, size_t count)
+{
+    struct virtio_blk* blk = &virtio_blk;
+    assert(blk->present);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        assert(sg[i].size % VIRTIO_BLK_SECTOR_SIZE == 0);
+        total += sg[i].size;
+    }
+
+    if (sector * VIRTIO_BLK_SECTOR_SIZE + total > virtio_blk_size()) {
+        LOG_ERROR("virtio-blk: read of %llu bytes at sector %llu is past end of disk\n", total, sector);
+        return false;
+    }
+
+    struct sg_cursor cur = { sg, count, 0, sector };
+    uint64_t start = now_ns();
+    uint64_t progress = start;
+    bool ok = true;
+    bool done = false;
+
+    while (!done || blk->nfree != blk->nslots) {
+        /* Fill every free slot, then publish the whole batch at once */
+        uint16_t old_idx = blk->avail_idx;
+        while (!done && blk->nfree) {
+            uint16_t slot = blk->free_slots[blk->nfree - 1];
+            uint32_t bytes = build_request(blk, slot, &cur);
+            if (!bytes) {
+                done = true;
+                break;
+            }
+
+            blk->nfree--;
+            blk->avail->ring[blk->avail_idx & (blk->qsize - 1)] = slot * blk->slot_descs;
+            blk->avail_idx++;
+            blk->requests++;
+            blk->bytes += bytes;
+        }
+
+        if (blk->avail_idx != old_idx) {
+            kick(blk, old_idx);
+        }
+
+        if (blk->nfree == blk->nslots) {
+            continue;
+        }
+
+        while (blk->used->idx == blk->last_used) {
+            if (now_ns() - progress > VIRTIO_BLK_TIMEOUT_NS) {
+                LOG_ERROR("virtio-blk: device stopped completing requests\n");
+                virtio_blk_shutdown();
+                return false;
+            }
+            pause();
+        }
+
+        ok = reap(blk) && ok;
+        progress = now_ns();
+    }
+
+    blk->ns += now_ns() - start;
+    return ok;
+}
+
+void virtio_blk_report(void)
+{
+    const struct virtio_blk* blk = &virtio_blk;
+    if (!blk->present || !blk->requests) {
+        return;
+    }
+
+    uint64_t us = blk->ns / 1000;
+    LOG_INFO("virtio-blk: read %llu KB in %llu us, %llu MB/s, %llu requests, %llu notifications\n",
+             blk->bytes >> 10, us, us ? blk->bytes / us : 0, blk->requests, blk->notifications);
+}
+
+void virtio_blk_shutdown(void)
+{
+    struct virtio_blk* blk = &virtio_blk;
+    if (!blk->present) {
+        return;
+    }
+
+    blk->common->device_status = 0;
+    while (blk->common->device_status != 0) {
+        pause();
+    }
+
+    page_free(blk->rings, blk->rings_order);
+    blk->present = false;
+}